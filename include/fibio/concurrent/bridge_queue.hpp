@@ -0,0 +1,138 @@
+//
+//  bridge_queue.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_bridge_queue_hpp
+#define fibio_bridge_queue_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <fibio/fibers/future/oneshot.hpp>
+#include <fibio/concurrent/ring_queue.hpp>
+
+namespace fibio {
+namespace concurrent {
+namespace detail {
+
+/**
+ * Condition variable can be waited by fibers and threads
+ *
+ * Every waiter parks on its own oneshot future, a fiber is paused and resumed with one post,
+ * a thread blocks on futex. The associated mutex is a `std::mutex` and is only held for short
+ * non-blocking sections, so fibers can take it as well.
+ */
+class hybrid_condition_variable
+{
+public:
+    hybrid_condition_variable() = default;
+
+    hybrid_condition_variable(const hybrid_condition_variable&) = delete;
+
+    void operator=(const hybrid_condition_variable&) = delete;
+
+    /// Must be called with lock held, no spurious wakeup
+    void wait(std::unique_lock<std::mutex>& lock)
+    {
+        waiter w;
+        fibers::oneshot_future<void> f = w.promise_.get_future();
+        link(w);
+        lock.unlock();
+        f.wait();
+        // The notifier holds the mutex until it finishes with `w`
+        lock.lock();
+    }
+
+    /// Must be called with lock held, returns timeout only if nobody has notified this waiter
+    template <class Clock, class Duration>
+    std::cv_status wait_until(std::unique_lock<std::mutex>& lock,
+                              const std::chrono::time_point<Clock, Duration>& timeout_time)
+    {
+        waiter w;
+        fibers::oneshot_future<void> f = w.promise_.get_future();
+        link(w);
+        lock.unlock();
+        auto st = f.wait_until(std::chrono::steady_clock::now()
+                               + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                     timeout_time - Clock::now()));
+        lock.lock();
+        if (st == fibers::future_status::timeout && !w.notified_) {
+            unlink(w);
+            return std::cv_status::timeout;
+        }
+        return std::cv_status::no_timeout;
+    }
+
+    /// Must be called with the mutex held
+    void notify_one()
+    {
+        if (waiter* w = head_) {
+            unlink(*w);
+            w->notified_ = true;
+            w->promise_.set_value();
+        }
+    }
+
+    /// Must be called with the mutex held
+    void notify_all()
+    {
+        while (head_) notify_one();
+    }
+
+private:
+    struct waiter
+    {
+        fibers::oneshot_promise<void> promise_;
+        waiter* prev_ = 0;
+        waiter* next_ = 0;
+        bool notified_ = false;
+    };
+
+    // FIFO, so waiters are woken in arrival order
+    void link(waiter& w)
+    {
+        w.prev_ = tail_;
+        w.next_ = 0;
+        if (tail_)
+            tail_->next_ = &w;
+        else
+            head_ = &w;
+        tail_ = &w;
+    }
+
+    void unlink(waiter& w)
+    {
+        if (w.prev_)
+            w.prev_->next_ = w.next_;
+        else
+            head_ = w.next_;
+        if (w.next_)
+            w.next_->prev_ = w.prev_;
+        else
+            tail_ = w.prev_;
+    }
+
+    waiter* head_ = 0;
+    waiter* tail_ = 0;
+};
+
+} // End of namespace detail
+
+/**
+ * Bounded queue, both ends can be fibers or plain threads
+ *
+ * A full push or an empty pop parks a fiber cooperatively or blocks a thread on futex, there is
+ * no helper fiber or thread involved in the handoff. The fast path is the same lock-free ring as
+ * `ring_queue`.
+ */
+template <typename T>
+using bridge_queue
+    = basic_ring_queue<T, std::unique_lock<std::mutex>, detail::hybrid_condition_variable>;
+
+} // End of namespace concurrent
+} // End of namespace fibio
+
+#endif
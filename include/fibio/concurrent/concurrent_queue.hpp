@@ -9,6 +9,7 @@
 #ifndef fibio_concurrent_queue_hpp
 #define fibio_concurrent_queue_hpp
 
+#include <chrono>
 #include <limits>
 #include <deque>
 #include <queue>
@@ -30,13 +31,110 @@ enum class queue_op_status
     empty,
     full,
     closed,
+    timeout,
 };
 
-template <typename T, typename LockType, typename CVType, typename Container = std::deque<T>>
+namespace detail {
+
+/// Something parked on several queues, i.e. `select`
+struct selector_base
+{
+    /// Returns false if the selector has already been fired by another queue
+    virtual bool fire(std::size_t index) = 0;
+
+protected:
+    ~selector_base() {}
+};
+
+/// Registration of a selector in a queue, lives on the stack of the selecting fiber
+struct select_waiter
+{
+    selector_base* selector_ = 0;
+    std::size_t index_ = 0;
+    select_waiter* prev_ = 0;
+    select_waiter* next_ = 0;
+    bool linked_ = false;
+};
+
+/// Intrusive list of selectors, protected by the queue mutex
+struct select_list
+{
+    void link(select_waiter& w)
+    {
+        w.prev_ = 0;
+        w.next_ = head_;
+        if (head_) head_->prev_ = &w;
+        head_ = &w;
+        w.linked_ = true;
+    }
+
+    void unlink(select_waiter& w)
+    {
+        if (!w.linked_) return;
+        if (w.prev_)
+            w.prev_->next_ = w.next_;
+        else
+            head_ = w.next_;
+        if (w.next_) w.next_->prev_ = w.prev_;
+        w.linked_ = false;
+    }
+
+    void fire_one()
+    {
+        for (select_waiter* w = head_; w; w = w->next_) {
+            if (w->selector_->fire(w->index_)) return;
+        }
+    }
+
+    void fire_all()
+    {
+        for (select_waiter* w = head_; w; w = w->next_) w->selector_->fire(w->index_);
+    }
+
+private:
+    select_waiter* head_ = 0;
+};
+
+/// Drops expired elements of queues with an eviction policy, see `d_ary_heap`
+template <typename Queue>
+inline auto evict_expired(Queue& q, int) -> decltype(std::size_t(q.evict()))
+{
+    return q.evict();
+}
+
+template <typename Queue>
+inline std::size_t evict_expired(Queue&, long)
+{
+    return 0;
+}
+
+template <typename Queue>
+inline auto evicted_count(const Queue& q, int) -> decltype(std::size_t(q.evicted()))
+{
+    return q.evicted();
+}
+
+template <typename Queue>
+inline std::size_t evicted_count(const Queue&, long)
+{
+    return 0;
+}
+
+} // End of namespace detail
+
+/**
+ * `Queue` decides the order of elements, it needs `std::queue` interface, i.e. `front`, `push`,
+ * `pop`, `size` and `empty`, see `d_ary_heap` for a priority order
+ */
+template <typename T,
+          typename LockType,
+          typename CVType,
+          typename Container = std::deque<T>,
+          typename Queue = std::queue<T, Container>>
 struct basic_concurrent_queue
 {
-    typedef basic_concurrent_queue<T, LockType, CVType, Container> this_type;
-    typedef std::queue<T, Container> queue_type;
+    typedef basic_concurrent_queue<T, LockType, CVType, Container, Queue> this_type;
+    typedef Queue queue_type;
     typedef typename LockType::mutex_type mutex_type;
 
     typedef typename queue_type::container_type container_type;
@@ -76,6 +174,9 @@ struct basic_concurrent_queue
         opened_ = false;
         full_cv_.notify_all();
         empty_cv_.notify_all();
+        // Closed queue is ready for both push and pop, they will return closed
+        pop_selectors_.fire_all();
+        push_selectors_.fire_all();
     }
 
     /**
@@ -98,7 +199,7 @@ struct basic_concurrent_queue
             return queue_op_status::closed;
         }
         // Wait until queue is closed or not full
-        while ((the_queue_.size() >= capacity_) && opened_) {
+        while ((queue_size() >= capacity_) && opened_) {
             full_cv_.wait(lock);
         }
         if (!opened_) {
@@ -106,7 +207,7 @@ struct basic_concurrent_queue
             return queue_op_status::closed;
         }
         the_queue_.push(data);
-        empty_cv_.notify_one();
+        notify_pop_ready();
         return queue_op_status::success;
     }
 
@@ -121,7 +222,7 @@ struct basic_concurrent_queue
             return queue_op_status::closed;
         }
         // Wait until queue is closed or not full
-        while ((the_queue_.size() >= capacity_) && opened_) {
+        while ((queue_size() >= capacity_) && opened_) {
             full_cv_.wait(lock);
         }
         if (!opened_) {
@@ -129,7 +230,7 @@ struct basic_concurrent_queue
             return queue_op_status::closed;
         }
         the_queue_.push(std::move(data));
-        empty_cv_.notify_one();
+        notify_pop_ready();
         return queue_op_status::success;
     }
 
@@ -157,9 +258,9 @@ struct basic_concurrent_queue
             // Cannot push into a closed queue
             return first;
         }
-        for (; first != last && the_queue_.size() < capacity_; ++first) {
+        for (; first != last && queue_size() < capacity_; ++first) {
             the_queue_.push(*first);
-            empty_cv_.notify_one();
+            notify_pop_ready();
         }
         return first;
     }
@@ -178,7 +279,7 @@ struct basic_concurrent_queue
         }
         while (first != last) {
             the_queue_.push(*first);
-            empty_cv_.notify_one();
+            notify_pop_ready();
             ++first;
         }
         return queue_op_status::success;
@@ -196,11 +297,11 @@ struct basic_concurrent_queue
             return queue_op_status::closed;
         }
         // Check if the queue is full
-        if (the_queue_.size() >= capacity_) {
+        if (queue_size() >= capacity_) {
             return queue_op_status::full;
         }
         the_queue_.push(std::move(data));
-        empty_cv_.notify_one();
+        notify_pop_ready();
         return queue_op_status::success;
     }
 
@@ -216,11 +317,11 @@ struct basic_concurrent_queue
             return queue_op_status::closed;
         }
         // Check if the queue is full
-        if (the_queue_.size() >= capacity_) {
+        if (queue_size() >= capacity_) {
             return queue_op_status::full;
         }
         the_queue_.push(std::move(data));
-        empty_cv_.notify_one();
+        notify_pop_ready();
         return queue_op_status::success;
     }
 
@@ -232,26 +333,7 @@ struct basic_concurrent_queue
     inline queue_op_status try_push_for(const T& data,
                                         const std::chrono::duration<Rep, Period>& timeout_duration)
     {
-        LockType lock(the_mutex_);
-        if (!opened_) {
-            // Cannot push into a closed queue
-            return queue_op_status::closed;
-        }
-        // Wait until queue is closed or not full
-        std::cv_status ret = cv_status::no_timeout;
-        while ((the_queue_.size() >= capacity_) && opened_) {
-            ret = full_cv_.wait_for(lock, timeout_duration);
-        }
-        if (!opened_) {
-            // Queue closed
-            return queue_op_status::closed;
-        }
-        if (ret == cv_status::no_timeout) {
-            the_queue_.push(std::move(data));
-            empty_cv_.notify_one();
-            return queue_op_status::success;
-        }
-        return queue_op_status::full;
+        return try_push_until(data, std::chrono::steady_clock::now() + timeout_duration);
     }
 
     /**
@@ -262,26 +344,7 @@ struct basic_concurrent_queue
     inline queue_op_status try_push_for(T&& data,
                                         const std::chrono::duration<Rep, Period>& timeout_duration)
     {
-        LockType lock(the_mutex_);
-        if (!opened_) {
-            // Cannot push into a closed queue
-            return queue_op_status::closed;
-        }
-        // Wait until queue is closed or not full
-        std::cv_status ret = cv_status::no_timeout;
-        while ((the_queue_.size() >= capacity_) && opened_) {
-            ret = full_cv_.wait_for(lock, timeout_duration);
-        }
-        if (!opened_) {
-            // Queue closed
-            return queue_op_status::closed;
-        }
-        if (ret == cv_status::no_timeout) {
-            the_queue_.push(std::move(data));
-            empty_cv_.notify_one();
-            return queue_op_status::success;
-        }
-        return queue_op_status::full;
+        return try_push_until(std::move(data), std::chrono::steady_clock::now() + timeout_duration);
     }
 
     /**
@@ -293,25 +356,11 @@ struct basic_concurrent_queue
     try_push_until(const T& data, const std::chrono::time_point<Clock, Duration>& timeout_time)
     {
         LockType lock(the_mutex_);
-        if (!opened_) {
-            // Cannot push into a closed queue
-            return queue_op_status::closed;
-        }
-        // Wait until queue is closed or not full
-        std::cv_status ret = cv_status::no_timeout;
-        while ((the_queue_.size() >= capacity_) && opened_) {
-            ret = full_cv_.wait_until(lock, timeout_time);
-        }
-        if (!opened_) {
-            // Queue closed
-            return queue_op_status::closed;
-        }
-        if (ret == cv_status::no_timeout) {
-            the_queue_.push(std::move(data));
-            empty_cv_.notify_one();
-            return queue_op_status::success;
-        }
-        return queue_op_status::full;
+        if (!wait_not_full(lock, timeout_time))
+            return opened_ ? queue_op_status::full : queue_op_status::closed;
+        the_queue_.push(data);
+        notify_pop_ready();
+        return queue_op_status::success;
     }
 
     /**
@@ -323,25 +372,11 @@ struct basic_concurrent_queue
     try_push_until(T&& data, const std::chrono::time_point<Clock, Duration>& timeout_time)
     {
         LockType lock(the_mutex_);
-        if (!opened_) {
-            // Cannot push into a closed queue
-            return queue_op_status::closed;
-        }
-        // Wait until queue is closed or not full
-        std::cv_status ret = cv_status::no_timeout;
-        while ((the_queue_.size() >= capacity_) && opened_) {
-            ret = full_cv_.wait_for(lock, timeout_time);
-        }
-        if (!opened_) {
-            // Queue closed
-            return queue_op_status::closed;
-        }
-        if (ret == cv_status::no_timeout) {
-            the_queue_.push(std::move(data));
-            empty_cv_.notify_one();
-            return queue_op_status::success;
-        }
-        return queue_op_status::full;
+        if (!wait_not_full(lock, timeout_time))
+            return opened_ ? queue_op_status::full : queue_op_status::closed;
+        the_queue_.push(std::move(data));
+        notify_pop_ready();
+        return queue_op_status::success;
     }
 
     /**
@@ -352,17 +387,17 @@ struct basic_concurrent_queue
     {
         LockType lock(the_mutex_);
         // Wait only if the queue is open and empty
-        while (the_queue_.empty() && opened_) {
+        while (queue_empty() && opened_) {
             empty_cv_.wait(lock);
         }
-        if (the_queue_.empty()) {
+        if (queue_empty()) {
             // Last loop ensure queue will not empty only if queue is closed
             // So here we have an empty and closed queue
             return queue_op_status::closed;
         }
         std::swap(popped_value, the_queue_.front());
         the_queue_.pop();
-        full_cv_.notify_one();
+        notify_push_ready();
         return queue_op_status::success;
     }
 
@@ -373,12 +408,12 @@ struct basic_concurrent_queue
     inline queue_op_status try_pop(T& popped_value)
     {
         LockType lock(the_mutex_);
-        if (the_queue_.empty()) {
+        if (queue_empty()) {
             return queue_op_status::empty;
         }
         std::swap(popped_value, the_queue_.front());
         the_queue_.pop();
-        full_cv_.notify_one();
+        notify_push_ready();
         return queue_op_status::success;
     }
 
@@ -390,24 +425,7 @@ struct basic_concurrent_queue
     inline queue_op_status try_pop_for(T& popped_value,
                                        const std::chrono::duration<Rep, Period>& timeout_duration)
     {
-        LockType lock(the_mutex_);
-        // Wait only if the queue is open and empty
-        std::cv_status ret = cv_status::no_timeout;
-        while (the_queue_.empty() && opened_) {
-            ret = empty_cv_.wait_for(lock, timeout_duration);
-        }
-        if (the_queue_.empty()) {
-            // Last loop ensure queue will not empty only if queue is closed
-            // So here we have an empty and closed queue
-            return queue_op_status::closed;
-        }
-        if (ret == cv_status::no_timeout) {
-            std::swap(popped_value, the_queue_.front());
-            the_queue_.pop();
-            full_cv_.notify_one();
-            return queue_op_status::success;
-        }
-        return queue_op_status::empty;
+        return try_pop_until(popped_value, std::chrono::steady_clock::now() + timeout_duration);
     }
 
     /**
@@ -421,21 +439,17 @@ struct basic_concurrent_queue
         LockType lock(the_mutex_);
         // Wait only if the queue is open and empty
         std::cv_status ret = cv_status::no_timeout;
-        while (the_queue_.empty() && opened_) {
+        while (queue_empty() && opened_ && ret == cv_status::no_timeout) {
             ret = empty_cv_.wait_until(lock, timeout_time);
         }
-        if (the_queue_.empty()) {
-            // Last loop ensure queue will not empty only if queue is closed
-            // So here we have an empty and closed queue
-            return queue_op_status::closed;
-        }
-        if (ret == cv_status::no_timeout) {
-            std::swap(popped_value, the_queue_.front());
-            the_queue_.pop();
-            full_cv_.notify_one();
-            return queue_op_status::success;
+        if (queue_empty()) {
+            // Either timeout or the queue is empty and closed
+            return opened_ ? queue_op_status::empty : queue_op_status::closed;
         }
-        return queue_op_status::empty;
+        std::swap(popped_value, the_queue_.front());
+        the_queue_.pop();
+        notify_push_ready();
+        return queue_op_status::success;
     }
 
     /**
@@ -450,16 +464,16 @@ struct basic_concurrent_queue
                                 size_type nelem = std::numeric_limits<size_type>::max())
     {
         LockType lock(the_mutex_);
-        if (the_queue_.empty()) {
+        if (queue_empty()) {
             return false;
         }
-        nelem = std::min(the_queue_.size(), nelem);
+        nelem = std::min(queue_size(), nelem);
         size_type i = 0;
         for (; i < nelem; i++) {
             std::swap(*oi, the_queue_.top());
             the_queue_.pop();
             oi++;
-            full_cv_.notify_one();
+            notify_push_ready();
         }
         return oi;
     }
@@ -502,6 +516,55 @@ struct basic_concurrent_queue
      */
     inline size_type capacity() const { return capacity_; }
 
+    /**
+     * Returns the number of expired elements dropped by a queue with an eviction policy
+     */
+    inline std::size_t evicted() const
+    {
+        LockType lock(the_mutex_);
+        return detail::evicted_count(the_queue_, 0);
+    }
+
+    /**
+     * Used by `select`, returns true if pop will not block, otherwise registers the waiter
+     */
+    inline bool select_pop_ready(detail::select_waiter& w)
+    {
+        LockType lock(the_mutex_);
+        if (!queue_empty() || !opened_) return true;
+        pop_selectors_.link(w);
+        return false;
+    }
+
+    /**
+     * Used by `select`, removes the waiter registered by `select_pop_ready`
+     */
+    inline void select_pop_cancel(detail::select_waiter& w)
+    {
+        LockType lock(the_mutex_);
+        pop_selectors_.unlink(w);
+    }
+
+    /**
+     * Used by `select`, returns true if push will not block, otherwise registers the waiter
+     */
+    inline bool select_push_ready(detail::select_waiter& w)
+    {
+        LockType lock(the_mutex_);
+        if (queue_size() < capacity_ || !opened_) return true;
+        push_selectors_.link(w);
+        return false;
+    }
+
+    /**
+     * Used by `select`, removes the waiter registered by `select_push_ready`
+     */
+    inline void select_push_cancel(detail::select_waiter& w)
+    {
+        LockType lock(the_mutex_);
+        push_selectors_.unlink(w);
+    }
+
     /**
      * Minimal range-based for loop support
      * It's not a fully functional iterator and should not be used directly
@@ -567,12 +630,61 @@ private:
 
     void operator=(const basic_concurrent_queue&) = delete;
 
+    // Returns true if the queue is open and not full, false on timeout or closed
+    template <class Clock, class Duration>
+    inline bool wait_not_full(LockType& lock,
+                              const std::chrono::time_point<Clock, Duration>& timeout_time)
+    {
+        std::cv_status ret = cv_status::no_timeout;
+        while ((queue_size() >= capacity_) && opened_ && ret == cv_status::no_timeout) {
+            ret = full_cv_.wait_until(lock, timeout_time);
+        }
+        return opened_ && queue_size() < capacity_;
+    }
+
+    // Called with the_mutex_ held, expired elements are dropped before the queue is checked and
+    // their slots are handed to blocked pushers, as if they were popped
+    inline bool queue_empty()
+    {
+        evict_expired();
+        return the_queue_.empty();
+    }
+
+    inline size_type queue_size()
+    {
+        evict_expired();
+        return the_queue_.size();
+    }
+
+    inline void evict_expired()
+    {
+        for (std::size_t n = detail::evict_expired(the_queue_, 0); n > 0; n--) {
+            notify_push_ready();
+        }
+    }
+
+    // Called with the_mutex_ held after an element is pushed
+    inline void notify_pop_ready()
+    {
+        empty_cv_.notify_one();
+        pop_selectors_.fire_one();
+    }
+
+    // Called with the_mutex_ held after an element is popped
+    inline void notify_push_ready()
+    {
+        full_cv_.notify_one();
+        push_selectors_.fire_one();
+    }
+
     bool opened_;
     const size_t capacity_;
     mutable mutex_type the_mutex_;
     CVType full_cv_;
     CVType empty_cv_;
     queue_type the_queue_;
+    detail::select_list pop_selectors_;
+    detail::select_list push_selectors_;
 };
 
 template <typename T, typename Container = std::deque<T>>
@@ -0,0 +1,185 @@
+//
+//  priority_queue.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_priority_queue_hpp
+#define fibio_priority_queue_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <fibio/fibers/mutex.hpp>
+#include <fibio/fibers/condition_variable.hpp>
+#include <fibio/concurrent/concurrent_queue.hpp>
+
+namespace fibio {
+namespace concurrent {
+
+/**
+ * Eviction policy of `d_ary_heap`, nothing expires
+ */
+struct never_expires
+{
+    template <typename T>
+    bool operator()(const T&) const
+    {
+        return false;
+    }
+};
+
+/**
+ * Eviction policy of `d_ary_heap`, an element expires when its deadline has passed
+ * `DeadlineOf` returns a `std::chrono::steady_clock::time_point` for an element
+ */
+template <typename DeadlineOf>
+struct expires_at_deadline
+{
+    template <typename T>
+    bool operator()(const T& v) const
+    {
+        return DeadlineOf()(v) <= std::chrono::steady_clock::now();
+    }
+};
+
+/**
+ * Comparator for `d_ary_heap`, the element with the earliest deadline is on the top
+ */
+template <typename DeadlineOf>
+struct earliest_deadline_first
+{
+    template <typename T>
+    bool operator()(const T& a, const T& b) const
+    {
+        return DeadlineOf()(b) < DeadlineOf()(a);
+    }
+};
+
+/**
+ * Heap with `Arity` children per node on a contiguous vector, with `std::queue` interface
+ *
+ * Same order as `std::priority_queue`, `front()` is the greatest element under `Compare`. A
+ * wider node makes the tree shallower and keeps siblings in the same cache line.
+ * `evict` drops expired elements on the top, so ordering by deadline makes every expired element
+ * evicted before any live one is returned. `basic_concurrent_queue` calls it before checking the
+ * heap and wakes up pushers for the freed slots.
+ */
+template <typename T,
+          typename Compare = std::less<T>,
+          std::size_t Arity = 4,
+          typename Expired = never_expires>
+class d_ary_heap
+{
+    static_assert(Arity >= 2, "d_ary_heap needs at least 2 children per node");
+
+public:
+    typedef std::vector<T> container_type;
+    typedef typename container_type::value_type value_type;
+    typedef typename container_type::size_type size_type;
+    typedef typename container_type::reference reference;
+    typedef typename container_type::const_reference const_reference;
+
+    explicit d_ary_heap(const Compare& comp = Compare(), const Expired& expired = Expired())
+    : comp_(comp), expired_(expired)
+    {
+    }
+
+    bool empty() const { return c_.empty(); }
+
+    size_type size() const { return c_.size(); }
+
+    reference front() { return c_.front(); }
+
+    const_reference front() const { return c_.front(); }
+
+    void push(const value_type& v)
+    {
+        c_.push_back(v);
+        sift_up(c_.size() - 1);
+    }
+
+    void push(value_type&& v)
+    {
+        c_.push_back(std::move(v));
+        sift_up(c_.size() - 1);
+    }
+
+    void pop()
+    {
+        if (c_.size() > 1) {
+            c_.front() = std::move(c_.back());
+            c_.pop_back();
+            sift_down(0);
+        } else {
+            c_.pop_back();
+        }
+    }
+
+    /// Drops expired elements on the top, returns the number of dropped elements
+    size_type evict()
+    {
+        size_type n = 0;
+        for (; !c_.empty() && expired_(c_.front()); n++) pop();
+        evicted_ += n;
+        return n;
+    }
+
+    /// Total number of elements dropped by `evict`
+    std::size_t evicted() const { return evicted_; }
+
+private:
+    void sift_up(size_type i)
+    {
+        value_type v(std::move(c_[i]));
+        while (i > 0) {
+            size_type parent = (i - 1) / Arity;
+            if (!comp_(c_[parent], v)) break;
+            c_[i] = std::move(c_[parent]);
+            i = parent;
+        }
+        c_[i] = std::move(v);
+    }
+
+    void sift_down(size_type i)
+    {
+        const size_type n = c_.size();
+        value_type v(std::move(c_[i]));
+        for (;;) {
+            size_type first = i * Arity + 1;
+            if (first >= n) break;
+            size_type last = std::min(first + Arity, n);
+            size_type best = first;
+            for (size_type j = first + 1; j < last; j++) {
+                if (comp_(c_[best], c_[j])) best = j;
+            }
+            if (!comp_(v, c_[best])) break;
+            c_[i] = std::move(c_[best]);
+            i = best;
+        }
+        c_[i] = std::move(v);
+    }
+
+    container_type c_;
+    Compare comp_;
+    Expired expired_;
+    std::size_t evicted_ = 0;
+};
+
+/**
+ * Concurrent queue pops the greatest element under `Compare` first
+ */
+template <typename T, typename Compare = std::less<T>, typename Expired = never_expires>
+using concurrent_priority_queue
+    = concurrent::basic_concurrent_queue<T,
+                                         unique_lock<fibers::mutex>,
+                                         fibers::condition_variable,
+                                         std::vector<T>,
+                                         d_ary_heap<T, Compare, 4, Expired>>;
+
+} // End of namespace concurrent
+} // End of namespace fibio
+
+#endif
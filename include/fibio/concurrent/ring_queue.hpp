@@ -0,0 +1,457 @@
+//
+//  ring_queue.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_ring_queue_hpp
+#define fibio_ring_queue_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <fibio/fibers/mutex.hpp>
+#include <fibio/fibers/condition_variable.hpp>
+#include <fibio/concurrent/concurrent_queue.hpp>
+
+namespace fibio {
+namespace concurrent {
+
+namespace detail {
+constexpr std::size_t cache_line_size = 64;
+} // End of namespace detail
+
+/**
+ * Bounded MPMC queue on a ring buffer
+ *
+ * Each slot carries a sequence number, producers and consumers claim slots with a CAS on their
+ * own cursor, so the fast path takes no lock and never allocates. The mutex and condition
+ * variables are only touched when the ring is full or empty and there is someone to park or
+ * wake up. The interface is the same as `basic_concurrent_queue`, except that capacity is
+ * required and rounded up to a power of 2.
+ *
+ * A claimed slot must be filled and a filled one released, or the ring stops at it, so moving a
+ * `T` must not throw. Pushing an lvalue copies it before a slot is claimed.
+ */
+template <typename T, typename LockType, typename CVType>
+struct basic_ring_queue
+{
+    static_assert(std::is_nothrow_move_constructible<T>::value
+                      && std::is_nothrow_move_assignable<T>::value,
+                  "ring_queue requires a T with non-throwing move operations");
+
+    typedef basic_ring_queue<T, LockType, CVType> this_type;
+    typedef typename LockType::mutex_type mutex_type;
+
+    typedef T value_type;
+    typedef std::size_t size_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+
+    /**
+     * Constructor construct a ring queue
+     * @param capacity capacity of the queue, rounded up to a power of 2
+     * @param auto_open true indicates the queue is created in open state
+     */
+    inline explicit basic_ring_queue(size_type capacity, bool auto_open = true)
+    : mask_(round_up(capacity) - 1)
+    , cells_(new cell[mask_ + 1])
+    , enqueue_pos_(0)
+    , dequeue_pos_(0)
+    , opened_(auto_open)
+    , push_waiters_(0)
+    , pop_waiters_(0)
+    {
+        for (size_type i = 0; i <= mask_; i++) cells_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+
+    ~basic_ring_queue()
+    {
+        // Destroy what is left in place, T is not required to be default constructible
+        size_type e = enqueue_pos_.load(std::memory_order_acquire);
+        for (size_type pos = dequeue_pos_.load(std::memory_order_relaxed); pos != e; pos++)
+            reinterpret_cast<T*>(&cells_[pos & mask_].storage_)->~T();
+    }
+
+    /**
+     * Open the queue, only opened queue can accept new elements
+     */
+    inline bool open()
+    {
+        LockType lock(the_mutex_);
+        opened_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Close the queue, closed queue cannot have new elements pushed in
+     */
+    inline void close()
+    {
+        LockType lock(the_mutex_);
+        opened_.store(false, std::memory_order_release);
+        full_cv_.notify_all();
+        empty_cv_.notify_all();
+    }
+
+    /**
+     * Returns true if the queue is open
+     */
+    inline bool is_open() const { return opened_.load(std::memory_order_acquire); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     */
+    inline queue_op_status push(const T& data) { return push_impl(T(data)); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     */
+    inline queue_op_status push(T&& data) { return push_impl(std::move(data)); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     * std::back_inserter support
+     */
+    inline void push_back(const T& data) { push(data); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     * std::back_inserter support
+     */
+    inline void push_back(T&& data) { push(std::move(data)); }
+
+    /**
+     * Try push an elements into the queue without blocking
+     * @return return queue_op_status::success if element is pushed, other values indicate failure
+     */
+    inline queue_op_status try_push(const T& data) { return try_push_impl(T(data)); }
+
+    /**
+     * Try push an elements into the queue without blocking
+     * @return return queue_op_status::success if element is pushed, other values indicate failure
+     */
+    inline queue_op_status try_push(T&& data) { return try_push_impl(std::move(data)); }
+
+    /**
+     * Blocks until an element is popped from the queue
+     * @return return queue_op_status::success if element is popped, other values indicate failure
+     */
+    inline queue_op_status pop(T& popped_value)
+    {
+        if (dequeue(popped_value)) {
+            wake_up(push_waiters_, full_cv_);
+            return queue_op_status::success;
+        }
+        // Ring is empty, park until an element is pushed or the queue is closed
+        LockType lock(the_mutex_);
+        pop_waiters_.fetch_add(1, std::memory_order_relaxed);
+        // Pairs with the fence in wake_up, either we see the element or the producer sees us
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        queue_op_status ret = queue_op_status::success;
+        while (!dequeue(popped_value)) {
+            if (!opened_.load(std::memory_order_acquire)) {
+                // Queue is empty and closed
+                ret = queue_op_status::closed;
+                break;
+            }
+            empty_cv_.wait(lock);
+        }
+        pop_waiters_.fetch_sub(1, std::memory_order_relaxed);
+        if (ret == queue_op_status::success) wake_up_locked(push_waiters_, full_cv_);
+        return ret;
+    }
+
+    /**
+     * Try to pop an element from the queue, wait until `timeout_time` reached
+     * @return return queue_op_status::success if element is popped, other values indicate failure
+     */
+    template <class Clock, class Duration>
+    inline queue_op_status
+    try_pop_until(T& popped_value, const std::chrono::time_point<Clock, Duration>& timeout_time)
+    {
+        if (dequeue(popped_value)) {
+            wake_up(push_waiters_, full_cv_);
+            return queue_op_status::success;
+        }
+        LockType lock(the_mutex_);
+        pop_waiters_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        queue_op_status ret = queue_op_status::success;
+        std::cv_status st = std::cv_status::no_timeout;
+        while (!dequeue(popped_value)) {
+            if (!opened_.load(std::memory_order_acquire)) {
+                ret = queue_op_status::closed;
+                break;
+            }
+            if (st == std::cv_status::timeout) {
+                ret = queue_op_status::empty;
+                break;
+            }
+            st = empty_cv_.wait_until(lock, timeout_time);
+        }
+        pop_waiters_.fetch_sub(1, std::memory_order_relaxed);
+        if (ret == queue_op_status::success) wake_up_locked(push_waiters_, full_cv_);
+        return ret;
+    }
+
+    /**
+     * Try to pop an element from the queue, wait for `timeout_duration`
+     * @return return queue_op_status::success if element is popped, other values indicate failure
+     */
+    template <class Rep, class Period>
+    inline queue_op_status try_pop_for(T& popped_value,
+                                       const std::chrono::duration<Rep, Period>& timeout_duration)
+    {
+        return try_pop_until(popped_value, std::chrono::steady_clock::now() + timeout_duration);
+    }
+
+    /**
+     * Try to pop an element from the queue without blocking
+     * @return return queue_op_status::success if element is popped, other values indicate failure
+     */
+    inline queue_op_status try_pop(T& popped_value)
+    {
+        if (!dequeue(popped_value)) return queue_op_status::empty;
+        wake_up(push_waiters_, full_cv_);
+        return queue_op_status::success;
+    }
+
+    /**
+     * Returns true indicates the queue is empty
+     * NOTE: The return value is just a snapshot, queue state may change
+     *       when caller gets the returned value
+     */
+    inline bool empty() const { return size() == 0; }
+
+    /**
+     * Returns true indicates the queue is full
+     * NOTE: The return value is just a snapshot, queue state may change
+     *       when caller gets the returned value
+     */
+    inline bool full() const { return size() >= capacity(); }
+
+    /**
+     * Returns the number of elements holding in the queue
+     * NOTE: The return value is just a snapshot, queue state may change
+     *       when caller gets the returned value
+     */
+    inline size_type size() const
+    {
+        size_type d = dequeue_pos_.load(std::memory_order_acquire);
+        size_type e = enqueue_pos_.load(std::memory_order_acquire);
+        return e > d ? e - d : 0;
+    }
+
+    /**
+     * Returns the max number of elements the queue can hold
+     */
+    inline size_type capacity() const { return mask_ + 1; }
+
+    /**
+     * Minimal range-based for loop support
+     * It's not a fully functional iterator and should not be used directly
+     */
+    struct iterator : std::iterator<std::input_iterator_tag, T>
+    {
+        iterator(iterator&& other) = default;
+
+        bool operator!=(const iterator& other) const
+        {
+            // Only ended iterators are equal
+            return !(ended() && other.ended());
+        }
+
+        iterator& operator++()
+        {
+            popped_ = queue_->pop(value_);
+            if (popped_ != queue_op_status::success) queue_ = 0;
+            return *this;
+        }
+
+        value_type& operator*() { return value_; }
+
+        value_type* operator->() { return &value_; }
+
+    private:
+        bool ended() const { return !queue_; }
+
+        iterator() : queue_(0), popped_(queue_op_status::success) {}
+
+        iterator(this_type* queue) : queue_(queue), popped_(queue_op_status::success)
+        {
+            operator++();
+        }
+
+        iterator(const iterator& other) = delete;
+
+        iterator& operator=(const iterator& other) = delete;
+
+        this_type* queue_;
+        value_type value_;
+        queue_op_status popped_;
+        friend struct basic_ring_queue;
+    };
+
+    /**
+     * Minimal range-based for loop support
+     * Returns an iterator to the first element of the container.
+     */
+    iterator begin() { return iterator(this); }
+
+    /**
+     * Minimal range-based for loop support
+     * Returns an iterator indicates the queue is empty and closed.
+     */
+    iterator end() const { return iterator(); }
+
+private:
+    // Non-copyable, non-movable
+    basic_ring_queue(const basic_ring_queue&) = delete;
+
+    basic_ring_queue(basic_ring_queue&&) = delete;
+
+    void operator=(const basic_ring_queue&) = delete;
+
+    struct cell
+    {
+        std::atomic<size_type> seq_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    };
+
+    static size_type round_up(size_type n)
+    {
+        size_type r = 2;
+        while (r < n) r <<= 1;
+        return r;
+    }
+
+    template <typename U>
+    bool enqueue(U&& data)
+    {
+        size_type pos = enqueue_pos_.load(std::memory_order_relaxed);
+        cell* c;
+        for (;;) {
+            c = &cells_[pos & mask_];
+            size_type seq = c->seq_.load(std::memory_order_acquire);
+            std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // The slot still holds an element from last lap
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        ::new (static_cast<void*>(&c->storage_)) T(std::forward<U>(data));
+        c->seq_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool dequeue(T& value)
+    {
+        size_type pos = dequeue_pos_.load(std::memory_order_relaxed);
+        cell* c;
+        for (;;) {
+            c = &cells_[pos & mask_];
+            size_type seq = c->seq_.load(std::memory_order_acquire);
+            std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // The slot has not been filled yet
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        T* p = reinterpret_cast<T*>(&c->storage_);
+        value = std::move(*p);
+        p->~T();
+        c->seq_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Wake up one parked fiber on the other side, only locks if there is one
+    void wake_up(std::atomic<size_type>& waiters, CVType& cv)
+    {
+        // Pairs with the fence after registering a waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            LockType lock(the_mutex_);
+            cv.notify_one();
+        }
+    }
+
+    /// Same as wake_up, called with the_mutex_ held
+    void wake_up_locked(std::atomic<size_type>& waiters, CVType& cv)
+    {
+        if (waiters.load(std::memory_order_relaxed) > 0) cv.notify_one();
+    }
+
+    template <typename U>
+    queue_op_status try_enqueue(U&& data)
+    {
+        if (!opened_.load(std::memory_order_acquire)) {
+            // Cannot push into a closed queue
+            return queue_op_status::closed;
+        }
+        return enqueue(std::forward<U>(data)) ? queue_op_status::success : queue_op_status::full;
+    }
+
+    template <typename U>
+    queue_op_status try_push_impl(U&& data)
+    {
+        queue_op_status ret = try_enqueue(std::forward<U>(data));
+        if (ret == queue_op_status::success) wake_up(pop_waiters_, empty_cv_);
+        return ret;
+    }
+
+    template <typename U>
+    queue_op_status push_impl(U&& data)
+    {
+        queue_op_status ret = try_push_impl(std::forward<U>(data));
+        if (ret != queue_op_status::full) return ret;
+        // Ring is full, park until a slot is released or the queue is closed
+        LockType lock(the_mutex_);
+        push_waiters_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while ((ret = try_enqueue(std::forward<U>(data))) == queue_op_status::full) {
+            full_cv_.wait(lock);
+        }
+        push_waiters_.fetch_sub(1, std::memory_order_relaxed);
+        if (ret == queue_op_status::success) wake_up_locked(pop_waiters_, empty_cv_);
+        return ret;
+    }
+
+    const size_type mask_;
+    std::unique_ptr<cell[]> cells_;
+    char pad0_[detail::cache_line_size];
+    std::atomic<size_type> enqueue_pos_;
+    char pad1_[detail::cache_line_size - sizeof(std::atomic<size_type>)];
+    std::atomic<size_type> dequeue_pos_;
+    char pad2_[detail::cache_line_size - sizeof(std::atomic<size_type>)];
+    std::atomic<bool> opened_;
+    std::atomic<size_type> push_waiters_;
+    std::atomic<size_type> pop_waiters_;
+    mutable mutex_type the_mutex_;
+    CVType full_cv_;
+    CVType empty_cv_;
+};
+
+template <typename T>
+using ring_queue = concurrent::
+    basic_ring_queue<T, unique_lock<fibers::mutex>, fibers::condition_variable>;
+} // End of namespace concurrent
+} // End of namespace fibio
+
+#endif
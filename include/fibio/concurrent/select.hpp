@@ -0,0 +1,225 @@
+//
+//  select.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_select_hpp
+#define fibio_select_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <fibio/fibers/future/oneshot.hpp>
+#include <fibio/concurrent/concurrent_queue.hpp>
+
+namespace fibio {
+namespace concurrent {
+
+/// Index returned by `select` when no case completed before the deadline
+constexpr std::size_t select_timeout = std::numeric_limits<std::size_t>::max();
+
+/**
+ * Result of `select`
+ * `index` is the position of the completed case, `status` is the status of the operation,
+ * which is either `success` or `closed`, or `timeout` if `index` is `select_timeout`
+ */
+struct select_result
+{
+    std::size_t index;
+    queue_op_status status;
+};
+
+namespace detail {
+
+struct select_case_base
+{
+    /// Returns true if the operation will not block, otherwise registers `w` to the queue
+    virtual bool arm(select_waiter& w) = 0;
+
+    /// Removes `w` from the queue, no-op if it is not registered
+    virtual void disarm(select_waiter& w) = 0;
+
+    /// Non-blocking attempt, returns `full` or `empty` if another fiber won the race
+    virtual queue_op_status attempt() = 0;
+
+protected:
+    ~select_case_base() {}
+};
+
+template <typename Queue>
+struct pop_case : select_case_base
+{
+    typedef typename Queue::value_type value_type;
+
+    pop_case(Queue& q, value_type& v) : q_(q), v_(v) {}
+
+    bool arm(select_waiter& w) override { return q_.select_pop_ready(w); }
+
+    void disarm(select_waiter& w) override { q_.select_pop_cancel(w); }
+
+    queue_op_status attempt() override
+    {
+        queue_op_status ret = q_.try_pop(v_);
+        if (ret == queue_op_status::empty && !q_.is_open()) {
+            // Check again as the last elements may be pushed before close
+            ret = q_.try_pop(v_);
+            if (ret == queue_op_status::empty) ret = queue_op_status::closed;
+        }
+        return ret;
+    }
+
+    Queue& q_;
+    value_type& v_;
+};
+
+template <typename Queue>
+struct push_case : select_case_base
+{
+    typedef typename Queue::value_type value_type;
+
+    template <typename V>
+    push_case(Queue& q, V&& v) : q_(q), v_(std::forward<V>(v))
+    {
+    }
+
+    bool arm(select_waiter& w) override { return q_.select_push_ready(w); }
+
+    void disarm(select_waiter& w) override { q_.select_push_cancel(w); }
+
+    queue_op_status attempt() override { return q_.try_push(std::move(v_)); }
+
+    Queue& q_;
+    value_type v_;
+};
+
+/// Parks the selecting fiber until one of the queues fires
+struct selector : selector_base
+{
+    selector() : fired_(select_timeout), future_(promise_.get_future()) {}
+
+    bool fire(std::size_t index) override
+    {
+        std::size_t expected = select_timeout;
+        if (!fired_.compare_exchange_strong(expected, index, std::memory_order_acq_rel))
+            return false;
+        promise_.set_value();
+        return true;
+    }
+
+    std::size_t wait()
+    {
+        future_.wait();
+        return fired_.load(std::memory_order_acquire);
+    }
+
+    std::size_t wait_until(std::chrono::steady_clock::time_point timeout_time)
+    {
+        if (future_.wait_until(timeout_time) == fibers::future_status::timeout) {
+            // Make sure no queue will fire after the timeout
+            std::size_t expected = select_timeout;
+            if (fired_.compare_exchange_strong(
+                    expected, select_timeout - 1, std::memory_order_acq_rel))
+                return select_timeout;
+        }
+        return fired_.load(std::memory_order_acquire);
+    }
+
+    std::atomic<std::size_t> fired_;
+    fibers::oneshot_promise<void> promise_;
+    fibers::oneshot_future<void> future_;
+};
+
+template <std::size_t N>
+select_result do_select(select_case_base* (&cases)[N],
+                        const std::chrono::steady_clock::time_point* timeout_time)
+{
+    for (;;) {
+        selector sel;
+        select_waiter waiters[N];
+        std::size_t ready = select_timeout;
+        std::size_t armed = 0;
+        for (; armed < N; armed++) {
+            waiters[armed].selector_ = &sel;
+            waiters[armed].index_ = armed;
+            if (cases[armed]->arm(waiters[armed])) {
+                ready = armed;
+                break;
+            }
+        }
+        if (ready == select_timeout) {
+            ready = timeout_time ? sel.wait_until(*timeout_time) : sel.wait();
+        }
+        // Each queue unlinks in O(1), after this no queue can touch `sel` or `waiters`
+        for (std::size_t i = 0; i < armed; i++) cases[i]->disarm(waiters[i]);
+        if (ready >= N) return select_result{select_timeout, queue_op_status::timeout};
+        queue_op_status ret = cases[ready]->attempt();
+        if (ret == queue_op_status::success || ret == queue_op_status::closed)
+            return select_result{ready, ret};
+        // Another fiber took the element or the slot, try again
+    }
+}
+
+} // End of namespace detail
+
+/**
+ * A case of `select`, pops an element from `q` into `v`
+ */
+template <typename Queue>
+detail::pop_case<Queue> on_pop(Queue& q, typename Queue::value_type& v)
+{
+    return detail::pop_case<Queue>(q, v);
+}
+
+/**
+ * A case of `select`, pushes `v` into `q`
+ */
+template <typename Queue, typename V>
+detail::push_case<Queue> on_push(Queue& q, V&& v)
+{
+    return detail::push_case<Queue>(q, std::forward<V>(v));
+}
+
+/**
+ * Blocks until one of the cases can complete and completes it, cases are checked in order
+ * Each queue is registered and unregistered with O(1) operations, only one fiber is parked
+ */
+template <typename... Cases>
+select_result select(Cases&&... cases)
+{
+    detail::select_case_base* cs[] = {&cases...};
+    return detail::do_select(cs, nullptr);
+}
+
+/**
+ * Same as `select`, returns `select_timeout` as index if no case completes before `timeout_time`
+ */
+template <typename Clock, typename Duration, typename... Cases>
+select_result select_until(const std::chrono::time_point<Clock, Duration>& timeout_time,
+                           Cases&&... cases)
+{
+    detail::select_case_base* cs[] = {&cases...};
+    std::chrono::steady_clock::time_point t
+        = std::chrono::steady_clock::now()
+          + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout_time
+                                                                             - Clock::now());
+    return detail::do_select(cs, &t);
+}
+
+/**
+ * Same as `select`, returns `select_timeout` as index if no case completes in `timeout_duration`
+ */
+template <typename Rep, typename Period, typename... Cases>
+select_result select_for(const std::chrono::duration<Rep, Period>& timeout_duration,
+                         Cases&&... cases)
+{
+    return select_until(std::chrono::steady_clock::now() + timeout_duration,
+                        std::forward<Cases>(cases)...);
+}
+
+} // End of namespace concurrent
+} // End of namespace fibio
+
+#endif
@@ -0,0 +1,384 @@
+//
+//  spsc_queue.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_spsc_queue_hpp
+#define fibio_spsc_queue_hpp
+
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <fibio/fibers/mutex.hpp>
+#include <fibio/fibers/condition_variable.hpp>
+#include <fibio/concurrent/ring_queue.hpp>
+
+namespace fibio {
+namespace concurrent {
+
+/**
+ * Bounded queue for exactly one producer and one consumer
+ *
+ * Each side owns its index and keeps a cached copy of the other side's one, it only reads the
+ * shared index when the cached value says the ring is full or empty, so push and pop are
+ * wait-free and mostly touch their own cache line. A parked consumer is woken by the first push
+ * after it parked and drains the whole burst before parking again, same for a parked producer.
+ *
+ * Close and range-for semantics are the same as `basic_concurrent_queue`.
+ */
+template <typename T, typename LockType, typename CVType>
+struct basic_spsc_queue
+{
+    typedef basic_spsc_queue<T, LockType, CVType> this_type;
+    typedef typename LockType::mutex_type mutex_type;
+
+    typedef T value_type;
+    typedef std::size_t size_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+
+    /**
+     * Constructor construct a SPSC queue
+     * @param capacity capacity of the queue, rounded up to a power of 2
+     * @param auto_open true indicates the queue is created in open state
+     */
+    inline explicit basic_spsc_queue(size_type capacity, bool auto_open = true)
+    : mask_(round_up(capacity) - 1)
+    , cells_(new cell[mask_ + 1])
+    , tail_(0)
+    , cached_head_(0)
+    , head_(0)
+    , cached_tail_(0)
+    , opened_(auto_open)
+    , producer_parked_(false)
+    , consumer_parked_(false)
+    {
+    }
+
+    ~basic_spsc_queue()
+    {
+        // Destroy what is left in place, T is not required to be default constructible
+        size_type t = tail_.load(std::memory_order_acquire);
+        for (size_type h = head_.load(std::memory_order_relaxed); h != t; h++)
+            reinterpret_cast<T*>(&cells_[h & mask_])->~T();
+    }
+
+    /**
+     * Open the queue, only opened queue can accept new elements
+     */
+    inline bool open()
+    {
+        LockType lock(the_mutex_);
+        opened_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Close the queue, closed queue cannot have new elements pushed in
+     */
+    inline void close()
+    {
+        LockType lock(the_mutex_);
+        opened_.store(false, std::memory_order_release);
+        full_cv_.notify_all();
+        empty_cv_.notify_all();
+    }
+
+    /**
+     * Returns true if the queue is open
+     */
+    inline bool is_open() const { return opened_.load(std::memory_order_acquire); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     */
+    inline queue_op_status push(const T& data) { return push_impl(data); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     */
+    inline queue_op_status push(T&& data) { return push_impl(std::move(data)); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     * std::back_inserter support
+     */
+    inline void push_back(const T& data) { push(data); }
+
+    /**
+     * Push an element into the queue, block if the queue is full
+     * std::back_inserter support
+     */
+    inline void push_back(T&& data) { push(std::move(data)); }
+
+    /**
+     * Try push an elements into the queue without blocking
+     * @return return queue_op_status::success if element is pushed, other values indicate failure
+     */
+    inline queue_op_status try_push(const T& data) { return try_push_impl(data); }
+
+    /**
+     * Try push an elements into the queue without blocking
+     * @return return queue_op_status::success if element is pushed, other values indicate failure
+     */
+    inline queue_op_status try_push(T&& data) { return try_push_impl(std::move(data)); }
+
+    /**
+     * Blocks until an element is popped from the queue
+     * @return return queue_op_status::success if element is popped, other values indicate failure
+     */
+    inline queue_op_status pop(T& popped_value)
+    {
+        if (dequeue(popped_value)) {
+            wake_up(producer_parked_, full_cv_);
+            return queue_op_status::success;
+        }
+        // Ring is empty, park until the producer pushes or closes the queue
+        LockType lock(the_mutex_);
+        queue_op_status ret = queue_op_status::success;
+        for (;;) {
+            consumer_parked_.store(true, std::memory_order_relaxed);
+            // Pairs with the fence in wake_up
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (dequeue(popped_value)) break;
+            if (!opened_.load(std::memory_order_acquire)) {
+                // Queue is empty and closed
+                ret = queue_op_status::closed;
+                break;
+            }
+            empty_cv_.wait(lock);
+        }
+        consumer_parked_.store(false, std::memory_order_relaxed);
+        if (ret == queue_op_status::success) wake_up_locked(producer_parked_, full_cv_);
+        return ret;
+    }
+
+    /**
+     * Try to pop an element from the queue without blocking
+     * @return return queue_op_status::success if element is popped, other values indicate failure
+     */
+    inline queue_op_status try_pop(T& popped_value)
+    {
+        if (!dequeue(popped_value)) return queue_op_status::empty;
+        wake_up(producer_parked_, full_cv_);
+        return queue_op_status::success;
+    }
+
+    /**
+     * Returns true indicates the queue is empty
+     * NOTE: The return value is just a snapshot, queue state may change
+     *       when caller gets the returned value
+     */
+    inline bool empty() const { return size() == 0; }
+
+    /**
+     * Returns true indicates the queue is full
+     * NOTE: The return value is just a snapshot, queue state may change
+     *       when caller gets the returned value
+     */
+    inline bool full() const { return size() >= capacity(); }
+
+    /**
+     * Returns the number of elements holding in the queue
+     * NOTE: The return value is just a snapshot, queue state may change
+     *       when caller gets the returned value
+     */
+    inline size_type size() const
+    {
+        size_type h = head_.load(std::memory_order_acquire);
+        size_type t = tail_.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+
+    /**
+     * Returns the max number of elements the queue can hold
+     */
+    inline size_type capacity() const { return mask_ + 1; }
+
+    /**
+     * Minimal range-based for loop support
+     * It's not a fully functional iterator and should not be used directly
+     */
+    struct iterator : std::iterator<std::input_iterator_tag, T>
+    {
+        iterator(iterator&& other) = default;
+
+        bool operator!=(const iterator& other) const
+        {
+            // Only ended iterators are equal
+            return !(ended() && other.ended());
+        }
+
+        iterator& operator++()
+        {
+            popped_ = queue_->pop(value_);
+            if (popped_ != queue_op_status::success) queue_ = 0;
+            return *this;
+        }
+
+        value_type& operator*() { return value_; }
+
+        value_type* operator->() { return &value_; }
+
+    private:
+        bool ended() const { return !queue_; }
+
+        iterator() : queue_(0), popped_(queue_op_status::success) {}
+
+        iterator(this_type* queue) : queue_(queue), popped_(queue_op_status::success)
+        {
+            operator++();
+        }
+
+        iterator(const iterator& other) = delete;
+
+        iterator& operator=(const iterator& other) = delete;
+
+        this_type* queue_;
+        value_type value_;
+        queue_op_status popped_;
+        friend struct basic_spsc_queue;
+    };
+
+    /**
+     * Minimal range-based for loop support
+     * Returns an iterator to the first element of the container.
+     */
+    iterator begin() { return iterator(this); }
+
+    /**
+     * Minimal range-based for loop support
+     * Returns an iterator indicates the queue is empty and closed.
+     */
+    iterator end() const { return iterator(); }
+
+private:
+    // Non-copyable, non-movable
+    basic_spsc_queue(const basic_spsc_queue&) = delete;
+
+    basic_spsc_queue(basic_spsc_queue&&) = delete;
+
+    void operator=(const basic_spsc_queue&) = delete;
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type cell;
+
+    static size_type round_up(size_type n)
+    {
+        size_type r = 2;
+        while (r < n) r <<= 1;
+        return r;
+    }
+
+    // Producer side only
+    template <typename U>
+    bool enqueue(U&& data)
+    {
+        size_type t = tail_.load(std::memory_order_relaxed);
+        if (t - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (t - cached_head_ > mask_) return false;
+        }
+        ::new (static_cast<void*>(&cells_[t & mask_])) T(std::forward<U>(data));
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side only
+    bool dequeue(T& value)
+    {
+        size_type h = head_.load(std::memory_order_relaxed);
+        if (h == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (h == cached_tail_) return false;
+        }
+        T* p = reinterpret_cast<T*>(&cells_[h & mask_]);
+        value = std::move(*p);
+        p->~T();
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Wake up the other side if it is parked, only the first call after it parked locks
+    void wake_up(std::atomic<bool>& parked, CVType& cv)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed)
+            && parked.exchange(false, std::memory_order_relaxed)) {
+            LockType lock(the_mutex_);
+            cv.notify_one();
+        }
+    }
+
+    /// Same as wake_up, called with the_mutex_ held
+    void wake_up_locked(std::atomic<bool>& parked, CVType& cv)
+    {
+        if (parked.exchange(false, std::memory_order_relaxed)) cv.notify_one();
+    }
+
+    template <typename U>
+    queue_op_status try_enqueue(U&& data)
+    {
+        if (!opened_.load(std::memory_order_acquire)) {
+            // Cannot push into a closed queue
+            return queue_op_status::closed;
+        }
+        return enqueue(std::forward<U>(data)) ? queue_op_status::success : queue_op_status::full;
+    }
+
+    template <typename U>
+    queue_op_status try_push_impl(U&& data)
+    {
+        queue_op_status ret = try_enqueue(std::forward<U>(data));
+        if (ret == queue_op_status::success) wake_up(consumer_parked_, empty_cv_);
+        return ret;
+    }
+
+    template <typename U>
+    queue_op_status push_impl(U&& data)
+    {
+        queue_op_status ret = try_push_impl(std::forward<U>(data));
+        if (ret != queue_op_status::full) return ret;
+        // Ring is full, park until the consumer drains or the queue is closed
+        LockType lock(the_mutex_);
+        for (;;) {
+            producer_parked_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            ret = try_enqueue(std::forward<U>(data));
+            if (ret != queue_op_status::full) break;
+            full_cv_.wait(lock);
+        }
+        producer_parked_.store(false, std::memory_order_relaxed);
+        if (ret == queue_op_status::success) wake_up_locked(consumer_parked_, empty_cv_);
+        return ret;
+    }
+
+    const size_type mask_;
+    std::unique_ptr<cell[]> cells_;
+    char pad0_[detail::cache_line_size];
+    // Producer cache line
+    std::atomic<size_type> tail_;
+    size_type cached_head_;
+    char pad1_[detail::cache_line_size - sizeof(std::atomic<size_type>) - sizeof(size_type)];
+    // Consumer cache line
+    std::atomic<size_type> head_;
+    size_type cached_tail_;
+    char pad2_[detail::cache_line_size - sizeof(std::atomic<size_type>) - sizeof(size_type)];
+    std::atomic<bool> opened_;
+    std::atomic<bool> producer_parked_;
+    std::atomic<bool> consumer_parked_;
+    mutable mutex_type the_mutex_;
+    CVType full_cv_;
+    CVType empty_cv_;
+};
+
+template <typename T>
+using spsc_queue = concurrent::
+    basic_spsc_queue<T, unique_lock<fibers::mutex>, fibers::condition_variable>;
+} // End of namespace concurrent
+} // End of namespace fibio
+
+#endif
@@ -16,5 +16,6 @@
 #include <fibio/fibers/barrier.hpp>
 #include <fibio/fibers/fss.hpp>
 #include <fibio/fibers/fiber_group.hpp>
+#include <fibio/fibers/generator.hpp>
 
 #endif
@@ -14,8 +14,15 @@
 #ifndef fibio_barrier_h
 #define fibio_barrier_h
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
 #include <type_traits>
+#include <vector>
 #include <fibio/fibers/exceptions.hpp>
+#include <fibio/fibers/fiber.hpp>
 #include <fibio/fibers/mutex.hpp>
 #include <fibio/fibers/condition_variable.hpp>
 
@@ -26,6 +33,12 @@ namespace detail {
 typedef std::function<void()> void_completion_function;
 typedef std::function<size_t()> size_completion_function;
 
+template <typename F>
+struct completion_result
+{
+    typedef typename std::result_of<typename std::decay<F>::type()>::type type;
+};
+
 struct default_barrier_reseter
 {
     unsigned int size_;
@@ -98,7 +111,8 @@ public:
     barrier(
         unsigned int count,
         F&& completion,
-        typename std::enable_if<std::is_void<typename std::result_of<F>::type>::value, dummy*>::type
+        typename std::enable_if<std::is_void<typename detail::completion_result<F>::type>::value,
+                                dummy*>::type
         = 0)
     : m_count(check_counter(count))
     , m_generation(0)
@@ -113,8 +127,9 @@ public:
     barrier(
         unsigned int count,
         F&& completion,
-        typename std::enable_if<std::is_same<typename std::result_of<F>::type, unsigned int>::value,
-                                dummy*>::type
+        typename std::enable_if<
+            std::is_same<typename detail::completion_result<F>::type, unsigned int>::value,
+            dummy*>::type
         = 0)
     : m_count(check_counter(count)), m_generation(0), fct_(std::move(completion))
     {
@@ -200,9 +215,183 @@ private:
     detail::size_completion_function fct_;
 };
 
+/**
+ * A barrier for large number of fibers
+ *
+ * Arriving fibers are grouped by the scheduler worker they are running on, each group has its
+ * own arrival counter, mutex and condition variable. The first fiber arriving at an idle group
+ * yields once before flushing, so the other fibers ready on the same worker arrive meanwhile and
+ * are only counted in the group, the flushing fiber then subtracts all of them from the shared
+ * counter with one atomic operation. The fiber bringing the shared counter to zero completes the
+ * generation and releases waiters group by group, each with one `notify_all`. Completion
+ * functions have the same semantics as `barrier`.
+ */
+class combining_barrier
+{
+    struct dummy
+    {
+    };
+
+public:
+    /**
+     * Construct a barrier for `count` fibers
+     */
+    explicit combining_barrier(unsigned int count)
+    : combining_barrier(
+          count, detail::size_completion_function(detail::default_barrier_reseter(count)), 0)
+    {
+    }
+
+    /**
+     * Construct a barrier for `count` fibers and a completion function `completion`.
+     */
+    template <typename F>
+    combining_barrier(
+        unsigned int count,
+        F&& completion,
+        typename std::enable_if<std::is_void<typename detail::completion_result<F>::type>::value,
+                                dummy*>::type
+        = 0)
+    : combining_barrier(count,
+                        detail::size_completion_function(
+                            detail::void_functor_barrier_reseter(count, std::move(completion))),
+                        0)
+    {
+    }
+
+    /**
+     * Construct a barrier for `count` fibers and a completion function `completion`.
+     */
+    template <typename F>
+    combining_barrier(
+        unsigned int count,
+        F&& completion,
+        typename std::enable_if<
+            std::is_same<typename detail::completion_result<F>::type, unsigned int>::value,
+            dummy*>::type
+        = 0)
+    : combining_barrier(count, detail::size_completion_function(std::move(completion)), 0)
+    {
+    }
+
+    /**
+     * Construct a barrier for `count` fibers and a completion function `completion`.
+     */
+    combining_barrier(unsigned int count, void (*completion)())
+    : combining_barrier(
+          count,
+          completion ? detail::size_completion_function(
+                           detail::void_fct_ptr_barrier_reseter(count, completion))
+                     : detail::size_completion_function(detail::default_barrier_reseter(count)),
+          0)
+    {
+    }
+
+    /**
+     * Construct a barrier for `count` fibers and a completion function `completion`.
+     */
+    combining_barrier(unsigned int count, unsigned int (*completion)())
+    : combining_barrier(
+          count,
+          completion ? detail::size_completion_function(completion)
+                     : detail::size_completion_function(detail::default_barrier_reseter(count)),
+          0)
+    {
+    }
+
+    /**
+     * Block until count fibers have called `wait` or `count_down_and_wait` on `*this`.
+     * Returns true for exactly one fiber of each generation, same as `barrier::wait`.
+     */
+    bool wait()
+    {
+        group& g = current_group();
+        unique_lock<mutex> lock(g.mtx_);
+        unsigned int gen = m_generation.load(std::memory_order_acquire);
+        g.arrived_++;
+        if (!g.flushing_) {
+            // Let the other fibers ready on this worker arrive before touching the shared counter
+            g.flushing_ = true;
+            lock.unlock();
+            this_fiber::yield();
+            lock.lock();
+            unsigned int n = g.arrived_;
+            g.arrived_ = 0;
+            g.flushing_ = false;
+            if (m_count.fetch_sub(n, std::memory_order_acq_rel) == n) {
+                lock.unlock();
+                // All other participants are blocked, no one can arrive before the generation
+                // changes
+                unsigned int count = static_cast<unsigned int>(fct_());
+                assert(count != 0);
+                m_count.store(count, std::memory_order_relaxed);
+                m_generation.fetch_add(1, std::memory_order_release);
+                for (auto& p : groups_) {
+                    // Waiters check the generation with the group mutex held
+                    { lock_guard<mutex> lk(p->mtx_); }
+                    p->cond_.notify_all();
+                }
+                return true;
+            }
+        }
+
+        while (gen == m_generation.load(std::memory_order_acquire)) g.cond_.wait(lock);
+        return false;
+    }
+
+    /**
+     * Same as `wait`
+     */
+    void count_down_and_wait() { wait(); }
+
+private:
+    combining_barrier(unsigned int count, detail::size_completion_function&& fct, int)
+    : m_count(check_counter(count)), m_generation(0), fct_(std::move(fct))
+    {
+        unsigned int n = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned int i = 0; i < n; i++) groups_.emplace_back(new group);
+    }
+
+    combining_barrier(const combining_barrier&) = delete;
+
+    void operator=(const combining_barrier&) = delete;
+
+    static inline unsigned int check_counter(unsigned int count)
+    {
+        if (count == 0)
+            BOOST_THROW_EXCEPTION(
+                fiber_exception(boost::system::errc::invalid_argument,
+                                "combining_barrier constructor: count cannot be zero."));
+        return count;
+    }
+
+    struct group
+    {
+        mutex mtx_;
+        condition_variable cond_;
+        // Arrivals not yet subtracted from the shared counter
+        unsigned int arrived_ = 0;
+        // A fiber of this group is about to flush `arrived_`
+        bool flushing_ = false;
+    };
+
+    group& current_group()
+    {
+        std::size_t i = scheduler::current_worker_index();
+        if (i == std::size_t(-1)) i = std::hash<std::thread::id>()(std::this_thread::get_id());
+        return *groups_[i % groups_.size()];
+    }
+
+    std::vector<std::unique_ptr<group>> groups_;
+    std::atomic<unsigned int> m_count;
+    std::atomic<unsigned int> m_generation;
+    detail::size_completion_function fct_;
+};
+
 } // End of namespace fibers
 
 using fibers::barrier;
+using fibers::combining_barrier;
 
 } // End of namespace fibio
 
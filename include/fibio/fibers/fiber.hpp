@@ -54,6 +54,12 @@ public:
      */
     size_t worker_pool_size() const;
 
+    /**
+     * returns the index of the worker thread running the caller, workers of a scheduler are
+     * numbered from 0 in the order they are started, `size_t(-1)` on other threads
+     */
+    static size_t current_worker_index();
+
     /**
      * returns the scheduler singleton
      */
@@ -10,13 +10,27 @@
 #define fibio_fibers_future_async_hpp
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 #include <tuple>
+#include <vector>
 #include <fibio/utility.hpp>
 #include <fibio/fibers/fiber_group.hpp>
 #include <fibio/fibers/future/future.hpp>
 #include <fibio/fibers/future/packaged_task.hpp>
+#include <fibio/fibers/future/oneshot.hpp>
+#include <fibio/fibers/future/pooled_allocator.hpp>
+#include <fibio/fibers/future/detail/small_task.hpp>
 #include <fibio/concurrent/concurrent_queue.hpp>
+#include <fibio/concurrent/bridge_queue.hpp>
 
 namespace fibio {
 namespace fibers {
@@ -30,15 +44,14 @@ struct task_data
     typedef future<result_type> future_type;
     typedef packaged_task<result_type()> task_type;
 
-    task_data(Fn&& fn, Args&&... args)
-    : fn_(new data_type(std::forward<Fn>(fn), std::forward<Args>(args)...))
+    task_data(Fn&& fn, Args&&... args) : fn_(std::forward<Fn>(fn), std::forward<Args>(args)...)
     {
     }
 
     template <std::size_t... Indices>
     result_type run2(utility::tuple_indices<Indices...>)
     {
-        return utility::invoke(std::move(std::get<0>(*fn_)), std::move(std::get<Indices>(*fn_))...);
+        return utility::invoke(std::move(std::get<0>(fn_)), std::move(std::get<Indices>(fn_))...);
     }
 
     result_type operator()()
@@ -49,7 +62,45 @@ struct task_data
         return run2(index_type());
     }
 
-    std::unique_ptr<data_type> fn_;
+    data_type fn_;
+};
+
+template <typename R>
+struct oneshot_invoker
+{
+    template <typename Fn>
+    static void run(oneshot_promise<R>& p, Fn& fn)
+    {
+        try {
+            p.set_value(fn());
+        } catch (...) {
+            p.set_exception(std::current_exception());
+        }
+    }
+};
+
+template <>
+struct oneshot_invoker<void>
+{
+    template <typename Fn>
+    static void run(oneshot_promise<void>& p, Fn& fn)
+    {
+        try {
+            fn();
+            p.set_value();
+        } catch (...) {
+            p.set_exception(std::current_exception());
+        }
+    }
+};
+
+/// Waits on a oneshot state and returns its result, adapts a oneshot_future into a future
+template <typename R>
+struct oneshot_waiter
+{
+    R operator()() { return f_.get(); }
+
+    oneshot_future<R> f_;
 };
 
 } // End of namespace detail
@@ -58,7 +109,9 @@ struct task_data
  * Run function asynchronously, returns a future, which will be ready when function completes
  */
 template <typename Fn, typename... Args>
-typename detail::task_data<Fn, Args...>::future_type async(Fn&& fn, Args&&... args)
+typename std::enable_if<!std::is_same<typename std::decay<Fn>::type, std::allocator_arg_t>::value,
+                        detail::task_data<Fn, Args...>>::type::future_type
+async(Fn&& fn, Args&&... args)
 {
     typedef detail::task_data<Fn, Args...> data_type;
     typename data_type::task_type task(
@@ -68,6 +121,21 @@ typename detail::task_data<Fn, Args...>::future_type async(Fn&& fn, Args&&... ar
     return std::move(ret);
 }
 
+/**
+ * Run function asynchronously, the shared state of returned future is allocated with alloc
+ */
+template <typename Allocator, typename Fn, typename... Args>
+typename detail::task_data<Fn, Args...>::future_type
+async(std::allocator_arg_t, const Allocator& alloc, Fn&& fn, Args&&... args)
+{
+    typedef detail::task_data<Fn, Args...> data_type;
+    typename data_type::task_type task(
+        std::allocator_arg, alloc, data_type(std::forward<Fn>(fn), std::forward<Args>(args)...));
+    typename data_type::future_type ret(task.get_future());
+    fiber(std::move(task)).detach();
+    return std::move(ret);
+}
+
 /**
  * Run function asynchronously in a fiber pool, returns a future
  */
@@ -196,61 +264,455 @@ async_function<Fn> make_async(Fn&& fn)
     return async_function<Fn>(std::forward<Fn>(fn));
 }
 
+namespace detail {
+
+template <typename R>
+struct batch_invoker
+{
+    template <typename Fn, typename Batch, typename Elements>
+    static void run(Fn& fn, Batch& args, Elements& elements)
+    {
+        std::vector<R> results;
+        try {
+            results = fn(args);
+            if (results.size() != elements.size())
+                BOOST_THROW_EXCEPTION(
+                    std::length_error("batched function must return one result per call"));
+        } catch (...) {
+            for (auto& e : elements) e->ret.set_exception(std::current_exception());
+            return;
+        }
+        for (std::size_t i = 0; i < elements.size(); i++)
+            elements[i]->ret.set_value(std::move(results[i]));
+    }
+};
+
+template <>
+struct batch_invoker<void>
+{
+    template <typename Fn, typename Batch, typename Elements>
+    static void run(Fn& fn, Batch& args, Elements& elements)
+    {
+        try {
+            fn(args);
+        } catch (...) {
+            for (auto& e : elements) e->ret.set_exception(std::current_exception());
+            return;
+        }
+        for (auto& e : elements) e->ret.set_value();
+    }
+};
+
+} // End of namespace detail
+
+template <typename Signature>
+struct batched_async_function;
+
+/**
+ * Asynchronous wrapper for a function processes queued calls in batches
+ *
+ * Calls are collected until `max_batch` calls are taken or `max_delay` passed since the first
+ * one, then the function is called once with a vector of argument tuples and returns a vector
+ * with one result per call (or nothing if `R` is `void`), every caller gets its own future
+ */
+template <typename R, typename... Args>
+struct batched_async_function<R(Args...)>
+{
+    typedef R result_type;
+    typedef std::tuple<typename std::decay<Args>::type...> arguments_tuple;
+    typedef std::vector<arguments_tuple> batch_type;
+    typedef typename std::conditional<std::is_void<R>::value, void, std::vector<R>>::type
+        batch_result_type;
+    typedef std::function<batch_result_type(batch_type&)> function_type;
+
+    template <typename Fn, typename Rep, typename Period>
+    batched_async_function(Fn&& fn,
+                           std::size_t max_batch,
+                           const std::chrono::duration<Rep, Period>& max_delay)
+    : impl_(new impl(function_type(std::forward<Fn>(fn)),
+                     std::max(max_batch, std::size_t(1)),
+                     std::chrono::duration_cast<std::chrono::steady_clock::duration>(max_delay)))
+    , fiber_(&impl::execute, impl_.get())
+    {
+    }
+
+    batched_async_function(batched_async_function&&) = default;
+
+    ~batched_async_function()
+    {
+        if (impl_) {
+            impl_->queue_.close();
+            fiber_.join();
+        }
+    }
+
+    template <typename... Ts>
+    future<result_type> operator()(Ts&&... args)
+    {
+        return apply(arguments_tuple(std::forward<Ts>(args)...));
+    }
+
+    future<result_type> apply(arguments_tuple&& args)
+    {
+        queue_element e(new element{std::move(args), promise<result_type>()});
+        future<result_type> ret(e->ret.get_future());
+        impl_->queue_.push(std::move(e));
+        return ret;
+    }
+
+private:
+    struct element
+    {
+        arguments_tuple args;
+        promise<result_type> ret;
+    };
+    typedef std::unique_ptr<element> queue_element;
+
+    struct impl
+    {
+        impl(function_type&& fn,
+             std::size_t max_batch,
+             std::chrono::steady_clock::duration max_delay)
+        : fn_(std::move(fn)), max_batch_(max_batch), max_delay_(max_delay)
+        {
+        }
+
+        void execute()
+        {
+            queue_element e;
+            std::vector<queue_element> elements;
+            batch_type args;
+            while (queue_.pop(e) == concurrent::queue_op_status::success) {
+                elements.push_back(std::move(e));
+                auto deadline = std::chrono::steady_clock::now() + max_delay_;
+                while (elements.size() < max_batch_) {
+                    // Take what is already queued before arming the timer
+                    auto st = queue_.try_pop(e);
+                    if (st != concurrent::queue_op_status::success
+                        && max_delay_ > std::chrono::steady_clock::duration::zero())
+                        st = queue_.try_pop_until(e, deadline);
+                    if (st != concurrent::queue_op_status::success) break;
+                    elements.push_back(std::move(e));
+                }
+                for (auto& el : elements) args.push_back(std::move(el->args));
+                detail::batch_invoker<result_type>::run(fn_, args, elements);
+                args.clear();
+                elements.clear();
+            }
+        }
+
+        function_type fn_;
+        std::size_t max_batch_;
+        std::chrono::steady_clock::duration max_delay_;
+        concurrent::concurrent_queue<queue_element> queue_;
+    };
+
+    std::unique_ptr<impl> impl_;
+    fiber fiber_;
+};
+
+/**
+ *  Create a batching asynchronous wrapper, `Signature` is the signature of a single call
+ */
+template <typename Signature, typename Fn, typename Rep, typename Period>
+batched_async_function<Signature>
+make_batched_async(Fn&& fn,
+                   std::size_t max_batch,
+                   const std::chrono::duration<Rep, Period>& max_delay)
+{
+    return batched_async_function<Signature>(std::forward<Fn>(fn), max_batch, max_delay);
+}
+
 /**
  *  Foreign thread pool
+ *
+ * Runs blocking functions in plain threads. The pool starts `min_threads` threads and grows up
+ * to `max_threads` when tasks are queued and no thread is idle, a thread above the minimum exits
+ * after it has been idle for `idle_timeout`.
+ *
+ * Tasks are queued in a lock-free ring. A bounded pool parks the submitting fiber, or blocks the
+ * submitting thread, while the ring is full, so a task must not submit to its own pool and wait.
+ * An unbounded pool, the default, moves the excess to an overflow list and never blocks on
+ * submit. Arguments are stored in the queued task and result states come from
+ * `pooled_allocator`, so submitting a small call doesn't touch the heap.
  */
 struct foreign_thread_pool
 {
+    /**
+     * Snapshot of the pool, times are cumulative over all completed tasks
+     */
+    struct stats_type
+    {
+        std::size_t threads;
+        std::size_t idle_threads;
+        std::size_t queue_depth;
+        std::uint64_t completed;
+        std::chrono::nanoseconds wait_time;
+        std::chrono::nanoseconds run_time;
+    };
+
+    /// Ring size of an unbounded pool, tasks beyond it go to the overflow list
+    static constexpr std::size_t default_queue_capacity = 1024;
+
+    /**
+     * Constructs a pool with fixed number of threads and unbounded queue
+     */
     foreign_thread_pool(size_t pool_size = 1)
+    : foreign_thread_pool(pool_size, pool_size, 0, std::chrono::seconds(60))
     {
-        for (size_t i = 0; i < pool_size; i++) {
-            threads_.emplace_back([this]() {
-                for (auto& i : queue_) i();
-            });
-        }
+    }
+
+    /**
+     * Constructs an elastic pool
+     * @param min_threads threads always kept in the pool, at least 1
+     * @param max_threads upper limit of the pool size
+     * @param queue_capacity max number of tasks waiting for a thread, 0 means unbounded
+     * @param idle_timeout a thread above the minimum exits after being idle for this long
+     */
+    template <typename Rep, typename Period>
+    foreign_thread_pool(size_t min_threads,
+                        size_t max_threads,
+                        size_t queue_capacity,
+                        const std::chrono::duration<Rep, Period>& idle_timeout)
+    : min_threads_(std::max(min_threads, size_t(1)))
+    , max_threads_(std::max(max_threads, min_threads_))
+    , idle_timeout_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(idle_timeout))
+    , bounded_(queue_capacity != 0)
+    , queue_(bounded_ ? queue_capacity : default_queue_capacity)
+    , overflow_size_(0)
+    , threads_(0)
+    , idle_threads_(0)
+    , completed_(0)
+    , wait_ns_(0)
+    , run_ns_(0)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (threads_ < min_threads_) spawn();
     }
 
     ~foreign_thread_pool()
     {
         queue_.close();
-        for (auto& t : threads_) {
-            t.join();
-        }
+        // Workers are detached, the last one leaving wakes us up
+        std::unique_lock<std::mutex> lock(mutex_);
+        exited_.wait(lock, [this]() { return threads_ == 0; });
     }
 
+    /**
+     * Call function in the pool, returns a future
+     *
+     * The pool thread completes a oneshot state, and a fiber of the caller's scheduler moves the
+     * result into the future, so no fiber mutex is locked from a pool thread. A plain thread
+     * caller has no scheduler, its future is completed by the pool thread directly.
+     */
     template <typename Fn, typename... Args>
     auto async_call(Fn&& fn, Args&&... args)
         -> future<typename detail::task_data<Fn, Args...>::result_type>
     {
         typedef detail::task_data<Fn, Args...> task_data_type;
         typedef typename task_data_type::result_type result_type;
-        std::shared_ptr<packaged_task<result_type()>> task(new packaged_task<result_type()>(
-            task_data_type(std::forward<Fn>(fn), std::forward<Args>(args)...)));
-        future<result_type> ret = task->get_future();
+        if (!this_fiber::is_a_fiber()) {
+            packaged_task<result_type()> task(
+                std::allocator_arg,
+                pooled_allocator<result_type>(),
+                task_data_type(std::forward<Fn>(fn), std::forward<Args>(args)...));
+            future<result_type> ret = task.get_future();
+            submit(std::move(task));
+            return ret;
+        }
+        packaged_task<result_type()> task(
+            std::allocator_arg,
+            pooled_allocator<result_type>(),
+            detail::oneshot_waiter<result_type>{
+                async_call_oneshot(std::forward<Fn>(fn), std::forward<Args>(args)...)});
+        future<result_type> ret = task.get_future();
+        fiber(std::move(task)).detach();
+        return ret;
+    }
+
+    /**
+     * Call function in the pool, returns a oneshot_future which can be waited by a fiber or a
+     * plain thread, the pool threads complete it without locking any fiber mutex
+     */
+    template <typename Fn, typename... Args>
+    auto async_call_oneshot(Fn&& fn, Args&&... args)
+        -> oneshot_future<typename detail::task_data<Fn, Args...>::result_type>
+    {
+        typedef detail::task_data<Fn, Args...> task_data_type;
+        typedef typename task_data_type::result_type result_type;
         struct thr_task
         {
-            void operator()() { (*pt_)(); }
+            thr_task(task_data_type&& d)
+            : data_(std::move(d)), p_(std::allocator_arg, pooled_allocator<result_type>())
+            {
+            }
+
+            void operator()() { detail::oneshot_invoker<result_type>::run(p_, data_); }
 
-            std::shared_ptr<packaged_task<result_type()>> pt_;
+            task_data_type data_;
+            oneshot_promise<result_type> p_;
         };
-        queue_.push(thr_task{task});
+        thr_task task(task_data_type(std::forward<Fn>(fn), std::forward<Args>(args)...));
+        oneshot_future<result_type> ret = task.p_.get_future();
+        submit(std::move(task));
         return ret;
     }
 
+    /**
+     * Call function in the pool and wait for the result, works from fibers and plain threads
+     *
+     * The task lives on the stack of the caller, which is blocked until it completes, the oneshot
+     * state comes from `pooled_allocator`, and the result is handed back without locking
+     */
     template <typename Fn, typename... Args>
     auto operator()(Fn&& fn, Args&&... args) -> typename detail::task_data<Fn, Args...>::result_type
     {
-        return async_call(std::forward<Fn>(fn), std::forward<Args>(args)...).get();
+        typedef detail::task_data<Fn, Args...> task_data_type;
+        typedef typename task_data_type::result_type result_type;
+        task_data_type task(std::forward<Fn>(fn), std::forward<Args>(args)...);
+        oneshot_promise<result_type> p(std::allocator_arg, pooled_allocator<result_type>());
+        oneshot_future<result_type> ret = p.get_future();
+        submit([&task, &p]() { detail::oneshot_invoker<result_type>::run(p, task); });
+        return ret.get();
+    }
+
+    /**
+     * Returns a snapshot of the pool size, the queue depth and the accumulated task times
+     */
+    stats_type stats() const
+    {
+        stats_type ret;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ret.threads = threads_;
+        }
+        ret.idle_threads = idle_threads_.load(std::memory_order_relaxed);
+        ret.queue_depth = queue_.size() + overflow_size_.load(std::memory_order_relaxed);
+        ret.completed = completed_.load(std::memory_order_relaxed);
+        ret.wait_time = std::chrono::nanoseconds(wait_ns_.load(std::memory_order_relaxed));
+        ret.run_time = std::chrono::nanoseconds(run_ns_.load(std::memory_order_relaxed));
+        return ret;
     }
 
 private:
-    typedef std::function<void()> task_type;
-    typedef concurrent::basic_concurrent_queue<task_type,
-                                               std::unique_lock<std::mutex>,
-                                               std::condition_variable> queue_type;
+    struct job
+    {
+        detail::small_task fn_;
+        std::chrono::steady_clock::time_point queued_;
+    };
+
+    template <typename Fn>
+    void submit(Fn&& fn)
+    {
+        job j{detail::small_task(std::forward<Fn>(fn)), std::chrono::steady_clock::now()};
+        if (bounded_)
+            queue_.push(std::move(j));
+        else if (overflow_size_.load(std::memory_order_relaxed) != 0
+                 || queue_.try_push(std::move(j)) == concurrent::queue_op_status::full)
+            push_overflow(std::move(j));
+        // Queued tasks outnumber idle threads, no one is going to pick this one up soon
+        if (queue_.size() > idle_threads_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (threads_ < max_threads_ && queue_.is_open()) spawn();
+        }
+    }
+
+    /// Queues behind the overflowed tasks, so tasks still run in submission order
+    void push_overflow(job&& j)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        overflow_.push_back(std::move(j));
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+        // Workers may have drained the ring before they could see the overflow
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        refill_locked();
+    }
+
+    /// Moves overflowed tasks to the ring as workers free slots, called with mutex_ held
+    void refill_locked()
+    {
+        while (!overflow_.empty()) {
+            auto st = queue_.try_push(std::move(overflow_.front()));
+            if (st != concurrent::queue_op_status::success) break;
+            overflow_.pop_front();
+        }
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+    }
+
+    /// The ring is closed, overflowed tasks are run directly
+    bool take_overflow(job& j)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (overflow_.empty()) return false;
+        j = std::move(overflow_.front());
+        overflow_.pop_front();
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Called with mutex_ held
+    void spawn()
+    {
+        std::thread(&foreign_thread_pool::worker, this).detach();
+        threads_++;
+    }
+
+    void worker()
+    {
+        typedef std::chrono::steady_clock clock_type;
+        job j;
+        for (;;) {
+            idle_threads_.fetch_add(1, std::memory_order_relaxed);
+            concurrent::queue_op_status st = queue_.try_pop_for(j, idle_timeout_);
+            idle_threads_.fetch_sub(1, std::memory_order_relaxed);
+            if (st == concurrent::queue_op_status::closed && take_overflow(j))
+                st = concurrent::queue_op_status::success;
+            if (st == concurrent::queue_op_status::success) {
+                // Pairs with the fence in push_overflow
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (overflow_size_.load(std::memory_order_relaxed)) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    refill_locked();
+                }
+                clock_type::time_point start = clock_type::now();
+                j.fn_();
+                j.fn_ = detail::small_task();
+                clock_type::time_point end = clock_type::now();
+                wait_ns_.fetch_add(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(start - j.queued_).count(),
+                    std::memory_order_relaxed);
+                run_ns_.fetch_add(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                    std::memory_order_relaxed);
+                completed_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (st == concurrent::queue_op_status::closed || threads_ > min_threads_) {
+                // Nothing touches `this` after the lock is released
+                if (--threads_ == 0) exited_.notify_all();
+                return;
+            }
+        }
+    }
+
+    typedef concurrent::bridge_queue<job> queue_type;
 
+    const std::size_t min_threads_;
+    const std::size_t max_threads_;
+    const std::chrono::steady_clock::duration idle_timeout_;
+    const bool bounded_;
     queue_type queue_;
-    std::vector<std::thread> threads_;
+    // Tasks of an unbounded pool not fitting in the ring, protected by mutex_
+    std::deque<job> overflow_;
+    std::atomic<std::size_t> overflow_size_;
+    mutable std::mutex mutex_;
+    std::condition_variable exited_;
+    std::size_t threads_;
+    std::atomic<std::size_t> idle_threads_;
+    std::atomic<std::uint64_t> completed_;
+    std::atomic<std::uint64_t> wait_ns_;
+    std::atomic<std::uint64_t> run_ns_;
 };
 
 } // End of namespace fibers
@@ -259,6 +721,8 @@ using fibers::async;
 using fibers::async_executor;
 using fibers::async_function;
 using fibers::make_async;
+using fibers::batched_async_function;
+using fibers::make_batched_async;
 using fibers::foreign_thread_pool;
 
 } // End of namespace fibio
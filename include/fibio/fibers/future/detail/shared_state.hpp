@@ -14,6 +14,8 @@
 #define fibio_fibers_future_detail_shared_state_hpp
 
 #include <chrono>
+#include <functional>
+#include <vector>
 #include <boost/assert.hpp>
 #include <boost/atomic.hpp>
 #include <boost/config.hpp>
@@ -63,10 +65,13 @@ private:
     {
         ready_ = true;
         waiters_.notify_all();
-        for (auto& w : ext_waiters_) {
-            relock_guard<mutex> g(mtx_);
-            w();
-        }
+        // External waiters (continuations, when_all/when_any) may hold references to this state,
+        // drop them once fired so the state can be released
+        std::vector<external_waiter> ws;
+        ws.swap(ext_waiters_);
+        relock_guard<mutex> g(mtx_);
+        for (auto& w : ws) w();
+        ws.clear();
     }
 
     void owner_destroyed_()
@@ -115,6 +120,13 @@ private:
         return value_.get();
     }
 
+    R take_(unique_lock<mutex>& lk)
+    {
+        wait_(lk);
+        if (except_) std::rethrow_exception(except_);
+        return std::move(value_.get());
+    }
+
     void wait_(unique_lock<mutex>& lk) const
     {
         // TODO: blocks until the result becomes available
@@ -223,6 +235,13 @@ public:
         return get_(lk);
     }
 
+    /// Waits until the state becomes ready and moves the value out, used by the unique owner
+    R take()
+    {
+        unique_lock<mutex> lk(mtx_);
+        return take_(lk);
+    }
+
     void wait() const
     {
         // TODO: blocks until the result becomes available
@@ -275,10 +294,13 @@ private:
     {
         ready_ = true;
         waiters_.notify_all();
-        for (auto& w : ext_waiters_) {
-            relock_guard<mutex> g(mtx_);
-            w();
-        }
+        // External waiters (continuations, when_all/when_any) may hold references to this state,
+        // drop them once fired so the state can be released
+        std::vector<external_waiter> ws;
+        ws.swap(ext_waiters_);
+        relock_guard<mutex> g(mtx_);
+        for (auto& w : ws) w();
+        ws.clear();
     }
 
     void owner_destroyed_()
@@ -468,10 +490,13 @@ private:
     {
         ready_ = true;
         waiters_.notify_all();
-        for (auto& w : ext_waiters_) {
-            relock_guard<mutex> g(mtx_);
-            w();
-        }
+        // External waiters (continuations, when_all/when_any) may hold references to this state,
+        // drop them once fired so the state can be released
+        std::vector<external_waiter> ws;
+        ws.swap(ext_waiters_);
+        relock_guard<mutex> g(mtx_);
+        for (auto& w : ws) w();
+        ws.clear();
     }
 
     void owner_destroyed_()
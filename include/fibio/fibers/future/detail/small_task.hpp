@@ -0,0 +1,156 @@
+//
+//  small_task.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_fibers_future_detail_small_task_hpp
+#define fibio_fibers_future_detail_small_task_hpp
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace fibio {
+namespace fibers {
+namespace detail {
+
+/**
+ * Move-only `void()` callable
+ *
+ * Callables up to `inline_size` bytes with a nothrow move constructor are stored in place,
+ * bigger ones are allocated on heap, so submitting a small closure never allocates.
+ */
+class small_task
+{
+public:
+    static constexpr std::size_t inline_size = 4 * sizeof(void*);
+
+    small_task() noexcept : ops_(nullptr) {}
+
+    template <typename Fn,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<Fn>::type, small_task>::value>::type>
+    small_task(Fn&& fn)
+    {
+        typedef typename std::decay<Fn>::type fn_type;
+        init<fn_type>(std::forward<Fn>(fn), std::integral_constant<bool, fits<fn_type>()>());
+    }
+
+    small_task(small_task&& other) noexcept : ops_(other.ops_)
+    {
+        if (ops_) {
+            ops_->move(&other.storage_, &storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    small_task& operator=(small_task&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(&other.storage_, &storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    ~small_task() { reset(); }
+
+    void operator()() { ops_->invoke(&storage_); }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+private:
+    small_task(const small_task&) = delete;
+
+    small_task& operator=(const small_task&) = delete;
+
+    typedef std::aligned_storage<inline_size, alignof(std::max_align_t)>::type storage_type;
+
+    struct ops_type
+    {
+        void (*invoke)(void*);
+        void (*move)(void* from, void* to);
+        void (*destroy)(void*);
+    };
+
+    template <typename F>
+    static constexpr bool fits()
+    {
+        return sizeof(F) <= sizeof(storage_type) && alignof(F) <= alignof(storage_type)
+               && std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template <typename F>
+    struct inline_ops
+    {
+        static void invoke(void* p) { (*static_cast<F*>(p))(); }
+
+        static void move(void* from, void* to)
+        {
+            ::new (to) F(std::move(*static_cast<F*>(from)));
+            static_cast<F*>(from)->~F();
+        }
+
+        static void destroy(void* p) { static_cast<F*>(p)->~F(); }
+
+        static const ops_type table;
+    };
+
+    template <typename F>
+    struct heap_ops
+    {
+        static void invoke(void* p) { (**static_cast<F**>(p))(); }
+
+        static void move(void* from, void* to) { *static_cast<F**>(to) = *static_cast<F**>(from); }
+
+        static void destroy(void* p) { delete *static_cast<F**>(p); }
+
+        static const ops_type table;
+    };
+
+    template <typename F, typename Fn>
+    void init(Fn&& fn, std::true_type)
+    {
+        ::new (static_cast<void*>(&storage_)) F(std::forward<Fn>(fn));
+        ops_ = &inline_ops<F>::table;
+    }
+
+    template <typename F, typename Fn>
+    void init(Fn&& fn, std::false_type)
+    {
+        *reinterpret_cast<F**>(&storage_) = new F(std::forward<Fn>(fn));
+        ops_ = &heap_ops<F>::table;
+    }
+
+    void reset() noexcept
+    {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    storage_type storage_;
+    const ops_type* ops_;
+};
+
+template <typename F>
+const small_task::ops_type small_task::inline_ops<F>::table
+    = {&inline_ops<F>::invoke, &inline_ops<F>::move, &inline_ops<F>::destroy};
+
+template <typename F>
+const small_task::ops_type small_task::heap_ops<F>::table
+    = {&heap_ops<F>::invoke, &heap_ops<F>::move, &heap_ops<F>::destroy};
+
+} // End of namespace detail
+} // End of namespace fibers
+} // End of namespace fibio
+
+#endif
@@ -66,6 +66,8 @@ struct async_any_waiter;
 template <typename... Futures>
 struct async_all_waiter;
 
+struct future_access;
+
 } // End of namespace detail
 
 template <typename Iterator>
@@ -115,6 +117,8 @@ private:
     template <typename... Futures>
     friend struct detail::async_all_waiter;
 
+    friend struct detail::future_access;
+
     template <typename Iterator>
     friend auto async_wait_for_any(Iterator begin, Iterator end) ->
         typename std::enable_if<!detail::is_future<Iterator>::value, future<Iterator>>::type;
@@ -191,7 +195,7 @@ public:
         }
         ptr_t tmp;
         tmp.swap(state_);
-        return tmp->get();
+        return tmp->take();
     }
 
     /// Blocks until the result becomes available
@@ -227,6 +231,11 @@ public:
 
     template <typename F>
     future<typename std::result_of<F(future&)>::type> then(F&& func);
+
+    /// Same as then(func), but the continuation is submitted to ex instead of running inline in
+    /// the context making the future ready, ex must outlive the continuation
+    template <typename Executor, typename F>
+    future<typename std::result_of<F(future&)>::type> then(Executor& ex, F&& func);
 };
 
 template <typename R>
@@ -260,6 +269,8 @@ private:
     template <typename... Futures>
     friend struct detail::async_all_waiter;
 
+    friend struct detail::future_access;
+
     template <typename Iterator>
     friend auto async_wait_for_any(Iterator begin, Iterator end) ->
         typename std::enable_if<!detail::is_future<Iterator>::value, future<Iterator>>::type;
@@ -372,6 +383,11 @@ public:
 
     template <typename F>
     future<typename std::result_of<F(future&)>::type> then(F&& func);
+
+    /// Same as then(func), but the continuation is submitted to ex instead of running inline in
+    /// the context making the future ready, ex must outlive the continuation
+    template <typename Executor, typename F>
+    future<typename std::result_of<F(future&)>::type> then(Executor& ex, F&& func);
 };
 
 template <>
@@ -405,6 +421,8 @@ private:
     template <typename... Futures>
     friend struct detail::async_all_waiter;
 
+    friend struct detail::future_access;
+
     template <typename Iterator>
     friend auto async_wait_for_any(Iterator begin, Iterator end) ->
         typename std::enable_if<!detail::is_future<Iterator>::value, future<Iterator>>::type;
@@ -517,6 +535,11 @@ public:
 
     template <typename F>
     future<typename std::result_of<F(future&)>::type> then(F&& func);
+
+    /// Same as then(func), but the continuation is submitted to ex instead of running inline in
+    /// the context making the future ready, ex must outlive the continuation
+    template <typename Executor, typename F>
+    future<typename std::result_of<F(future&)>::type> then(Executor& ex, F&& func);
 };
 
 template <typename R>
@@ -551,6 +574,8 @@ private:
     template <typename... Futures>
     friend struct detail::async_all_waiter;
 
+    friend struct detail::future_access;
+
     template <typename Iterator>
     friend auto async_wait_for_any(Iterator begin, Iterator end) ->
         typename std::enable_if<!detail::is_future<Iterator>::value, future<Iterator>>::type;
@@ -678,6 +703,11 @@ public:
 
     template <typename F>
     future<typename std::result_of<F(shared_future&)>::type> then(F&& func);
+
+    /// Same as then(func), but the continuation is submitted to ex instead of running inline in
+    /// the context making the future ready, ex must outlive the continuation
+    template <typename Executor, typename F>
+    future<typename std::result_of<F(shared_future&)>::type> then(Executor& ex, F&& func);
 };
 
 template <typename R>
@@ -706,6 +736,8 @@ private:
     template <typename... Futures>
     friend struct detail::async_all_waiter;
 
+    friend struct detail::future_access;
+
     template <typename Iterator>
     friend auto async_wait_for_any(Iterator begin, Iterator end) ->
         typename std::enable_if<!detail::is_future<Iterator>::value, future<Iterator>>::type;
@@ -833,6 +865,11 @@ public:
 
     template <typename F>
     future<typename std::result_of<F(shared_future&)>::type> then(F&& func);
+
+    /// Same as then(func), but the continuation is submitted to ex instead of running inline in
+    /// the context making the future ready, ex must outlive the continuation
+    template <typename Executor, typename F>
+    future<typename std::result_of<F(shared_future&)>::type> then(Executor& ex, F&& func);
 };
 
 template <>
@@ -861,6 +898,8 @@ private:
     template <typename... Futures>
     friend struct detail::async_all_waiter;
 
+    friend struct detail::future_access;
+
     template <typename Iterator>
     friend auto async_wait_for_any(Iterator begin, Iterator end) ->
         typename std::enable_if<!detail::is_future<Iterator>::value, future<Iterator>>::type;
@@ -991,6 +1030,11 @@ public:
 
     template <typename F>
     future<typename std::result_of<F(shared_future&)>::type> then(F&& func);
+
+    /// Same as then(func), but the continuation is submitted to ex instead of running inline in
+    /// the context making the future ready, ex must outlive the continuation
+    template <typename Executor, typename F>
+    future<typename std::result_of<F(shared_future&)>::type> then(Executor& ex, F&& func);
 };
 
 template <typename R>
@@ -0,0 +1,373 @@
+//
+//  oneshot.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_fibers_future_oneshot_hpp
+#define fibio_fibers_future_oneshot_hpp
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/optional.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/utility.hpp>
+#include <fibio/utility.hpp>
+#include <fibio/fibers/exceptions.hpp>
+#include <fibio/fibers/detail/fiber_base.hpp>
+#include <fibio/fibers/future/future_status.hpp>
+
+namespace fibio {
+namespace fibers {
+
+template <typename R>
+class oneshot_promise;
+
+template <typename R>
+class oneshot_future;
+
+namespace detail {
+
+/// Shared state for one producer and one consumer
+/**
+ * Readiness and the waiting fiber are published through a single atomic word, there is no
+ * mutex or condition variable involved, setting the value wakes up the waiter with one post.
+ * The producer can be any OS thread, the consumer can be a fiber or a plain thread, the latter
+ * blocks on the state word with futex (or a process-wide condition variable on other platforms)
+ */
+class oneshot_state_base : private boost::noncopyable
+{
+public:
+    oneshot_state_base() : state_(EMPTY), satisfied_(false), use_count_(0) {}
+
+    virtual ~oneshot_state_base() {}
+
+    bool ready() const noexcept { return state_.load(std::memory_order_acquire) == READY; }
+
+    /// Blocks current fiber or thread until the state becomes ready
+    void wait();
+
+    /// Blocks current fiber or thread until the state becomes ready or timeout
+    future_status wait_until(std::chrono::steady_clock::time_point timeout_time);
+
+    friend inline void intrusive_ptr_add_ref(oneshot_state_base* p) noexcept
+    {
+        p->use_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend inline void intrusive_ptr_release(oneshot_state_base* p)
+    {
+        if (p->use_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) p->deallocate_state();
+    }
+
+protected:
+    /// Reserve the right to store the result, throws if the state is already satisfied
+    void claim()
+    {
+        if (satisfied_.exchange(true, std::memory_order_relaxed))
+            BOOST_THROW_EXCEPTION(promise_already_satisfied());
+    }
+
+    bool claimed() const noexcept { return satisfied_.load(std::memory_order_relaxed); }
+
+    /// Mark the state ready after the result is stored, resumes the waiting fiber if any
+    void publish();
+
+    virtual void deallocate_state() = 0;
+
+private:
+    enum
+    {
+        EMPTY,
+        WAITING,
+        THREAD_WAITING,
+        READY,
+    };
+
+    bool cancel_wait();
+
+    bool begin_wait(int waiting_state);
+
+    void thread_wait();
+
+    future_status thread_wait_until(std::chrono::steady_clock::time_point timeout_time);
+
+    void thread_notify();
+
+    std::atomic<int> state_;
+    std::atomic<bool> satisfied_;
+    std::atomic<std::size_t> use_count_;
+    fiber_base::ptr_t waiter_;
+};
+
+template <typename R>
+class oneshot_state : public oneshot_state_base
+{
+public:
+    typedef boost::intrusive_ptr<oneshot_state> ptr_t;
+
+    template <typename V>
+    void set_value(V&& v)
+    {
+        claim();
+        try {
+            value_ = std::forward<V>(v);
+        } catch (...) {
+            // The state is already claimed, the waiter gets the exception instead of hanging
+            except_ = std::current_exception();
+            publish();
+            throw;
+        }
+        publish();
+    }
+
+    void set_exception(std::exception_ptr except)
+    {
+        claim();
+        except_ = except;
+        publish();
+    }
+
+    void owner_destroyed()
+    {
+        if (!claimed()) set_exception(utility::copy_exception(broken_promise()));
+    }
+
+    R get()
+    {
+        wait();
+        if (except_) std::rethrow_exception(except_);
+        return std::forward<R>(*value_);
+    }
+
+private:
+    boost::optional<R> value_;
+    std::exception_ptr except_;
+};
+
+template <>
+class oneshot_state<void> : public oneshot_state_base
+{
+public:
+    typedef boost::intrusive_ptr<oneshot_state> ptr_t;
+
+    void set_value()
+    {
+        claim();
+        publish();
+    }
+
+    void set_exception(std::exception_ptr except)
+    {
+        claim();
+        except_ = except;
+        publish();
+    }
+
+    void owner_destroyed()
+    {
+        if (!claimed()) set_exception(utility::copy_exception(broken_promise()));
+    }
+
+    void get()
+    {
+        wait();
+        if (except_) std::rethrow_exception(except_);
+    }
+
+private:
+    std::exception_ptr except_;
+};
+
+template <typename R, typename Allocator>
+class oneshot_state_object : public oneshot_state<R>
+{
+public:
+    typedef
+        typename Allocator::template rebind<oneshot_state_object<R, Allocator>>::other allocator_t;
+
+    oneshot_state_object(allocator_t const& alloc) : oneshot_state<R>(), alloc_(alloc) {}
+
+protected:
+    void deallocate_state() override
+    {
+        allocator_t alloc(alloc_);
+        alloc.destroy(this);
+        alloc.deallocate(this, 1);
+    }
+
+private:
+    allocator_t alloc_;
+};
+
+} // End of namespace detail
+
+/// Future of a oneshot_promise
+/**
+ * Only one fiber may wait on it, the value is moved out by get()
+ */
+template <typename R>
+class oneshot_future
+{
+    typedef typename detail::oneshot_state<R>::ptr_t ptr_t;
+
+    friend class oneshot_promise<R>;
+
+    ptr_t state_;
+
+    explicit oneshot_future(ptr_t const& p) : state_(p) {}
+
+    oneshot_future(const oneshot_future&) = delete;
+
+    oneshot_future& operator=(const oneshot_future&) = delete;
+
+public:
+    oneshot_future() noexcept : state_() {}
+
+    oneshot_future(oneshot_future&& other) noexcept : state_() { swap(other); }
+
+    oneshot_future& operator=(oneshot_future&& other) noexcept
+    {
+        oneshot_future tmp(std::move(other));
+        swap(tmp);
+        return *this;
+    }
+
+    void swap(oneshot_future& other) noexcept { state_.swap(other.state_); }
+
+    bool valid() const noexcept { return 0 != state_.get(); }
+
+    /// Checks if the result is available without blocking
+    bool is_ready() const noexcept { return valid() && state_->ready(); }
+
+    /// Waits for the result and retrieves it, valid() == false after the call
+    R get()
+    {
+        if (!valid()) {
+            BOOST_THROW_EXCEPTION(future_uninitialized());
+        }
+        ptr_t tmp;
+        tmp.swap(state_);
+        return tmp->get();
+    }
+
+    void wait() const
+    {
+        if (!valid()) {
+            BOOST_THROW_EXCEPTION(future_uninitialized());
+        }
+        state_->wait();
+    }
+
+    template <class Rep, class Period>
+    future_status wait_for(std::chrono::duration<Rep, Period> const& timeout_duration) const
+    {
+        return wait_until(std::chrono::steady_clock::now() + timeout_duration);
+    }
+
+    future_status wait_until(std::chrono::steady_clock::time_point const& timeout_time) const
+    {
+        if (!valid()) {
+            BOOST_THROW_EXCEPTION(future_uninitialized());
+        }
+        return state_->wait_until(timeout_time);
+    }
+};
+
+/// Promise for the one-producer, one-consumer case
+/**
+ * Lighter than promise, no mutex or condition variable is allocated and only one fiber may wait
+ * on the future, there is no shared_future or continuation support
+ */
+template <typename R>
+class oneshot_promise
+{
+    typedef typename detail::oneshot_state<R>::ptr_t ptr_t;
+
+    bool obtained_;
+    ptr_t state_;
+
+    oneshot_promise(const oneshot_promise&) = delete;
+
+    oneshot_promise& operator=(const oneshot_promise&) = delete;
+
+    template <typename Allocator>
+    void init(const Allocator& alloc)
+    {
+        typedef detail::oneshot_state_object<R, Allocator> object_t;
+        typename object_t::allocator_t a(alloc);
+        // placement new
+        state_ = ptr_t(::new (a.allocate(1)) object_t(a));
+    }
+
+public:
+    oneshot_promise() : obtained_(false), state_() { init(std::allocator<oneshot_promise>()); }
+
+    template <typename Allocator>
+    oneshot_promise(std::allocator_arg_t, const Allocator& alloc)
+    : obtained_(false), state_()
+    {
+        init(alloc);
+    }
+
+    ~oneshot_promise()
+    {
+        if (state_) state_->owner_destroyed();
+    }
+
+    oneshot_promise(oneshot_promise&& other) noexcept : obtained_(false), state_() { swap(other); }
+
+    oneshot_promise& operator=(oneshot_promise&& other) noexcept
+    {
+        oneshot_promise tmp(std::move(other));
+        swap(tmp);
+        return *this;
+    }
+
+    void swap(oneshot_promise& other) noexcept
+    {
+        std::swap(obtained_, other.obtained_);
+        state_.swap(other.state_);
+    }
+
+    oneshot_future<R> get_future()
+    {
+        if (obtained_) BOOST_THROW_EXCEPTION(future_already_retrieved());
+        if (!state_) BOOST_THROW_EXCEPTION(promise_uninitialized());
+        obtained_ = true;
+        return oneshot_future<R>(state_);
+    }
+
+    template <typename V>
+    void set_value(V&& value)
+    {
+        if (!state_) BOOST_THROW_EXCEPTION(promise_uninitialized());
+        state_->set_value(std::forward<V>(value));
+    }
+
+    /// Only available for oneshot_promise<void>
+    void set_value()
+    {
+        if (!state_) BOOST_THROW_EXCEPTION(promise_uninitialized());
+        state_->set_value();
+    }
+
+    void set_exception(std::exception_ptr p)
+    {
+        if (!state_) BOOST_THROW_EXCEPTION(promise_uninitialized());
+        state_->set_exception(p);
+    }
+};
+
+} // End of namespace fibers
+
+using fibers::oneshot_promise;
+using fibers::oneshot_future;
+
+} // End of namespace fibio
+
+#endif
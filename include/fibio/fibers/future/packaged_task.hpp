@@ -72,7 +72,7 @@ public:
     template <typename Fn, typename Allocator>
     explicit packaged_task(std::allocator_arg_t, const Allocator& alloc, Fn&& fn)
     {
-        typedef detail::task_object<Fn, std::allocator<this_type>, R, Args...> object_t;
+        typedef detail::task_object<Fn, Allocator, R, Args...> object_t;
         typename object_t::allocator_t a(alloc);
         // placement new
         task_ = ptr_t(::new (a.allocate(1)) object_t(std::forward<Fn>(fn), a));
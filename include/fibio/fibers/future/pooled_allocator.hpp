@@ -0,0 +1,101 @@
+//
+//  pooled_allocator.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_fibers_future_pooled_allocator_hpp
+#define fibio_fibers_future_pooled_allocator_hpp
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace fibio {
+namespace fibers {
+namespace detail {
+
+/// Allocate a block from the free list of calling thread, falls back to operator new for sizes
+/// bigger than the largest size class
+void* pool_allocate(std::size_t size);
+
+/// Return a block to the free list of calling thread, the block may come from another thread
+void pool_deallocate(void* p, std::size_t size) noexcept;
+
+} // End of namespace detail
+
+/// Allocator keeps per-worker-thread free lists for small objects
+/**
+ * Designed for shared states of promise/packaged_task/async, which are allocated and released
+ * once per request, all instances are interchangeable
+ */
+template <typename T>
+struct pooled_allocator
+{
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef pooled_allocator<U> other;
+    };
+
+    pooled_allocator() noexcept {}
+
+    template <typename U>
+    pooled_allocator(const pooled_allocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (n == 1) return static_cast<T*>(detail::pool_allocate(sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if (n == 1)
+            detail::pool_deallocate(p, sizeof(T));
+        else
+            ::operator delete(p);
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U* p)
+    {
+        p->~U();
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const pooled_allocator<T>&, const pooled_allocator<U>&) noexcept
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const pooled_allocator<T>&, const pooled_allocator<U>&) noexcept
+{
+    return false;
+}
+
+} // End of namespace fibers
+
+using fibers::pooled_allocator;
+
+} // End of namespace fibio
+
+#endif
@@ -12,7 +12,11 @@
 #ifndef fibio_fibers_future_promise_hpp
 #define fibio_fibers_future_promise_hpp
 
+#include <atomic>
+#include <iterator>
 #include <memory>
+#include <tuple>
+#include <vector>
 
 #include <boost/config.hpp>
 #include <boost/move/move.hpp>
@@ -462,6 +466,15 @@ inline future<void> make_ready_future()
     return p.get_future();
 }
 
+/// Result of when_any, futures is the whole input sequence and index refers to the first future
+/// became ready, or std::size_t(-1) if the sequence is empty
+template <typename Sequence>
+struct when_any_result
+{
+    std::size_t index;
+    Sequence futures;
+};
+
 namespace detail {
 
 // HACK: C++ forbids variable with `void` type as it is always incomplete
@@ -621,154 +634,279 @@ future<void> async_wait_for_all2(std::tuple<Futures&...>&& futures,
     return state->get_future();
 }
 
-} // End of namespace detail
+/// Executor runs continuations inline, in the context that makes the future ready
+struct inline_executor
+{
+    template <typename Task>
+    void operator()(Task&& task)
+    {
+        std::forward<Task>(task)();
+    }
 
-template <typename R>
-template <typename F>
-inline future<typename std::result_of<F(future<R>&)>::type> future<R>::then(F&& func)
+    static inline_executor& instance()
+    {
+        static inline_executor ex;
+        return ex;
+    }
+};
+
+struct future_access
 {
-    typedef typename std::result_of<F(future<R>&)>::type result_type;
-    struct waiter
+    template <typename Future>
+    static auto state(Future& f) -> decltype(f.state_)
     {
-        ptr_t src_;
-        F f_;
-        promise<result_type> p_;
+        return f.state_;
+    }
+};
+
+template <typename Future, typename F>
+struct continuation
+{
+    typedef typename std::result_of<F(Future&)>::type result_type;
 
-        waiter(ptr_t src, F&& f) : src_(src), f_(std::forward<F>(f)) {}
+    continuation(Future&& src, F&& fn) : src_(std::move(src)), fn_(std::forward<F>(fn)) {}
 
-        void invoke()
-        {
-            future<R> f(src_);
-            detail::set_promise_value(p_, std::forward<F>(f_), f);
+    future<result_type> get_future() { return p_.get_future(); }
+
+    void operator()()
+    {
+        // Exceptions go to the returned future instead of the fiber making the source ready
+        try {
+            set_promise_value(p_, fn_, src_);
+        } catch (...) {
+            p_.set_exception(std::current_exception());
         }
-    };
-    std::shared_ptr<waiter> w = std::make_shared<waiter>(state_, std::forward<F>(func));
-    state_->add_external_waiter(std::bind(&waiter::invoke, w));
-    return w->p_.get_future();
+    }
+
+    Future src_;
+    typename std::decay<F>::type fn_;
+    promise<result_type> p_;
+};
+
+template <typename Future, typename StatePtr, typename Executor, typename F>
+future<typename continuation<Future, F>::result_type>
+attach_continuation(const StatePtr& state, Future&& src, Executor& ex, F&& fn)
+{
+    typedef continuation<Future, F> continuation_type;
+    std::shared_ptr<continuation_type> c
+        = std::make_shared<continuation_type>(std::move(src), std::forward<F>(fn));
+    future<typename continuation_type::result_type> ret(c->get_future());
+    Executor* e = &ex;
+    state->add_external_waiter([c, e]() { (*e)([c]() { (*c)(); }); });
+    return ret;
 }
 
 template <typename R>
-template <typename F>
-inline future<typename std::result_of<F(future<R&>&)>::type> future<R&>::then(F&& func)
+future<R> capture_future(future<R>& f)
 {
-    typedef typename std::result_of<F(future<R&>&)>::type result_type;
+    return std::move(f);
+}
 
-    struct waiter
+template <typename R>
+shared_future<R> capture_future(shared_future<R>& f)
+{
+    return f;
+}
+
+template <typename Sequence>
+struct when_all_state
+{
+    typedef std::shared_ptr<when_all_state> ptr;
+
+    // One extra count is held by the registering caller, so the sequence cannot be handed out
+    // before every future got its waiter
+    when_all_state(Sequence&& futures, std::size_t count)
+    : futures_(std::move(futures)), pending_(count + 1)
     {
-        ptr_t src_;
-        F f_;
-        promise<result_type> p_;
+    }
 
-        waiter(ptr_t src, F&& f) : src_(src), f_(std::forward<F>(f)) {}
+    void count_down()
+    {
+        if (--pending_ == 0) p_.set_value(std::move(futures_));
+    }
 
-        void invoke()
-        {
-            future<R&> f(src_);
-            detail::set_promise_value(p_, std::forward<F>(f_), f);
-        }
-    };
+    template <typename F>
+    static void watch(const ptr& s, F& f)
+    {
+        future_access::state(f)->add_external_waiter([s]() { s->count_down(); });
+    }
 
-    std::shared_ptr<waiter> w = std::make_shared<waiter>(state_, std::forward<F>(func));
-    state_->add_external_waiter(std::bind(&waiter::invoke, w));
-    return w->p_.get_future();
-}
+    Sequence futures_;
+    std::atomic<std::size_t> pending_;
+    promise<Sequence> p_;
+};
 
-template <typename F>
-inline future<typename std::result_of<F(future<void>&)>::type> future<void>::then(F&& func)
+template <typename Sequence>
+struct when_any_state
 {
-    typedef typename std::result_of<F(future<void>&)>::type result_type;
-    struct waiter
+    typedef std::shared_ptr<when_any_state> ptr;
+
+    // The first ready future and the registering caller both count down, an empty sequence only
+    // waits for the caller
+    when_any_state(Sequence&& futures, std::size_t count)
+    : futures_(std::move(futures)), index_(std::size_t(-1)), pending_(count ? 2 : 1)
     {
-        ptr_t src_;
-        F f_;
-        promise<result_type> p_;
+    }
 
-        waiter(ptr_t src, F&& f) : src_(src), f_(std::forward<F>(f)) {}
+    void ready(std::size_t i)
+    {
+        std::size_t expected = std::size_t(-1);
+        if (index_.compare_exchange_strong(expected, i)) count_down();
+    }
 
-        void invoke()
-        {
-            future<void> f(src_);
-            detail::set_promise_value(p_, std::forward<F>(f_), f);
-        }
-    };
-    std::shared_ptr<waiter> w = std::make_shared<waiter>(state_, std::forward<F>(func));
-    state_->add_external_waiter(std::bind(&waiter::invoke, w));
-    return w->p_.get_future();
+    void count_down()
+    {
+        if (--pending_ == 0) p_.set_value(when_any_result<Sequence>{index_, std::move(futures_)});
+    }
+
+    template <typename F>
+    static void watch(const ptr& s, F& f, std::size_t i)
+    {
+        future_access::state(f)->add_external_waiter([s, i]() { s->ready(i); });
+    }
+
+    Sequence futures_;
+    std::atomic<std::size_t> index_;
+    std::atomic<std::size_t> pending_;
+    promise<when_any_result<Sequence>> p_;
+};
+
+template <typename Sequence, std::size_t... Indices>
+void watch_all(const std::shared_ptr<when_all_state<Sequence>>& s,
+               utility::tuple_indices<Indices...>)
+{
+    int expander[] = {0, (when_all_state<Sequence>::watch(
+                              s, std::get<Indices>(s->futures_)),
+                          0)...};
+    (void)expander;
 }
 
+template <typename Sequence, std::size_t... Indices>
+void watch_any(const std::shared_ptr<when_any_state<Sequence>>& s,
+               utility::tuple_indices<Indices...>)
+{
+    int expander[] = {0, (when_any_state<Sequence>::watch(
+                              s, std::get<Indices>(s->futures_), Indices),
+                          0)...};
+    (void)expander;
+}
+
+} // End of namespace detail
+
 template <typename R>
 template <typename F>
-inline future<typename std::result_of<F(shared_future<R>&)>::type> shared_future<R>::then(F&& func)
+inline future<typename std::result_of<F(future<R>&)>::type> future<R>::then(F&& func)
 {
-    typedef typename std::result_of<F(shared_future<R>&)>::type result_type;
-    struct waiter
-    {
-        ptr_t src_;
-        F f_;
-        promise<result_type> p_;
+    return then(detail::inline_executor::instance(), std::forward<F>(func));
+}
 
-        waiter(ptr_t src, F&& f) : src_(src), f_(std::forward<F>(f)) {}
+template <typename R>
+template <typename Executor, typename F>
+inline future<typename std::result_of<F(future<R>&)>::type> future<R>::then(Executor& ex, F&& func)
+{
+    if (!valid()) {
+        BOOST_THROW_EXCEPTION(future_uninitialized());
+    }
+    // The continuation becomes the only owner of the shared state
+    ptr_t tmp;
+    tmp.swap(state_);
+    return detail::attach_continuation(tmp, future<R>(tmp), ex, std::forward<F>(func));
+}
 
-        void invoke()
-        {
-            shared_future<R> f(src_);
-            detail::set_promise_value(p_, std::forward<F>(f_), f);
-        }
-    };
-    std::shared_ptr<waiter> w = std::make_shared<waiter>(state_, std::forward<F>(func));
-    state_->add_external_waiter(std::bind(&waiter::invoke, w));
-    return w->p_.get_future();
+template <typename R>
+template <typename F>
+inline future<typename std::result_of<F(future<R&>&)>::type> future<R&>::then(F&& func)
+{
+    return then(detail::inline_executor::instance(), std::forward<F>(func));
 }
 
 template <typename R>
+template <typename Executor, typename F>
+inline future<typename std::result_of<F(future<R&>&)>::type>
+future<R&>::then(Executor& ex, F&& func)
+{
+    if (!valid()) {
+        BOOST_THROW_EXCEPTION(future_uninitialized());
+    }
+    // The continuation becomes the only owner of the shared state
+    ptr_t tmp;
+    tmp.swap(state_);
+    return detail::attach_continuation(tmp, future<R&>(tmp), ex, std::forward<F>(func));
+}
+
 template <typename F>
-inline future<typename std::result_of<F(shared_future<R&>&)>::type>
-shared_future<R&>::then(F&& func)
+inline future<typename std::result_of<F(future<void>&)>::type> future<void>::then(F&& func)
 {
-    typedef typename std::result_of<F(shared_future<R&>&)>::type result_type;
+    return then(detail::inline_executor::instance(), std::forward<F>(func));
+}
 
-    struct waiter
-    {
-        ptr_t src_;
-        F f_;
-        promise<result_type> p_;
+template <typename Executor, typename F>
+inline future<typename std::result_of<F(future<void>&)>::type>
+future<void>::then(Executor& ex, F&& func)
+{
+    if (!valid()) {
+        BOOST_THROW_EXCEPTION(future_uninitialized());
+    }
+    // The continuation becomes the only owner of the shared state
+    ptr_t tmp;
+    tmp.swap(state_);
+    return detail::attach_continuation(tmp, future<void>(tmp), ex, std::forward<F>(func));
+}
 
-        waiter(ptr_t src, F&& f) : src_(src), f_(std::forward<F>(f)) {}
+template <typename R>
+template <typename F>
+inline future<typename std::result_of<F(shared_future<R>&)>::type> shared_future<R>::then(F&& func)
+{
+    return then(detail::inline_executor::instance(), std::forward<F>(func));
+}
 
-        void invoke()
-        {
-            shared_future<R&> f(src_);
-            detail::set_promise_value(p_, std::forward<F>(f_), f);
-        }
-    };
+template <typename R>
+template <typename Executor, typename F>
+inline future<typename std::result_of<F(shared_future<R>&)>::type>
+shared_future<R>::then(Executor& ex, F&& func)
+{
+    if (!valid()) {
+        BOOST_THROW_EXCEPTION(future_uninitialized());
+    }
+    return detail::attach_continuation(state_, shared_future<R>(state_), ex, std::forward<F>(func));
+}
+
+template <typename R>
+template <typename F>
+inline future<typename std::result_of<F(shared_future<R&>&)>::type>
+shared_future<R&>::then(F&& func)
+{
+    return then(detail::inline_executor::instance(), std::forward<F>(func));
+}
 
-    std::shared_ptr<waiter> w = std::make_shared<waiter>(state_, std::forward<F>(func));
-    state_->add_external_waiter(std::bind(&waiter::invoke, w));
-    return w->p_.get_future();
+template <typename R>
+template <typename Executor, typename F>
+inline future<typename std::result_of<F(shared_future<R&>&)>::type>
+shared_future<R&>::then(Executor& ex, F&& func)
+{
+    if (!valid()) {
+        BOOST_THROW_EXCEPTION(future_uninitialized());
+    }
+    return detail::attach_continuation(
+        state_, shared_future<R&>(state_), ex, std::forward<F>(func));
 }
 
 template <typename F>
 inline future<typename std::result_of<F(shared_future<void>&)>::type>
 shared_future<void>::then(F&& func)
 {
-    typedef typename std::result_of<F(shared_future<void>&)>::type result_type;
-    struct waiter
-    {
-        ptr_t src_;
-        F f_;
-        promise<result_type> p_;
-
-        waiter(ptr_t src, F&& f) : src_(src), f_(std::forward<F>(f)) {}
+    return then(detail::inline_executor::instance(), std::forward<F>(func));
+}
 
-        void invoke()
-        {
-            shared_future<void> f(src_);
-            detail::set_promise_value(p_, std::forward<F>(f_), f);
-        }
-    };
-    std::shared_ptr<waiter> w = std::make_shared<waiter>(state_, std::forward<F>(func));
-    state_->add_external_waiter(std::bind(&waiter::invoke, w));
-    return w->p_.get_future();
+template <typename Executor, typename F>
+inline future<typename std::result_of<F(shared_future<void>&)>::type>
+shared_future<void>::then(Executor& ex, F&& func)
+{
+    if (!valid()) {
+        BOOST_THROW_EXCEPTION(future_uninitialized());
+    }
+    return detail::attach_continuation(
+        state_, shared_future<void>(state_), ex, std::forward<F>(func));
 }
 
 template <typename... Futures>
@@ -856,10 +994,86 @@ auto async_wait_for_all(Iterator begin, Iterator end) ->
     return state->get_future();
 }
 
+/// Returns a future becomes ready when all input futures are ready, the input futures are moved
+/// (future) or copied (shared_future) into the result, no fiber waits in between
+template <typename Iterator>
+auto when_all(Iterator begin, Iterator end) -> typename std::enable_if<
+    !detail::is_future<Iterator>::value,
+    future<std::vector<typename std::iterator_traits<Iterator>::value_type>>>::type
+{
+    typedef typename std::iterator_traits<Iterator>::value_type value_type;
+    static_assert(detail::is_future<value_type>::value, "Iterator must refer to future type");
+    typedef std::vector<value_type> sequence_type;
+    sequence_type futures;
+    for (Iterator i = begin; i != end; ++i) futures.push_back(detail::capture_future(*i));
+    std::size_t count = futures.size();
+    auto s = std::make_shared<detail::when_all_state<sequence_type>>(std::move(futures), count);
+    future<sequence_type> ret(s->p_.get_future());
+    for (auto& f : s->futures_) detail::when_all_state<sequence_type>::watch(s, f);
+    s->count_down();
+    return ret;
+}
+
+template <typename... Futures>
+auto when_all(Futures&&... futures) -> typename std::enable_if<
+    utility::and_<detail::is_future<typename std::decay<Futures>::type>::value...>::value,
+    future<std::tuple<typename std::decay<Futures>::type...>>>::type
+{
+    typedef std::tuple<typename std::decay<Futures>::type...> sequence_type;
+    typedef typename utility::make_tuple_indices<sizeof...(Futures)>::type index_type;
+    auto s = std::make_shared<detail::when_all_state<sequence_type>>(
+        sequence_type(std::forward<Futures>(futures)...), sizeof...(Futures));
+    future<sequence_type> ret(s->p_.get_future());
+    detail::watch_all(s, index_type());
+    s->count_down();
+    return ret;
+}
+
+/// Returns a future becomes ready when any of the input futures is ready, the result carries the
+/// input futures along with the index of the first ready one
+template <typename Iterator>
+auto when_any(Iterator begin, Iterator end) -> typename std::enable_if<
+    !detail::is_future<Iterator>::value,
+    future<when_any_result<std::vector<typename std::iterator_traits<Iterator>::value_type>>>>::
+    type
+{
+    typedef typename std::iterator_traits<Iterator>::value_type value_type;
+    static_assert(detail::is_future<value_type>::value, "Iterator must refer to future type");
+    typedef std::vector<value_type> sequence_type;
+    sequence_type futures;
+    for (Iterator i = begin; i != end; ++i) futures.push_back(detail::capture_future(*i));
+    std::size_t count = futures.size();
+    auto s = std::make_shared<detail::when_any_state<sequence_type>>(std::move(futures), count);
+    future<when_any_result<sequence_type>> ret(s->p_.get_future());
+    for (std::size_t i = 0; i < count; i++) {
+        detail::when_any_state<sequence_type>::watch(s, s->futures_[i], i);
+    }
+    s->count_down();
+    return ret;
+}
+
+template <typename... Futures>
+auto when_any(Futures&&... futures) -> typename std::enable_if<
+    utility::and_<detail::is_future<typename std::decay<Futures>::type>::value...>::value,
+    future<when_any_result<std::tuple<typename std::decay<Futures>::type...>>>>::type
+{
+    typedef std::tuple<typename std::decay<Futures>::type...> sequence_type;
+    typedef typename utility::make_tuple_indices<sizeof...(Futures)>::type index_type;
+    auto s = std::make_shared<detail::when_any_state<sequence_type>>(
+        sequence_type(std::forward<Futures>(futures)...), sizeof...(Futures));
+    future<when_any_result<sequence_type>> ret(s->p_.get_future());
+    detail::watch_any(s, index_type());
+    s->count_down();
+    return ret;
+}
+
 } // End of namespace fibers
 
 using fibers::promise;
 using fibers::make_ready_future;
+using fibers::when_all;
+using fibers::when_any;
+using fibers::when_any_result;
 
 } // End of namespace fibio
 
@@ -0,0 +1,224 @@
+//
+//  generator.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_generator_hpp
+#define fibio_generator_hpp
+
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <boost/optional.hpp>
+#include <fibio/fibers/fiber.hpp>
+#include <fibio/fibers/mutex.hpp>
+#include <fibio/fibers/condition_variable.hpp>
+
+namespace fibio {
+namespace fibers {
+namespace detail {
+
+/// Thrown out of `yield` to unwind the producer body when the generator is destroyed early
+struct generator_cancelled
+{
+};
+
+} // End of namespace detail
+
+/**
+ * Lazy sequence of values produced by a body running in its own fiber
+ *
+ * The body is called with a `yield_type&` and passes each value to it, it only runs while the
+ * consumer is waiting for the next value, so nothing is produced ahead of time, and it can block
+ * on any fibio I/O in between. An exception escaping the body is rethrown to the consumer.
+ *
+ * Destroying the generator before the sequence ends makes the pending `yield` throw to unwind
+ * the body, the destructor waits for the body to return.
+ */
+template <typename T>
+class generator
+{
+    struct impl;
+
+public:
+    typedef T value_type;
+    typedef T& reference;
+
+    /**
+     * Passed to the body, calling it hands a value to the consumer and suspends the body
+     */
+    class yield_type
+    {
+    public:
+        void operator()(const T& v) { impl_->yield(v); }
+
+        void operator()(T&& v) { impl_->yield(std::move(v)); }
+
+    private:
+        explicit yield_type(impl* i) : impl_(i) {}
+
+        yield_type(const yield_type&) = delete;
+
+        void operator=(const yield_type&) = delete;
+
+        impl* impl_;
+        friend struct impl;
+    };
+
+    typedef std::function<void(yield_type&)> body_type;
+
+    template <typename Fn>
+    explicit generator(Fn&& body)
+    : impl_(new impl(body_type(std::forward<Fn>(body)))), fiber_(&impl::run, impl_.get())
+    {
+    }
+
+    generator(generator&&) = default;
+
+    ~generator()
+    {
+        if (impl_) {
+            impl_->cancel();
+            fiber_.join();
+        }
+    }
+
+    /**
+     * Minimal range-based for loop support
+     * It's not a fully functional iterator and should not be used directly
+     */
+    struct iterator : std::iterator<std::input_iterator_tag, T>
+    {
+        iterator(iterator&& other) = default;
+
+        bool operator!=(const iterator& other) const
+        {
+            // Only ended iterators are equal
+            return !(ended() && other.ended());
+        }
+
+        iterator& operator++()
+        {
+            if (!impl_->next()) impl_ = 0;
+            return *this;
+        }
+
+        reference operator*() { return *impl_->value_; }
+
+        T* operator->() { return &*impl_->value_; }
+
+    private:
+        bool ended() const { return !impl_; }
+
+        iterator() : impl_(0) {}
+
+        iterator(impl* i) : impl_(i) { operator++(); }
+
+        iterator(const iterator& other) = delete;
+
+        iterator& operator=(const iterator& other) = delete;
+
+        impl* impl_;
+        friend class generator;
+    };
+
+    /**
+     * Minimal range-based for loop support
+     * Resumes the body and returns an iterator to the next value
+     */
+    iterator begin() { return iterator(impl_.get()); }
+
+    /**
+     * Minimal range-based for loop support
+     * Returns an iterator indicates the sequence is ended
+     */
+    iterator end() const { return iterator(); }
+
+private:
+    struct impl
+    {
+        enum state_type { idle, requested, ready, done, cancelled };
+
+        impl(body_type&& body) : body_(std::move(body)), state_(idle) {}
+
+        void run()
+        {
+            {
+                std::unique_lock<mutex> lock(m_);
+                cv_.wait(lock, [this]() { return state_ != idle; });
+                if (state_ == cancelled) return;
+            }
+            try {
+                yield_type y(this);
+                body_(y);
+            } catch (detail::generator_cancelled&) {
+                // Consumer is gone
+            } catch (...) {
+                except_ = std::current_exception();
+            }
+            std::unique_lock<mutex> lock(m_);
+            value_ = boost::none;
+            if (state_ != cancelled) state_ = done;
+            cv_.notify_one();
+        }
+
+        template <typename V>
+        void yield(V&& v)
+        {
+            std::unique_lock<mutex> lock(m_);
+            if (state_ == cancelled) throw detail::generator_cancelled();
+            value_ = std::forward<V>(v);
+            state_ = ready;
+            cv_.notify_one();
+            cv_.wait(lock, [this]() { return state_ == requested || state_ == cancelled; });
+            if (state_ == cancelled) throw detail::generator_cancelled();
+        }
+
+        /// Called by the consumer, returns false if the sequence is ended
+        bool next()
+        {
+            std::unique_lock<mutex> lock(m_);
+            if (state_ == done) return false;
+            state_ = requested;
+            cv_.notify_one();
+            cv_.wait(lock, [this]() { return state_ == ready || state_ == done; });
+            if (state_ == ready) return true;
+            if (except_) {
+                std::exception_ptr e;
+                std::swap(e, except_);
+                std::rethrow_exception(e);
+            }
+            return false;
+        }
+
+        void cancel()
+        {
+            std::unique_lock<mutex> lock(m_);
+            if (state_ != done) {
+                state_ = cancelled;
+                cv_.notify_one();
+            }
+        }
+
+        body_type body_;
+        mutex m_;
+        condition_variable cv_;
+        state_type state_;
+        boost::optional<T> value_;
+        std::exception_ptr except_;
+    };
+
+    std::unique_ptr<impl> impl_;
+    fiber fiber_;
+};
+
+} // End of namespace fibers
+
+using fibers::generator;
+
+} // End of namespace fibio
+
+#endif
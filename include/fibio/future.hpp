@@ -14,5 +14,7 @@
 #include <fibio/fibers/future/packaged_task.hpp>
 #include <fibio/fibers/future/promise.hpp>
 #include <fibio/fibers/future/async.hpp>
+#include <fibio/fibers/future/oneshot.hpp>
+#include <fibio/fibers/future/pooled_allocator.hpp>
 
 #endif
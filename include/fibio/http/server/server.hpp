@@ -63,7 +63,11 @@ struct server
         timeout_type read_timeout_ = DEFAULT_TIMEOUT;
         timeout_type write_timeout_ = DEFAULT_TIMEOUT;
         unsigned max_keep_alive_ = DEFAULT_MAX_KEEP_ALIVE;
+        std::size_t get_buffer_size_ = stream::default_buffer_size();
+        std::size_t put_buffer_size_ = stream::default_buffer_size();
+        bool release_buffers_when_idle_ = false;
         ssl::context* ctx_ = nullptr;
+        ssl::handshake_offload* handshake_offload_ = nullptr;
     };
 
     server() = default;
@@ -92,6 +96,13 @@ struct server
         return *this;
     }
 
+    // TLS handshakes run on the crypto threads of `o`
+    server& handshake_offload(ssl::handshake_offload& o)
+    {
+        s_.handshake_offload_ = &o;
+        return *this;
+    }
+
     server& timeout(timeout_type t)
     {
         s_.read_timeout_ = s_.write_timeout_ = t;
@@ -104,6 +115,21 @@ struct server
         return *this;
     }
 
+    // Stream buffer sizes of connections
+    server& buffer_size(std::size_t get_size, std::size_t put_size)
+    {
+        s_.get_buffer_size_ = get_size;
+        s_.put_buffer_size_ = put_size;
+        return *this;
+    }
+
+    // Keep-alive connections hold no stream buffer while waiting for the next request
+    server& release_buffers_when_idle(bool r)
+    {
+        s_.release_buffers_when_idle_ = r;
+        return *this;
+    }
+
     server& handler(request_handler h)
     {
         s_.default_request_handler_ = h;
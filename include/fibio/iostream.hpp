@@ -10,6 +10,9 @@
 #define fibio_stream_hpp
 
 #include <fibio/stream/iostream.hpp>
+#include <fibio/stream/compressed.hpp>
 #include <fibio/stream/fstream.hpp>
+#include <fibio/stream/mapped_fstream.hpp>
+#include <fibio/stream/udp.hpp>
 
 #endif
@@ -0,0 +1,152 @@
+//
+//  admission.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_stream_admission_hpp
+#define fibio_stream_admission_hpp
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <boost/asio/ip/address.hpp>
+
+namespace fibio {
+namespace stream {
+
+/**
+ * Decides which connections a listener takes, and when
+ *
+ * With a connection limit, the accepting fiber stops accepting while the limit is reached and
+ * lets the kernel backlog push back on clients, or with `reject_excess` it keeps accepting and
+ * closes the excess right away so clients fail fast. The accept rate can be paced, and the number
+ * of connections from one source address can be limited, the counters are kept in a table split
+ * in shards with their own lock, holding only addresses with live connections.
+ * All limits are off by default, 0 means unlimited, without a connection limit or pacing the
+ * accepting fiber takes its slots without locking.
+ */
+class admission_control
+{
+    // Counters and limits, shared with the tickets of live connections
+    struct state;
+
+public:
+    typedef std::array<unsigned char, 16> source_key;
+
+    struct statistics
+    {
+        /// Connections taken by the listener
+        std::uint64_t admitted;
+        /// Connections closed because the connection limit was reached
+        std::uint64_t rejected;
+        /// Connections closed because their source had too many connections
+        std::uint64_t rejected_per_source;
+        /// Times the accepting fiber waited for a connection to finish
+        std::uint64_t paused;
+        /// Connections alive now
+        std::size_t active;
+    };
+
+    /**
+     * Holds a slot of an admitted connection until destroyed, an empty ticket means the
+     * connection was rejected. It shares the counters with the admission control, so it may
+     * outlive the listener.
+     */
+    class ticket
+    {
+    public:
+        ticket() = default;
+
+        ticket(ticket&& other) = default;
+
+        ticket& operator=(ticket&& other)
+        {
+            if (this != &other) {
+                reset();
+                owner_ = std::move(other.owner_);
+                source_ = other.source_;
+                has_source_ = other.has_source_;
+            }
+            return *this;
+        }
+
+        ~ticket() { reset(); }
+
+        explicit operator bool() const { return owner_ != nullptr; }
+
+        void reset();
+
+    private:
+        ticket(std::shared_ptr<state> owner, const source_key* source)
+        : owner_(std::move(owner)), has_source_(source != nullptr)
+        {
+            if (source) source_ = *source;
+        }
+
+        ticket(const ticket&) = delete;
+
+        void operator=(const ticket&) = delete;
+
+        std::shared_ptr<state> owner_;
+        source_key source_;
+        bool has_source_ = false;
+
+        friend class admission_control;
+    };
+
+    admission_control();
+
+    ~admission_control();
+
+    /// Limits concurrent connections, with `reject_excess` they are closed instead of waited for
+    void set_max_connections(std::size_t n, bool reject_excess = false);
+
+    /// Limits concurrent connections from one source address
+    void set_max_connections_per_source(std::size_t n);
+
+    /// Paces accepts to `per_second` on average, with bursts of up to `burst` connections
+    void set_accept_rate(std::size_t per_second, std::size_t burst = 1);
+
+    /**
+     * Called by the accepting fiber before each accept, waits while the connection limit is
+     * reached or the accept rate is exceeded, then reserves a slot for the next connection,
+     * returns false if `close` was called meanwhile
+     */
+    bool wait_for_slot();
+
+    /// Same as `wait_for_slot` but returns false instead of waiting
+    bool try_slot();
+
+    /// Gives back a reserved slot when nothing was accepted, the accept rate is not charged
+    void cancel_slot();
+
+    /// Takes the reserved slot for an accepted connection from `source`, null if it has no IP
+    ticket admit(const boost::asio::ip::address* source);
+
+    /// Wakes up and fails `wait_for_slot`, until `open` is called
+    void close();
+
+    void open();
+
+    std::size_t active() const;
+
+    statistics stats() const;
+
+private:
+    admission_control(const admission_control&) = delete;
+
+    void operator=(const admission_control&) = delete;
+
+    std::shared_ptr<state> state_;
+};
+
+} // End of namespace stream
+
+using stream::admission_control;
+
+} // End of namespace fibio
+
+#endif
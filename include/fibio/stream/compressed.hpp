@@ -0,0 +1,174 @@
+//
+//  compressed.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_stream_compressed_hpp
+#define fibio_stream_compressed_hpp
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <fibio/stream/streambuf.hpp>
+
+namespace fibio {
+namespace stream {
+
+/// Compression format of `compressed_streambuf`
+enum class compression
+{
+    /// zlib format (RFC 1950), needs zlib
+    deflate,
+    /// gzip format (RFC 1952), needs zlib
+    gzip,
+    /// zstd frames, needs libzstd
+    zstd,
+    /// LZ4 frames, needs liblz4
+    lz4,
+};
+
+namespace detail {
+
+/**
+ * Streaming compressor or decompressor, the context is created once and reset between messages
+ */
+struct codec
+{
+    enum result
+    {
+        /// Output buffer is full, call again with more space
+        more,
+        /// All input is consumed, or the requested flush is complete, or a message ended
+        done,
+        /// Corrupted input or codec failure
+        error,
+    };
+
+    enum flush_type
+    {
+        no_flush,
+        /// Everything given so far can be decoded by the peer
+        sync_flush,
+        /// End the message, the context is ready for the next one
+        finish,
+    };
+
+    virtual ~codec() {}
+
+    /// Compresses [in, in_end) to [out, out_end), both pointers are advanced
+    virtual result
+    compress(const char*& in, const char* in_end, char*& out, char* out_end, flush_type f)
+    {
+        return error;
+    }
+
+    /// Decompresses [in, in_end) to [out, out_end), returns `done` at the end of each message
+    virtual result decompress(const char*& in, const char* in_end, char*& out, char* out_end)
+    {
+        return error;
+    }
+};
+
+/// True if the library was built with support of `c`
+bool compression_supported(compression c);
+
+/// `level` is codec specific, -1 means the default level of the codec
+std::unique_ptr<codec> make_compressor(compression c, int level);
+
+std::unique_ptr<codec> make_decompressor(compression c);
+
+} // End of namespace detail
+
+/**
+ * Compresses what is written and decompresses what is read, on top of any stream buffer
+ *
+ * Data goes through the codec a whole buffer at a time, the codec contexts live as long as the
+ * stream buffer and are reset between messages, buffers come from the stream buffer pool.
+ * `finish` ends a message, `sync` flushes so the peer can decode all data written so far.
+ * Messages are concatenated transparently on the reading side.
+ */
+class compressed_streambuf : public std::streambuf
+{
+public:
+    /// Throws `boost::system::system_error` if `c` is not supported by this build
+    compressed_streambuf(std::streambuf* next,
+                         compression c,
+                         int level = -1,
+                         std::size_t buffer_size = 16 * 1024);
+
+    /// Finishes the current message if any
+    ~compressed_streambuf();
+
+    /// Ends the current message and flushes the underlying stream, returns false on failure
+    bool finish();
+
+    /// True if the input was corrupted or ended in the middle of a message
+    bool failed() const { return failed_; }
+
+protected:
+    int_type overflow(int_type c) override;
+
+    int sync() override;
+
+    int_type underflow() override;
+
+private:
+    compressed_streambuf(const compressed_streambuf&) = delete;
+
+    void operator=(const compressed_streambuf&) = delete;
+
+    bool compress_out(detail::codec::flush_type f);
+
+    std::streambuf* next_;
+    compression compression_;
+    int level_;
+    std::size_t buffer_size_;
+    std::unique_ptr<detail::codec> compressor_;
+    std::unique_ptr<detail::codec> decompressor_;
+    detail::pooled_buffer put_buffer_;
+    detail::pooled_buffer out_buffer_;
+    detail::pooled_buffer get_buffer_;
+    detail::pooled_buffer in_buffer_;
+    const char* in_pos_ = 0;
+    const char* in_end_ = 0;
+    // Data was written after the last `finish`
+    bool in_message_ = false;
+    // The decompressor is in the middle of a message
+    bool reading_message_ = false;
+    bool failed_ = false;
+};
+
+/**
+ * Stream compresses and decompresses through `compressed_streambuf`, on top of another stream
+ */
+class compressed_stream : public std::iostream
+{
+public:
+    compressed_stream(std::ios& s,
+                      compression c,
+                      int level = -1,
+                      std::size_t buffer_size = 16 * 1024)
+    : std::iostream(&sb_), sb_(s.rdbuf(), c, level, buffer_size)
+    {
+    }
+
+    /// Ends the current message, sets badbit on failure
+    compressed_stream& finish()
+    {
+        if (!sb_.finish()) setstate(std::ios_base::badbit);
+        return *this;
+    }
+
+    compressed_streambuf* rdbuf() const { return const_cast<compressed_streambuf*>(&sb_); }
+
+private:
+    compressed_streambuf sb_;
+};
+
+} // End of namespace stream
+} // End of namespace fibio
+
+#endif
@@ -20,7 +20,14 @@
 #include <ostream>
 #include <istream>
 #include <locale>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <memory>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 #include <fibio/fibers/future/async.hpp>
 
 namespace fibio {
@@ -29,6 +36,37 @@ namespace detail {
 
 std::shared_ptr<fibers::foreign_thread_pool> get_default_executor();
 
+/// True if the kernel supports io_uring with reads and writes at the current file position
+bool uring_available();
+
+/**
+ * Reads into `buf` at `offset`, or at the current file position if `offset` is -1, the calling
+ * fiber is parked until the request completes, requests from all fibers share one ring and any
+ * number of them, up to the ring size, can be in flight, including several on the same file
+ * `buf_index` is the slot returned by `uring_register_buffer` for memory holding `buf`, or -1
+ * @return number of bytes read, -errno on error, or -EBUSY if the ring is saturated
+ */
+std::ptrdiff_t
+uring_read(int fd, void* buf, std::size_t len, std::int64_t offset = -1, int buf_index = -1);
+
+/**
+ * Same as `uring_read` but returns right away, the future holds the result once the request
+ * completes and `buf` must stay alive until then
+ * @return an empty future if the ring is saturated or unavailable
+ */
+fibers::oneshot_future<std::ptrdiff_t>
+uring_read_async(int fd, void* buf, std::size_t len, std::int64_t offset = -1, int buf_index = -1);
+
+/// Same as `uring_read` but writes
+std::ptrdiff_t
+uring_write(int fd, const void* buf, std::size_t len, std::int64_t offset = -1, int buf_index = -1);
+
+/// Registers `len` bytes at `p` as a fixed buffer, returns the slot or -1 if none is available
+int uring_register_buffer(void* p, std::size_t len);
+
+/// Unregisters a slot returned by `uring_register_buffer`, no-op if `index` is -1
+void uring_unregister_buffer(int index);
+
 } // End of namespace detail
 
 template <class CharT, class Traits = std::char_traits<CharT>>
@@ -59,6 +97,20 @@ public:
 
     void set_executor(std::shared_ptr<fibers::foreign_thread_pool> e);
 
+    /**
+     * Use io_uring for files opened afterwards, on by default where the kernel supports it
+     * Reads and writes are then submitted from the calling fiber with the stream buffer
+     * registered as a fixed buffer, the executor is only used when the ring is saturated
+     */
+    void set_io_uring(bool enable);
+
+    /**
+     * Sequential readahead, the next block is read on the ring or on the executor while the
+     * current one is consumed, so a fiber scanning a file seldom waits for the disk. Costs two extra blocks of
+     * the buffer size, seeking or writing discards the prefetched data.
+     */
+    void set_readahead(bool enable);
+
 protected:
     // 27.9.1.5 Overridden virtual functions:
     virtual int_type underflow();
@@ -90,10 +142,31 @@ private:
     bool owns_eb_;
     bool owns_ib_;
     bool always_noconv_;
+    bool use_uring_;
+    bool uring_;
+    int fixed_index_;
+    bool readahead_;
+    std::unique_ptr<char[]> ra_buf_;
+    size_t ra_block_;
+    int ra_cur_;
+    size_t ra_pos_;
+    size_t ra_end_;
+    fibers::oneshot_future<std::ptrdiff_t> ra_future_;
     std::shared_ptr<fibers::foreign_thread_pool> executor_;
 
     bool read_mode();
     void write_mode();
+    size_t read_file(void* p, size_t n);
+    size_t read_block(void* p, size_t n);
+    void start_readahead();
+    off_type drop_readahead();
+    static std::ptrdiff_t prefetch(FILE* f, bool fd_io, char* p, size_t n);
+    size_t write_file(const void* p, size_t n);
+    int seek_file(off_type off, int whence);
+    off_type tell_file();
+    void attach_fixed_buffer();
+    void release_fixed_buffer();
+    int fixed_index(const void* p, size_t n) const;
 };
 
 template <class CharT, class Traits>
@@ -113,6 +186,14 @@ basic_filebuf<CharT, Traits>::basic_filebuf()
 , owns_eb_(false)
 , owns_ib_(false)
 , always_noconv_(false)
+, use_uring_(true)
+, uring_(false)
+, fixed_index_(-1)
+, readahead_(false)
+, ra_block_(0)
+, ra_cur_(0)
+, ra_pos_(0)
+, ra_end_(0)
 , executor_(detail::get_default_executor())
 {
     if (std::has_facet<std::codecvt<char_type, char, state_type>>(this->getloc())) {
@@ -147,6 +228,17 @@ basic_filebuf<CharT, Traits>::basic_filebuf(basic_filebuf&& rhs)
     owns_eb_ = rhs.owns_eb_;
     owns_ib_ = rhs.owns_ib_;
     always_noconv_ = rhs.always_noconv_;
+    use_uring_ = rhs.use_uring_;
+    uring_ = rhs.uring_;
+    fixed_index_ = rhs.fixed_index_;
+    // A pending prefetch keeps filling the same heap block
+    readahead_ = rhs.readahead_;
+    ra_buf_ = std::move(rhs.ra_buf_);
+    ra_block_ = rhs.ra_block_;
+    ra_cur_ = rhs.ra_cur_;
+    ra_pos_ = rhs.ra_pos_;
+    ra_end_ = rhs.ra_end_;
+    ra_future_ = std::move(rhs.ra_future_);
     if (rhs.pbase()) {
         if (rhs.pbase() == rhs.intbuf_)
             this->setp(intbuf_, intbuf_ + (rhs.epptr() - rhs.pbase()));
@@ -175,6 +267,10 @@ basic_filebuf<CharT, Traits>::basic_filebuf(basic_filebuf&& rhs)
     rhs.cm_ = std::ios_base::openmode(0);
     rhs.owns_eb_ = false;
     rhs.owns_ib_ = false;
+    rhs.uring_ = false;
+    rhs.fixed_index_ = -1;
+    rhs.ra_block_ = 0;
+    rhs.ra_pos_ = rhs.ra_end_ = 0;
     rhs.setg(0, 0, 0);
     rhs.setp(0, 0);
 }
@@ -235,6 +331,16 @@ void basic_filebuf<CharT, Traits>::swap(basic_filebuf& rhs)
     std::swap(owns_eb_, rhs.owns_eb_);
     std::swap(owns_ib_, rhs.owns_ib_);
     std::swap(always_noconv_, rhs.always_noconv_);
+    std::swap(use_uring_, rhs.use_uring_);
+    std::swap(uring_, rhs.uring_);
+    std::swap(fixed_index_, rhs.fixed_index_);
+    std::swap(readahead_, rhs.readahead_);
+    std::swap(ra_buf_, rhs.ra_buf_);
+    std::swap(ra_block_, rhs.ra_block_);
+    std::swap(ra_cur_, rhs.ra_cur_);
+    std::swap(ra_pos_, rhs.ra_pos_);
+    std::swap(ra_end_, rhs.ra_end_);
+    ra_future_.swap(rhs.ra_future_);
     if (this->eback() == (char_type*)rhs.extbuf_min_) {
         ptrdiff_t n = this->gptr() - this->eback();
         ptrdiff_t e = this->egptr() - this->eback();
@@ -332,8 +438,16 @@ basic_filebuf<CharT, Traits>* basic_filebuf<CharT, Traits>::open(const char* s,
             file_ = (*executor_)(fopen, s, mdstr);
             if (file_) {
                 om_ = mode;
+                uring_ = use_uring_ && detail::uring_available();
+                if (uring_) {
+                    // All I/O goes to the descriptor, stdio must not buffer anything
+                    setvbuf(file_, 0, _IONBF, 0);
+                    attach_fixed_buffer();
+                }
                 if (mode & std::ios_base::ate) {
-                    if ((*executor_)(fseek, file_, 0, SEEK_END)) {
+                    if (seek_file(0, SEEK_END)) {
+                        release_fixed_buffer();
+                        uring_ = false;
                         fclose(file_);
                         file_ = 0;
                         rt = 0;
@@ -361,6 +475,8 @@ basic_filebuf<CharT, Traits>* basic_filebuf<CharT, Traits>::close()
         rt = this;
         std::unique_ptr<FILE, int (*)(FILE*)> h(file_, fclose);
         if (sync()) rt = 0;
+        release_fixed_buffer();
+        uring_ = false;
         if (fclose(h.release()) == 0)
             file_ = 0;
         else
@@ -375,6 +491,19 @@ void basic_filebuf<CharT, Traits>::set_executor(std::shared_ptr<fibers::foreign_
     executor_ = e;
 }
 
+template <class CharT, class Traits>
+void basic_filebuf<CharT, Traits>::set_io_uring(bool enable)
+{
+    use_uring_ = enable;
+}
+
+template <class CharT, class Traits>
+void basic_filebuf<CharT, Traits>::set_readahead(bool enable)
+{
+    if (!enable && file_ && (cm_ & std::ios_base::in)) sync();
+    readahead_ = enable;
+}
+
 template <class CharT, class Traits>
 typename basic_filebuf<CharT, Traits>::int_type basic_filebuf<CharT, Traits>::underflow()
 {
@@ -388,7 +517,7 @@ typename basic_filebuf<CharT, Traits>::int_type basic_filebuf<CharT, Traits>::un
         memmove(this->eback(), this->egptr() - unget_sz, unget_sz * sizeof(char_type));
         if (always_noconv_) {
             size_t nmemb = static_cast<size_t>(this->egptr() - this->eback() - unget_sz);
-            nmemb = (*executor_)(fread, this->eback() + unget_sz, 1, nmemb, file_);
+            nmemb = read_block(this->eback() + unget_sz, nmemb);
             if (nmemb != 0) {
                 this->setg(this->eback(), this->eback() + unget_sz,
                            this->eback() + unget_sz + nmemb);
@@ -402,7 +531,7 @@ typename basic_filebuf<CharT, Traits>::int_type basic_filebuf<CharT, Traits>::un
                                     static_cast<size_t>(extbufend_ - extbufnext_));
             std::codecvt_base::result r;
             st_last_ = st_;
-            size_t nr = (*executor_)(fread, (void*)extbufnext_, 1, nmemb, file_);
+            size_t nr = read_block((void*)extbufnext_, nmemb);
             if (nr != 0) {
                 if (!cv_) throw std::bad_cast();
                 extbufend_ = extbufnext_ + nr;
@@ -458,7 +587,7 @@ typename basic_filebuf<CharT, Traits>::int_type basic_filebuf<CharT, Traits>::ov
     if (this->pptr() != this->pbase()) {
         if (always_noconv_) {
             size_t nmemb = static_cast<size_t>(this->pptr() - this->pbase());
-            if ((*executor_)(fwrite, this->pbase(), sizeof(char_type), nmemb, file_) != nmemb)
+            if (write_file(this->pbase(), nmemb * sizeof(char_type)) != nmemb * sizeof(char_type))
                 return traits_type::eof();
         } else {
             char* extbe = extbuf_;
@@ -470,11 +599,11 @@ typename basic_filebuf<CharT, Traits>::int_type basic_filebuf<CharT, Traits>::ov
                 if (e == this->pbase()) return traits_type::eof();
                 if (r == std::codecvt_base::noconv) {
                     size_t nmemb = static_cast<size_t>(this->pptr() - this->pbase());
-                    if ((*executor_)(fwrite, this->pbase(), 1, nmemb, file_) != nmemb)
+                    if (write_file(this->pbase(), nmemb) != nmemb)
                         return traits_type::eof();
                 } else if (r == std::codecvt_base::ok || r == std::codecvt_base::partial) {
                     size_t nmemb = static_cast<size_t>(extbe - extbuf_);
-                    if ((*executor_)(fwrite, extbuf_, 1, nmemb, file_) != nmemb)
+                    if (write_file(extbuf_, nmemb) != nmemb)
                         return traits_type::eof();
                     if (r == std::codecvt_base::partial) {
                         this->setp((char_type*)e, this->pptr());
@@ -493,8 +622,11 @@ template <class CharT, class Traits>
 std::basic_streambuf<CharT, Traits>* basic_filebuf<CharT, Traits>::setbuf(char_type* s,
                                                                           std::streamsize n)
 {
+    // Prefetched data goes away with the get area, the file position is put back before it
+    sync();
     this->setg(0, 0, 0);
     this->setp(0, 0);
+    release_fixed_buffer();
     if (owns_eb_) delete[] extbuf_;
     if (owns_ib_) delete[] intbuf_;
     ebs_ = n;
@@ -525,6 +657,7 @@ std::basic_streambuf<CharT, Traits>* basic_filebuf<CharT, Traits>::setbuf(char_t
         intbuf_ = 0;
         owns_ib_ = false;
     }
+    attach_fixed_buffer();
     return this;
 }
 
@@ -550,15 +683,8 @@ typename basic_filebuf<CharT, Traits>::pos_type basic_filebuf<CharT, Traits>::se
     default:
         return pos_type(off_type(-1));
     }
-#if defined(_WIN32) || defined(_NEWLIB_VERSION)
-    if ((*executor_)(fseek, file_, width > 0 ? width * off : 0, whence))
-        return pos_type(off_type(-1));
-    pos_type r = ftell(file_);
-#else
-    if ((*executor_)(fseeko, file_, width > 0 ? width * off : 0, whence))
-        return pos_type(off_type(-1));
-    pos_type r = ftello(file_);
-#endif
+    if (seek_file(width > 0 ? width * off : 0, whence)) return pos_type(off_type(-1));
+    pos_type r = tell_file();
     r.state(st_);
     return r;
 }
@@ -568,11 +694,7 @@ typename basic_filebuf<CharT, Traits>::pos_type
 basic_filebuf<CharT, Traits>::seekpos(pos_type sp, std::ios_base::openmode)
 {
     if (file_ == 0 || sync()) return pos_type(off_type(-1));
-#if defined(_WIN32) || defined(_NEWLIB_VERSION)
-    if ((*executor_)(fseek, file_, sp, SEEK_SET)) return pos_type(off_type(-1));
-#else
-    if ((*executor_)(fseeko, file_, sp, SEEK_SET)) return pos_type(off_type(-1));
-#endif
+    if (seek_file(sp, SEEK_SET)) return pos_type(off_type(-1));
     st_ = sp.state();
     return sp;
 }
@@ -590,7 +712,7 @@ int basic_filebuf<CharT, Traits>::sync()
             char* extbe;
             r = cv_->unshift(st_, extbuf_, extbuf_ + ebs_, extbe);
             size_t nmemb = static_cast<size_t>(extbe - extbuf_);
-            if ((*executor_)(fwrite, extbuf_, 1, nmemb, file_) != nmemb) return -1;
+            if (write_file(extbuf_, nmemb) != nmemb) return -1;
         } while (r == std::codecvt_base::partial);
         if (r == std::codecvt_base::error) return -1;
         if (fflush(file_)) return -1;
@@ -614,11 +736,9 @@ int basic_filebuf<CharT, Traits>::sync()
                 }
             }
         }
-#if defined(_WIN32) || defined(_NEWLIB_VERSION)
-        if ((*executor_)(fseek, file_, -c, SEEK_CUR)) return -1;
-#else
-        if ((*executor_)(fseeko, file_, -c, SEEK_CUR)) return -1;
-#endif
+        // The file position is past the prefetched blocks as well
+        c += drop_readahead();
+        if (seek_file(-c, SEEK_CUR)) return -1;
         if (update_st) st_ = state;
         extbufnext_ = extbufend_ = extbuf_;
         this->setg(0, 0, 0);
@@ -637,6 +757,7 @@ void basic_filebuf<CharT, Traits>::imbue(const std::locale& loc)
     if (old_anc != always_noconv_) {
         this->setg(0, 0, 0);
         this->setp(0, 0);
+        release_fixed_buffer();
         // invariant, char_type is char, else we couldn't get here
         if (always_noconv_) // need to dump intbuf_
         {
@@ -661,7 +782,163 @@ void basic_filebuf<CharT, Traits>::imbue(const std::locale& loc)
                 owns_ib_ = true;
             }
         }
+        attach_fixed_buffer();
+    }
+}
+
+template <class CharT, class Traits>
+size_t basic_filebuf<CharT, Traits>::read_file(void* p, size_t n)
+{
+    if (!uring_) return (*executor_)(fread, p, 1, n, file_);
+#if !defined(_WIN32)
+    // Short only at end of file or on error, same as fread
+    int fd = fileno(file_);
+    size_t ret = 0;
+    while (ret < n) {
+        char* b = static_cast<char*>(p) + ret;
+        std::ptrdiff_t r = detail::uring_read(fd, b, n - ret, -1, fixed_index(b, n - ret));
+        // The ring is saturated or broken
+        if (r == -EBUSY || r == -ENOSYS) r = (*executor_)(::read, fd, (void*)b, n - ret);
+        if (r == -EINTR || r == -EAGAIN) continue;
+        if (r <= 0) break;
+        ret += size_t(r);
+    }
+    return ret;
+#else
+    return 0;
+#endif
+}
+
+template <class CharT, class Traits>
+size_t basic_filebuf<CharT, Traits>::read_block(void* p, size_t n)
+{
+    if (!readahead_) return read_file(p, n);
+    if (ra_pos_ == ra_end_) {
+        // Block `ra_cur_ ^ 1` is being filled, or nothing is in flight after a seek or at start
+        if (!ra_future_.valid()) start_readahead();
+        // A failed read ends the readahead like the end of file
+        ra_end_ = size_t(std::max<std::ptrdiff_t>(ra_future_.get(), 0));
+        ra_pos_ = 0;
+        ra_cur_ ^= 1;
+        if (ra_end_ == 0) return 0;
+        start_readahead();
+    }
+    size_t ret = std::min(n, ra_end_ - ra_pos_);
+    memcpy(p, ra_buf_.get() + ra_cur_ * ra_block_ + ra_pos_, ret);
+    ra_pos_ += ret;
+    return ret;
+}
+
+template <class CharT, class Traits>
+void basic_filebuf<CharT, Traits>::start_readahead()
+{
+    size_t block = std::max<size_t>(ebs_, 4096);
+    if (!ra_buf_ || ra_block_ != block) {
+        ra_buf_.reset(new char[2 * block]);
+        ra_block_ = block;
+    }
+    char* b = ra_buf_.get() + (ra_cur_ ^ 1) * ra_block_;
+#if !defined(_WIN32)
+    // In flight on the ring, no executor thread waits for the disk meanwhile
+    if (uring_) ra_future_ = detail::uring_read_async(fileno(file_), b, ra_block_);
+    if (ra_future_.valid()) return;
+#endif
+    ra_future_ = executor_->async_call_oneshot(
+        &basic_filebuf::prefetch, file_, uring_, b, ra_block_);
+}
+
+template <class CharT, class Traits>
+typename basic_filebuf<CharT, Traits>::off_type basic_filebuf<CharT, Traits>::drop_readahead()
+{
+    off_type ret = off_type(ra_end_ - ra_pos_);
+    if (ra_future_.valid()) ret += off_type(std::max<std::ptrdiff_t>(ra_future_.get(), 0));
+    ra_pos_ = ra_end_ = 0;
+    return ret;
+}
+
+template <class CharT, class Traits>
+std::ptrdiff_t basic_filebuf<CharT, Traits>::prefetch(FILE* f, bool fd_io, char* p, size_t n)
+{
+    if (!fd_io) return std::ptrdiff_t(fread(p, 1, n, f));
+#if !defined(_WIN32)
+    // Runs on the executor, a plain read on the descriptor keeps the position consistent
+    size_t ret = 0;
+    while (ret < n) {
+        ssize_t r = ::read(fileno(f), p + ret, n - ret);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        ret += size_t(r);
+    }
+    return std::ptrdiff_t(ret);
+#else
+    return 0;
+#endif
+}
+
+template <class CharT, class Traits>
+size_t basic_filebuf<CharT, Traits>::write_file(const void* p, size_t n)
+{
+    if (!uring_) return (*executor_)(fwrite, p, 1, n, file_);
+#if !defined(_WIN32)
+    int fd = fileno(file_);
+    size_t ret = 0;
+    while (ret < n) {
+        const char* b = static_cast<const char*>(p) + ret;
+        std::ptrdiff_t r = detail::uring_write(fd, b, n - ret, -1, fixed_index(b, n - ret));
+        if (r == -EBUSY || r == -ENOSYS) r = (*executor_)(::write, fd, (const void*)b, n - ret);
+        if (r == -EINTR || r == -EAGAIN) continue;
+        if (r <= 0) break;
+        ret += size_t(r);
     }
+    return ret;
+#else
+    return 0;
+#endif
+}
+
+template <class CharT, class Traits>
+int basic_filebuf<CharT, Traits>::seek_file(off_type off, int whence)
+{
+#if defined(_WIN32) || defined(_NEWLIB_VERSION)
+    return (*executor_)(fseek, file_, off, whence) ? -1 : 0;
+#else
+    // The descriptor position is the file position, lseek doesn't touch the disk
+    if (uring_) return ::lseek(fileno(file_), off, whence) < 0 ? -1 : 0;
+    return (*executor_)(fseeko, file_, off, whence) ? -1 : 0;
+#endif
+}
+
+template <class CharT, class Traits>
+typename basic_filebuf<CharT, Traits>::off_type basic_filebuf<CharT, Traits>::tell_file()
+{
+#if defined(_WIN32) || defined(_NEWLIB_VERSION)
+    return ftell(file_);
+#else
+    if (uring_) return ::lseek(fileno(file_), 0, SEEK_CUR);
+    return ftello(file_);
+#endif
+}
+
+template <class CharT, class Traits>
+void basic_filebuf<CharT, Traits>::attach_fixed_buffer()
+{
+    release_fixed_buffer();
+    if (uring_ && extbuf_ != extbuf_min_)
+        fixed_index_ = detail::uring_register_buffer(extbuf_, ebs_);
+}
+
+template <class CharT, class Traits>
+void basic_filebuf<CharT, Traits>::release_fixed_buffer()
+{
+    detail::uring_unregister_buffer(fixed_index_);
+    fixed_index_ = -1;
+}
+
+template <class CharT, class Traits>
+int basic_filebuf<CharT, Traits>::fixed_index(const void* p, size_t n) const
+{
+    const char* b = static_cast<const char*>(p);
+    return (fixed_index_ >= 0 && b >= extbuf_ && b + n <= extbuf_ + ebs_) ? fixed_index_ : -1;
 }
 
 template <class CharT, class Traits>
@@ -683,6 +960,8 @@ template <class CharT, class Traits>
 void basic_filebuf<CharT, Traits>::write_mode()
 {
     if (!(cm_ & std::ios_base::out)) {
+        // Put the file position back before the prefetched blocks
+        if ((cm_ & std::ios_base::in) && (ra_future_.valid() || ra_pos_ != ra_end_)) sync();
         this->setg(0, 0, 0);
         if (ebs_ > sizeof(extbuf_min_)) {
             if (always_noconv_)
@@ -723,6 +1002,10 @@ public:
 
     void set_executor(std::shared_ptr<fibers::foreign_thread_pool> e) { sb_.set_executor(e); }
 
+    void set_io_uring(bool enable) { sb_.set_io_uring(enable); }
+
+    void set_readahead(bool enable) { sb_.set_readahead(enable); }
+
 private:
     basic_filebuf<char_type, traits_type> sb_;
 };
@@ -841,6 +1124,10 @@ public:
 
     void set_executor(std::shared_ptr<fibers::foreign_thread_pool> e) { sb_.set_executor(e); }
 
+    void set_io_uring(bool enable) { sb_.set_io_uring(enable); }
+
+    void set_readahead(bool enable) { sb_.set_readahead(enable); }
+
 private:
     basic_filebuf<char_type, traits_type> sb_;
 };
@@ -961,6 +1248,10 @@ public:
 
     void set_executor(std::shared_ptr<fibers::foreign_thread_pool> e) { sb_.set_executor(e); }
 
+    void set_io_uring(bool enable) { sb_.set_io_uring(enable); }
+
+    void set_readahead(bool enable) { sb_.set_readahead(enable); }
+
 private:
     basic_filebuf<char_type, traits_type> sb_;
 };
@@ -9,7 +9,11 @@
 #ifndef fibio_stream_iostream_hpp
 #define fibio_stream_iostream_hpp
 
+#include <atomic>
+#include <cstdint>
 #include <map>
+#include <vector>
+#include <boost/version.hpp>
 #include <boost/asio/ip/basic_resolver.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/posix/stream_descriptor.hpp>
@@ -18,6 +22,7 @@
 #include <boost/lexical_cast.hpp>
 #include <fibio/fiber.hpp>
 #include <fibio/future.hpp>
+#include <fibio/stream/admission.hpp>
 #include <fibio/stream/streambuf.hpp>
 
 namespace fibio {
@@ -100,6 +105,45 @@ make_endpoint<boost::asio::local::stream_protocol::endpoint>(const std::string&
 
 #endif
 
+#if defined(SO_REUSEPORT)
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+// Source address of an accepted connection, for per-source admission limits
+template <typename Endpoint>
+admission_control::ticket admit_from(admission_control& ac, const Endpoint&)
+{
+    return ac.admit(nullptr);
+}
+
+inline admission_control::ticket admit_from(admission_control& ac,
+                                            const boost::asio::ip::tcp::endpoint& ep)
+{
+    boost::asio::ip::address a = ep.address();
+    return ac.admit(&a);
+}
+
+/**
+ * Opens, binds and listens like the constructor of `Acceptor`, with `reuse_port` several sockets
+ * can listen on the same endpoint and the kernel spreads incoming connections among them
+ */
+template <typename Acceptor, typename Endpoint>
+void open_acceptor(Acceptor& acc, const Endpoint& ep, bool reuse_port)
+{
+    acc.open(ep.protocol());
+    acc.set_option(typename Acceptor::reuse_address(true));
+    if (reuse_port) {
+#if defined(SO_REUSEPORT)
+        acc.set_option(detail::reuse_port(true));
+#else
+        BOOST_THROW_EXCEPTION(boost::system::system_error(boost::system::errc::make_error_code(
+            boost::system::errc::operation_not_supported)));
+#endif
+    }
+    acc.bind(ep);
+    acc.listen();
+}
+
 } // End of namespace detail
 
 // Closable stream
@@ -112,6 +156,16 @@ public:
     virtual bool is_open() const = 0;
 
     virtual void close() = 0;
+
+    /**
+     * Same as `write`, but buffered data and `s` are sent with one gathered write without copying
+     * `s` into the stream buffer
+     */
+    virtual closable_stream& write_direct(const char* s, std::streamsize n)
+    {
+        write(s, n);
+        return *this;
+    }
 };
 
 template <typename Stream>
@@ -189,6 +243,51 @@ public:
 
     inline bool is_open() const { return rdbuf()->lowest_layer().is_open(); }
 
+    /**
+     * Write buffered data and `buffers` with one gathered write, `buffers` are not copied
+     * Sets badbit on failure
+     */
+    template <typename ConstBufferSequence>
+    iostream& write_buffers(const ConstBufferSequence& buffers)
+    {
+        boost::system::error_code ec;
+        rdbuf()->write_buffers(buffers, ec);
+        if (ec) setstate(std::ios_base::badbit);
+        return *this;
+    }
+
+    /**
+     * Fill `buffers`, data not in the stream buffer is read directly into `buffers`
+     * Sets eofbit and failbit if the stream ends before `buffers` are filled
+     */
+    template <typename MutableBufferSequence>
+    std::size_t read_into(const MutableBufferSequence& buffers)
+    {
+        boost::system::error_code ec;
+        std::size_t ret = rdbuf()->read_into(buffers, ec);
+        if (ec) setstate(std::ios_base::eofbit | std::ios_base::failbit);
+        return ret;
+    }
+
+    /**
+     * Read data up to and including `delim` into `out`
+     * Sets eofbit if the stream ends before `delim`, and failbit if nothing was read
+     */
+    iostream& read_until(std::string& out, const std::string& delim)
+    {
+        if (!rdbuf()->read_until(out, delim)) {
+            setstate(out.empty() ? std::ios_base::eofbit | std::ios_base::failbit
+                                 : std::ios_base::eofbit);
+        }
+        return *this;
+    }
+
+    closable_stream& write_direct(const char* s, std::streamsize n) override
+    {
+        write_buffers(boost::asio::buffer(s, n));
+        return *this;
+    }
+
     inline streambuf_t* rdbuf() const { return this->sbuf_.get(); }
 
     inline stream_type& stream_descriptor() { return *rdbuf(); }
@@ -196,8 +295,57 @@ public:
     void set_duplex_mode(duplex_mode dm) { rdbuf()->set_duplex_mode(dm); }
 
     duplex_mode get_duplex_mode() const { return rdbuf()->get_duplex_mode(); }
+
+    void set_buffer_size(std::size_t get_size, std::size_t put_size)
+    {
+        rdbuf()->set_buffer_size(get_size, put_size);
+    }
+
+    void set_release_when_idle(bool r) { rdbuf()->set_release_when_idle(r); }
+
+    void set_coalesce(bool c) { rdbuf()->set_coalesce(c); }
+
+    bool get_coalesce() const { return rdbuf()->get_coalesce(); }
+
+    /// Socket streams only
+    boost::system::error_code set_no_delay(bool nd) { return rdbuf()->set_no_delay(nd); }
+
+    /// Socket streams only
+    boost::system::error_code set_cork(bool c) { return rdbuf()->set_cork(c); }
+
+    /**
+     * Send `len` bytes of file `fd` from `offset` without copying them to user space
+     * Socket streams only, sets badbit on failure
+     */
+    std::size_t send_file(int fd, std::uint64_t offset, std::size_t len)
+    {
+        boost::system::error_code ec;
+        std::size_t ret = rdbuf()->send_file(fd, offset, len, ec);
+        if (ec) setstate(std::ios_base::badbit);
+        return ret;
+    }
+
+    /// Socket streams only
+    std::size_t send_file(int fd,
+                          std::uint64_t offset,
+                          std::size_t len,
+                          boost::system::error_code& ec)
+    {
+        return rdbuf()->send_file(fd, offset, len, ec);
+    }
 };
 
+/**
+ * Moves everything read from `from` to `to` until `from` ends, in the kernel where possible
+ * Both must be socket streams, parks the calling fiber while either side is not ready
+ * @return number of bytes moved
+ */
+template <typename StreamA, typename StreamB>
+std::size_t splice(iostream<StreamA>& from, iostream<StreamB>& to, boost::system::error_code& ec)
+{
+    return from.rdbuf()->splice_to(*to.rdbuf(), ec);
+}
+
 template <typename Stream>
 iostream<Stream>& operator<<(iostream<Stream>& is, duplex_mode dm)
 {
@@ -236,6 +384,12 @@ struct stream_acceptor
     {
     }
 
+    /// With `reuse_port`, other acceptors can listen on `ep` too, see `listener::set_acceptors`
+    stream_acceptor(const endpoint_type& ep, bool reuse_port) : acc_(asio::get_io_service())
+    {
+        detail::open_acceptor(acc_, ep, reuse_port);
+    }
+
     stream_acceptor(stream_acceptor&& other) : acc_(std::move(other.acc_)) {}
 
     stream_acceptor(const stream_acceptor& other) = delete;
@@ -271,6 +425,25 @@ struct stream_acceptor
         acc_.async_accept(*(s.rdbuf()), asio::yield[ec]);
     }
 
+    /// Accepts a connection already in the backlog, sets `would_block` instead of waiting
+    void try_accept(stream_type& s, boost::system::error_code& ec)
+    {
+        if (!acc_.non_blocking()) acc_.non_blocking(true, ec);
+        if (!ec) acc_.accept(*(s.rdbuf()), ec);
+    }
+
+    /// Waits for a connection in the backlog, returns right away with ASIO older than 1.66
+    void wait_ready(boost::system::error_code& ec)
+    {
+#if BOOST_VERSION >= 106600
+        acc_.async_wait(acceptor_type::wait_read, asio::yield[ec]);
+#else
+        ec.clear();
+#endif
+    }
+
+    endpoint_type local_endpoint() const { return acc_.local_endpoint(); }
+
     stream_type operator()() { return accept(); }
 
     stream_type operator()(boost::system::error_code& ec) { return accept(ec); }
@@ -296,6 +469,9 @@ struct stream_traits
     {
         return std::unique_ptr<stream_type>(new stream_type());
     }
+
+    // Completes a connection taken by `try_accept`, in the connection fiber
+    static void finish_accept(stream_type&, boost::system::error_code& ec) { ec.clear(); }
 };
 
 template <typename Stream>
@@ -307,6 +483,14 @@ struct listener
     typedef typename traits_type::endpoint_type endpoint_type;
     typedef typename traits_type::arg_type arg_type;
 
+    struct acceptor_statistics
+    {
+        /// Connections taken by the acceptor
+        std::uint64_t accepted;
+        /// Connections of them taken by `try_accept` while draining the backlog
+        std::uint64_t batched;
+    };
+
     template <typename std::enable_if<std::is_move_constructible<Stream>::value>::type* = nullptr>
     listener(const std::string& access_point)
     : ep_(detail::make_endpoint<endpoint_type>(access_point))
@@ -322,6 +506,42 @@ struct listener
 
     endpoint_type endpoint() const { return ep_; }
 
+    // Buffer sizes of accepted streams
+    void set_buffer_size(std::size_t get_size, std::size_t put_size)
+    {
+        get_buffer_size_ = get_size;
+        put_buffer_size_ = put_size;
+    }
+
+    // Accepted streams release their buffers while waiting for requests
+    void set_release_when_idle(bool r) { release_when_idle_ = r; }
+
+    /**
+     * Listens with `n` SO_REUSEPORT sockets on the same endpoint, each one has its own accepting
+     * fiber and the kernel spreads incoming connections among them. With `stick_with_acceptor`,
+     * connection fibers share the strand of the fiber accepted them, so each acceptor and its
+     * connections form a shard that never runs concurrently with itself. TCP only.
+     */
+    void set_acceptors(std::size_t n, bool stick_with_acceptor = true)
+    {
+        acceptors_ = n ? n : 1;
+        stick_with_acceptor_ = stick_with_acceptor;
+    }
+
+    // Connections taken from the backlog without waiting, after each one the acceptor waited for
+    void set_accept_batch(std::size_t n) { accept_batch_ = n ? n : 1; }
+
+    // Connection limits, accept pacing and their counters
+    admission_control& admission() { return admission_; }
+
+    // Counters of each acceptor since the last start
+    std::vector<acceptor_statistics> acceptor_stats() const
+    {
+        std::vector<acceptor_statistics> ret;
+        for (const acceptor_counters& c : counters_) ret.push_back({c.accepted, c.batched});
+        return ret;
+    }
+
     // Start and join, other fiber may stop the listener
     template <typename F>
     boost::system::error_code operator()(F f)
@@ -335,15 +555,18 @@ struct listener
         return boost::system::error_code();
     }
 
-    // Start listener
+    // Start listener, throws `boost::system::system_error` if the endpoint cannot be bound
     template <typename F>
     void start(F f)
     {
         if (!stop_signal_) {
+            // Connections made once `start` returns wait in the backlog
+            open_acceptors();
             stop_signal_.reset(new promise<void>);
+            admission_.open();
             if (!acceptor_fiber_) {
                 acceptor_fiber_.reset(
-                    new fiber(&listener::acceptor_fiber<F>, this, ep_, stop_signal_.get(), f));
+                    new fiber(&listener::acceptor_fiber<F>, this, stop_signal_.get(), f));
             }
         }
     }
@@ -365,33 +588,148 @@ struct listener
     }
 
 private:
+    struct acceptor_counters
+    {
+        std::atomic<std::uint64_t> accepted{0};
+        std::atomic<std::uint64_t> batched{0};
+    };
+
+    void open_acceptors()
+    {
+        accs_.clear();
+        if (acceptors_ == 1) {
+            accs_.emplace_back(new acceptor_type(ep_));
+        } else {
+            // Open all sockets up front so they share the port even if `ep_` asks for any port
+            accs_.emplace_back(new acceptor_type(ep_, true));
+            endpoint_type bound = accs_.front()->local_endpoint();
+            while (accs_.size() < acceptors_) accs_.emplace_back(new acceptor_type(bound, true));
+        }
+        std::vector<acceptor_counters>(accs_.size()).swap(counters_);
+    }
+
+    template <typename F>
+    void acceptor_fiber(promise<void>* p, F f)
+    {
+        shared_future<void> stop = p->get_future().share();
+        if (accs_.size() == 1) {
+            accept_loop(*accs_.front(), counters_.front(), stop, f);
+        } else {
+            std::vector<fiber> fibers;
+            for (std::size_t i = 0; i < accs_.size(); i++) {
+                fibers.emplace_back(&listener::accept_loop<F>,
+                                    this,
+                                    std::ref(*accs_[i]),
+                                    std::ref(counters_[i]),
+                                    std::cref(stop),
+                                    std::ref(f));
+            }
+            for (fiber& fb : fibers) fb.join();
+        }
+        accs_.clear();
+    }
+
     template <typename F>
-    void acceptor_fiber(const endpoint_type& e, promise<void>* p, F f)
+    void accept_loop(acceptor_type& acc,
+                     acceptor_counters& counters,
+                     const shared_future<void>& stop,
+                     F& f)
     {
-        acceptor_type acc(e);
         boost::system::error_code ec;
+        // Closes the acceptor on its own strand when stopped
         fiber watchdog(fiber::attributes(fiber::attributes::stick_with_parent),
                        &listener::acceptor_watchdog_fiber,
                        this,
-                       p,
+                       stop,
                        std::ref(acc));
-        while (!ec) {
-            std::unique_ptr<stream_type> s(traits_type::construct(arg_));
+        for (;;) {
+            // A slot is reserved once a connection is pending, an idle acceptor never holds one
+            // another acceptor could use for its backlog
+            acc.wait_ready(ec);
+            if (ec || !admission_.wait_for_slot()) break;
+            std::unique_ptr<stream_type> s(new_stream());
             acc(*s, ec);
-            if (ec) break;
-            fiber([f](std::unique_ptr<stream_type> str) { f(*str); }, std::move(s)).detach();
+            if (ec) {
+                admission_.cancel_slot();
+                break;
+            }
+            counters.accepted++;
+            start_connection(f, std::move(s));
+            // Drain the backlog without waiting on the reactor for each connection while a slot
+            // is free right away, errors other than an empty backlog are reported again by the
+            // next accept
+            for (std::size_t i = 1; i < accept_batch_ && admission_.try_slot(); i++) {
+                boost::system::error_code try_ec;
+                s = new_stream();
+                acc.try_accept(*s, try_ec);
+                if (try_ec) {
+                    admission_.cancel_slot();
+                    break;
+                }
+                counters.accepted++;
+                counters.batched++;
+                start_connection(f, std::move(s), true);
+            }
         }
         watchdog.join();
     }
 
-    void acceptor_watchdog_fiber(promise<void>* p, acceptor_type& acc)
+    std::unique_ptr<stream_type> new_stream()
+    {
+        std::unique_ptr<stream_type> s(traits_type::construct(arg_));
+        s->set_buffer_size(get_buffer_size_, put_buffer_size_);
+        s->set_release_when_idle(release_when_idle_);
+        return s;
+    }
+
+    // With `finish`, the connection came from `try_accept` and is completed in its own fiber
+    template <typename F>
+    void start_connection(F& f, std::unique_ptr<stream_type> s, bool finish = false)
+    {
+        boost::system::error_code ec;
+        admission_control::ticket t(
+            detail::admit_from(admission_, s->rdbuf()->lowest_layer().remote_endpoint(ec)));
+        if (!t) {
+            // Rejected early, the client sees the connection closed instead of a slow server
+            s->close();
+            return;
+        }
+        // The ticket gives the slot back when the connection fiber ends
+        auto fn = [f, finish](std::unique_ptr<stream_type> str, admission_control::ticket) {
+            if (finish) {
+                boost::system::error_code ec;
+                traits_type::finish_accept(*str, ec);
+                if (ec) return;
+            }
+            f(*str);
+        };
+        if (acceptors_ > 1 && stick_with_acceptor_)
+            fiber(fiber::attributes(fiber::attributes::stick_with_parent),
+                  fn,
+                  std::move(s),
+                  std::move(t)).detach();
+        else
+            fiber(fn, std::move(s), std::move(t)).detach();
+    }
+
+    void acceptor_watchdog_fiber(shared_future<void> stop, acceptor_type& acc)
     {
-        p->get_future().wait();
+        stop.wait();
+        admission_.close();
         acc.close();
     }
 
     arg_type* arg_ = nullptr;
     endpoint_type ep_;
+    std::size_t get_buffer_size_ = default_buffer_size();
+    std::size_t put_buffer_size_ = default_buffer_size();
+    bool release_when_idle_ = false;
+    std::size_t acceptors_ = 1;
+    bool stick_with_acceptor_ = true;
+    std::size_t accept_batch_ = 16;
+    admission_control admission_;
+    std::vector<std::unique_ptr<acceptor_type>> accs_;
+    std::vector<acceptor_counters> counters_;
     std::unique_ptr<fiber> acceptor_fiber_;
     std::unique_ptr<promise<void>> stop_signal_;
 };
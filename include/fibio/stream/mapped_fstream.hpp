@@ -0,0 +1,141 @@
+//
+//  mapped_fstream.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_stream_mapped_fstream_hpp
+#define fibio_stream_mapped_fstream_hpp
+
+#include <cstddef>
+#include <istream>
+#include <streambuf>
+#include <string>
+
+namespace fibio {
+namespace stream {
+
+/// Access pattern of a mapped file, passed to madvise(2)
+enum class map_advice
+{
+    normal,
+    sequential,
+    random,
+    willneed,
+};
+
+/**
+ * Read-only stream buffer over a memory-mapped file
+ *
+ * The whole file is the get area, reading never copies through an intermediate buffer or hops
+ * to the executor, and `data()` gives direct access to the content. Mapping and unmapping run on
+ * the executor, a page fault still blocks the thread, `willneed` asks the kernel to read the
+ * whole file ahead and suits small hot files, `sequential` enables aggressive readahead.
+ */
+class mapped_filebuf : public std::streambuf
+{
+public:
+    mapped_filebuf();
+
+    mapped_filebuf(mapped_filebuf&& other);
+
+    ~mapped_filebuf();
+
+    bool is_open() const { return fd_ >= 0; }
+
+    mapped_filebuf* open(const char* s, map_advice advice = map_advice::sequential);
+
+    mapped_filebuf* open(const std::string& s, map_advice advice = map_advice::sequential)
+    {
+        return open(s.c_str(), advice);
+    }
+
+    mapped_filebuf* close();
+
+    /// Content of the file, valid until closed
+    const char* data() const { return data_; }
+
+    std::size_t size() const { return size_; }
+
+protected:
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which = std::ios_base::in) override;
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in) override;
+
+    std::streamsize showmanyc() override { return gptr() < egptr() ? egptr() - gptr() : -1; }
+
+private:
+    mapped_filebuf(const mapped_filebuf&) = delete;
+
+    void operator=(const mapped_filebuf&) = delete;
+
+    int fd_;
+    char* data_;
+    std::size_t size_;
+};
+
+/**
+ * Input file stream reads from a memory-mapped file, see `mapped_filebuf`
+ */
+class mapped_ifstream : public std::istream
+{
+public:
+    mapped_ifstream() : std::istream(&sb_) {}
+
+    explicit mapped_ifstream(const char* s, map_advice advice = map_advice::sequential)
+    : std::istream(&sb_)
+    {
+        if (!sb_.open(s, advice)) setstate(std::ios_base::failbit);
+    }
+
+    explicit mapped_ifstream(const std::string& s, map_advice advice = map_advice::sequential)
+    : mapped_ifstream(s.c_str(), advice)
+    {
+    }
+
+    mapped_ifstream(mapped_ifstream&& other)
+    : std::istream(std::move(other)), sb_(std::move(other.sb_))
+    {
+        set_rdbuf(&sb_);
+    }
+
+    mapped_filebuf* rdbuf() const { return const_cast<mapped_filebuf*>(&sb_); }
+
+    bool is_open() const { return sb_.is_open(); }
+
+    void open(const char* s, map_advice advice = map_advice::sequential)
+    {
+        if (sb_.open(s, advice))
+            clear();
+        else
+            setstate(std::ios_base::failbit);
+    }
+
+    void open(const std::string& s, map_advice advice = map_advice::sequential)
+    {
+        open(s.c_str(), advice);
+    }
+
+    void close()
+    {
+        if (!sb_.close()) setstate(std::ios_base::failbit);
+    }
+
+    const char* data() const { return sb_.data(); }
+
+    std::size_t size() const { return sb_.size(); }
+
+private:
+    mapped_filebuf sb_;
+};
+
+} // End of namespace stream
+
+using stream::mapped_ifstream;
+
+} // End of namespace fibio
+
+#endif
@@ -9,10 +9,189 @@
 #ifndef fibio_stream_ssl_hpp
 #define fibio_stream_ssl_hpp
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <boost/version.hpp>
 #include <boost/asio/ssl.hpp>
+#include <fibio/fibers/condition_variable.hpp>
+#include <fibio/fibers/future/async.hpp>
+#include <fibio/fibers/future/oneshot.hpp>
+#include <fibio/fibers/mutex.hpp>
 #include <fibio/stream/iostream.hpp>
 
 namespace fibio {
+namespace ssl {
+
+class handshake_offload;
+
+namespace detail {
+
+/// Runs `fn` on the pool of `o`
+template <typename Function>
+void post_to(handshake_offload* o, Function&& fn);
+
+#if BOOST_VERSION >= 106600
+/**
+ * Executor posts to the pool of a `handshake_offload`
+ */
+struct offload_executor
+{
+    boost::asio::execution_context& context() const noexcept { return *context_; }
+
+    void on_work_started() const noexcept {}
+
+    void on_work_finished() const noexcept {}
+
+    template <typename Function, typename Allocator>
+    void dispatch(Function&& fn, const Allocator&) const
+    {
+        post_to(offload_, std::forward<Function>(fn));
+    }
+
+    template <typename Function, typename Allocator>
+    void post(Function&& fn, const Allocator&) const
+    {
+        post_to(offload_, std::forward<Function>(fn));
+    }
+
+    template <typename Function, typename Allocator>
+    void defer(Function&& fn, const Allocator&) const
+    {
+        post_to(offload_, std::forward<Function>(fn));
+    }
+
+    friend bool operator==(const offload_executor& a, const offload_executor& b) noexcept
+    {
+        return a.offload_ == b.offload_;
+    }
+
+    friend bool operator!=(const offload_executor& a, const offload_executor& b) noexcept
+    {
+        return a.offload_ != b.offload_;
+    }
+
+    handshake_offload* offload_;
+    boost::asio::execution_context* context_;
+};
+#endif
+
+/**
+ * Completion handler of an offloaded handshake
+ *
+ * ASIO runs every step of the handshake, including the crypto work after each read or write,
+ * through the executor or the invocation hook of the final handler, both move these steps to
+ * the pool. Older ASIO only has the hook.
+ */
+struct offload_handler
+{
+    void operator()(const boost::system::error_code& ec) { promise_->set_value(ec); }
+
+#if BOOST_VERSION >= 106600
+    typedef offload_executor executor_type;
+
+    executor_type get_executor() const noexcept { return executor_type{offload_, context_}; }
+#endif
+
+    template <typename Function>
+    friend void asio_handler_invoke(Function& fn, offload_handler* h)
+    {
+        post_to(h->offload_, fn);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(const Function& fn, offload_handler* h)
+    {
+        post_to(h->offload_, fn);
+    }
+
+    handshake_offload* offload_;
+    boost::asio::io_service* context_;
+    std::shared_ptr<fibers::oneshot_promise<boost::system::error_code>> promise_;
+};
+
+} // End of namespace detail
+
+/**
+ * Runs the CPU work of TLS handshakes on a dedicated pool of threads
+ *
+ * Key exchange and certificate signing of a handshake storm no longer run on the scheduler
+ * threads, which keep serving established connections. At most `max_handshakes` handshakes are
+ * in progress at the same time, others wait for a slot in the order they arrive.
+ */
+class handshake_offload
+{
+public:
+    explicit handshake_offload(std::size_t threads = 1, std::size_t max_handshakes = 64);
+
+    /// Performs the handshake of `s`, the calling fiber waits for a slot and then for completion
+    template <typename Stream>
+    void handshake(boost::asio::ssl::stream<Stream>& s,
+                   boost::asio::ssl::stream_base::handshake_type type,
+                   boost::system::error_code& ec)
+    {
+        slot_guard guard(*this);
+        auto p = std::make_shared<fibers::oneshot_promise<boost::system::error_code>>();
+        fibers::oneshot_future<boost::system::error_code> f = p->get_future();
+        detail::offload_handler h{this, &asio::get_io_service(), std::move(p)};
+        s.async_handshake(type, std::move(h));
+        ec = f.get();
+    }
+
+    /// Number of handshakes in progress
+    std::size_t active() const;
+
+    /// Number of handshakes waiting for a slot
+    std::size_t waiting() const;
+
+    /// Number of handshake steps run on the pool
+    std::uint64_t offloaded() const { return pool_.stats().completed; }
+
+private:
+    handshake_offload(const handshake_offload&) = delete;
+
+    void operator=(const handshake_offload&) = delete;
+
+    void enter();
+
+    void leave();
+
+    /// Holds a handshake slot until destroyed, so it is given back if the handshake throws
+    struct slot_guard
+    {
+        explicit slot_guard(handshake_offload& o) : o_(o) { o_.enter(); }
+
+        ~slot_guard() { o_.leave(); }
+
+        slot_guard(const slot_guard&) = delete;
+
+        void operator=(const slot_guard&) = delete;
+
+        handshake_offload& o_;
+    };
+
+    fibers::foreign_thread_pool pool_;
+    std::size_t max_handshakes_;
+    mutable fibers::mutex m_;
+    fibers::condition_variable cv_;
+    std::size_t active_ = 0;
+    std::size_t waiting_ = 0;
+    template <typename Function>
+    friend void detail::post_to(handshake_offload* o, Function&& fn);
+};
+
+template <typename Function>
+void detail::post_to(handshake_offload* o, Function&& fn)
+{
+    // Handlers may be move-only
+    auto f = std::make_shared<typename std::decay<Function>::type>(std::forward<Function>(fn));
+    // Never blocks, the queue holds more entries than the handshakes allowed at the same time
+    o->pool_.async_call_oneshot([f]() { (*f)(); });
+}
+
+} // End of namespace ssl
+
 namespace stream {
 
 // Acceptor for SSL over stream socket
@@ -47,7 +226,14 @@ struct stream_acceptor<iostream<boost::asio::ssl::stream<Stream>>>
 
     stream_acceptor(const endpoint_type& ep) : acc_(asio::get_io_service(), ep) {}
 
-    stream_acceptor(stream_acceptor&& other) : acc_(std::move(other.acc_)) {}
+    stream_acceptor(const endpoint_type& ep, bool reuse_port) : acc_(asio::get_io_service())
+    {
+        detail::open_acceptor(acc_, ep, reuse_port);
+    }
+
+    stream_acceptor(stream_acceptor&& other) : acc_(std::move(other.acc_)), offload_(other.offload_)
+    {
+    }
 
     stream_acceptor(const stream_acceptor& other) = delete;
 
@@ -55,6 +241,9 @@ struct stream_acceptor<iostream<boost::asio::ssl::stream<Stream>>>
 
     void close() { acc_.close(); }
 
+    /// Runs handshakes on `o`, null runs them in the accepting fiber
+    void set_handshake_offload(ssl::handshake_offload* o) { offload_ = o; }
+
     boost::system::error_code accept(stream_type& s)
     {
         boost::system::error_code ec;
@@ -64,9 +253,44 @@ struct stream_acceptor<iostream<boost::asio::ssl::stream<Stream>>>
 
     void accept(stream_type& s, boost::system::error_code& ec)
     {
-        acc_.async_accept(s.rdbuf()->next_layer(), asio::yield[ec]);
+        accept_connection(s, ec);
         if (ec) return;
-        s.rdbuf()->async_handshake(boost::asio::ssl::stream_base::server, asio::yield[ec]);
+        handshake(s, ec);
+    }
+
+    /// Accepts the connection only, so the accepting fiber can go on with the next connection
+    /// while the handshake is done by `handshake` in another fiber
+    void accept_connection(stream_type& s, boost::system::error_code& ec)
+    {
+        acc_.async_accept(s.rdbuf()->next_layer(), asio::yield[ec]);
+    }
+
+    /// Accepts a connection already in the backlog without the handshake, which is left to
+    /// `handshake` in another fiber, sets `would_block` instead of waiting for a connection
+    void try_accept(stream_type& s, boost::system::error_code& ec)
+    {
+        if (!acc_.non_blocking()) acc_.non_blocking(true, ec);
+        if (!ec) acc_.accept(s.rdbuf()->next_layer(), ec);
+    }
+
+    /// Waits for a connection in the backlog, returns right away with ASIO older than 1.66
+    void wait_ready(boost::system::error_code& ec)
+    {
+#if BOOST_VERSION >= 106600
+        acc_.async_wait(acceptor_type::wait_read, asio::yield[ec]);
+#else
+        ec.clear();
+#endif
+    }
+
+    endpoint_type local_endpoint() const { return acc_.local_endpoint(); }
+
+    void handshake(stream_type& s, boost::system::error_code& ec)
+    {
+        if (offload_)
+            offload_->handshake(*s.rdbuf(), boost::asio::ssl::stream_base::server, ec);
+        else
+            s.rdbuf()->async_handshake(boost::asio::ssl::stream_base::server, asio::yield[ec]);
     }
 
     boost::system::error_code operator()(stream_type& s) { return accept(s); }
@@ -74,6 +298,7 @@ struct stream_acceptor<iostream<boost::asio::ssl::stream<Stream>>>
     void operator()(stream_type& s, boost::system::error_code& ec) { accept(s, ec); }
 
     acceptor_type acc_;
+    ssl::handshake_offload* offload_ = nullptr;
 };
 
 template <typename Socket>
@@ -90,6 +315,12 @@ struct stream_traits<stream::iostream<boost::asio::ssl::stream<Socket>>>
     {
         return std::unique_ptr<stream_type>(new stream_type(*arg));
     }
+
+    // The handshake of a connection taken by `try_accept`
+    static void finish_accept(stream_type& s, boost::system::error_code& ec)
+    {
+        s.rdbuf()->async_handshake(boost::asio::ssl::stream_base::server, asio::yield[ec]);
+    }
 };
 
 } // End of namespace stream
@@ -106,6 +337,117 @@ typedef stream::iostream<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>
 typedef stream::stream_acceptor<tcp_stream> tcp_stream_acceptor;
 typedef stream::listener<tcp_stream> tcp_listener;
 
+/**
+ * Server side TLS session cache, lets returning clients resume with an abbreviated handshake
+ *
+ * Sessions are kept in shards with their own lock and LRU list, so concurrent handshakes on
+ * different threads rarely contend. It serves clients that do not use session tickets, or all
+ * clients if tickets are disabled with `SSL_OP_NO_TICKET`. A cache can be attached to several
+ * contexts and must outlive them.
+ */
+class session_cache
+{
+public:
+    explicit session_cache(std::size_t capacity = 20480,
+                           std::size_t shards = 16,
+                           std::chrono::seconds timeout = std::chrono::seconds(300));
+
+    ~session_cache();
+
+    /// Replaces the OpenSSL internal cache of `ctx`
+    void attach(context& ctx);
+
+    /// Number of resumptions served from the cache
+    std::size_t hits() const;
+
+    /// Number of resumptions asked for sessions not in the cache
+    std::size_t misses() const;
+
+    std::size_t size() const;
+
+    void clear();
+
+    struct impl;
+
+private:
+    session_cache(const session_cache&) = delete;
+
+    void operator=(const session_cache&) = delete;
+
+    std::unique_ptr<impl> impl_;
+};
+
+/**
+ * Session ticket keys, the session state is kept by the client and no server side storage is
+ * needed, so tickets work across threads and processes sharing the keys
+ *
+ * A new key is generated every `rotation`, tickets issued with the previous key are still
+ * accepted and renewed, so a ticket lives for two rotation periods at most.
+ */
+class ticket_keys
+{
+public:
+    explicit ticket_keys(std::chrono::seconds rotation = std::chrono::hours(12));
+
+    ~ticket_keys();
+
+    void attach(context& ctx);
+
+    /// Generates a new key now, the current one becomes the previous
+    void rotate();
+
+    /// Number of tickets accepted
+    std::size_t hits() const;
+
+    /// Number of tickets with an unknown or expired key
+    std::size_t misses() const;
+
+    struct impl;
+
+private:
+    ticket_keys(const ticket_keys&) = delete;
+
+    void operator=(const ticket_keys&) = delete;
+
+    std::unique_ptr<impl> impl_;
+};
+
+/**
+ * Client side TLS session cache, keeps the latest session of each peer endpoint
+ *
+ * Once attached to a context, every `connect` of streams created with the context offers the
+ * cached session of the peer, reconnecting to the same server resumes the session instead of a
+ * full handshake.
+ */
+class client_session_cache
+{
+public:
+    explicit client_session_cache(std::size_t capacity = 1024);
+
+    ~client_session_cache();
+
+    void attach(context& ctx);
+
+    /// Number of handshakes that resumed a cached session
+    std::size_t hits() const;
+
+    /// Number of full handshakes
+    std::size_t misses() const;
+
+    std::size_t size() const;
+
+    void clear();
+
+    struct impl;
+
+private:
+    client_session_cache(const client_session_cache&) = delete;
+
+    void operator=(const client_session_cache&) = delete;
+
+    std::unique_ptr<impl> impl_;
+};
+
 } // End of namespace ssl
 } // End of namespace fibio
 
@@ -10,11 +10,20 @@
 #define fibio_stream_streambuf_hpp
 
 #include <streambuf>
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <utility>
 #include <vector>
 #include <boost/system/error_code.hpp>
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/asio/basic_stream_socket.hpp>
+#include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl/stream_base.hpp>
 #include <fibio/fibers/fiber.hpp>
 #include <fibio/fibers/asio/yield.hpp>
@@ -30,6 +39,9 @@ class stream;
 } // End of namespace asio
 } // End of namespace boost
 
+// OpenSSL connection, `SSL`
+struct ssl_st;
+
 namespace fibio {
 namespace stream {
 
@@ -39,6 +51,186 @@ enum duplex_mode
     half_duplex,
 };
 
+/// Size of get and put buffers of streams created after the call, default is 1500
+void set_default_buffer_size(std::size_t size);
+
+/// Size of get and put buffers of new streams
+std::size_t default_buffer_size();
+
+namespace detail {
+
+/// Allocate a buffer from the slab of calling thread, `size` is rounded up to the size class
+char* buffer_allocate(std::size_t& size);
+
+/// Return a buffer to the slab of calling thread, the buffer may come from another thread
+void buffer_deallocate(char* p, std::size_t size) noexcept;
+
+/**
+ * Move-only buffer drawn from the slab pool, empty until `acquire` is called
+ */
+class pooled_buffer
+{
+public:
+    pooled_buffer() noexcept : data_(nullptr), size_(0) {}
+
+    pooled_buffer(pooled_buffer&& other) noexcept : data_(other.data_), size_(other.size_)
+    {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    pooled_buffer& operator=(pooled_buffer&& other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~pooled_buffer() { release(); }
+
+    /// Make sure the buffer holds at least `size` bytes, old content is not kept
+    void acquire(std::size_t size)
+    {
+        if (size_ >= size) return;
+        release();
+        data_ = buffer_allocate(size);
+        size_ = size;
+    }
+
+    void release() noexcept
+    {
+        if (data_) buffer_deallocate(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    char* data() const noexcept { return data_; }
+
+    /// Capacity of the buffer, may be bigger than the requested size
+    std::size_t size() const noexcept { return size_; }
+
+    bool empty() const noexcept { return size_ == 0; }
+
+private:
+    pooled_buffer(const pooled_buffer&) = delete;
+
+    pooled_buffer& operator=(const pooled_buffer&) = delete;
+
+    char* data_;
+    std::size_t size_;
+};
+
+/// Sends up to `len` bytes of file `fd` from `offset` to socket `sock` until the socket buffer
+/// is full, `offset` is advanced. `sock` must be non-blocking, `ec` is set to would_block if the
+/// socket buffer is full, less than `len` bytes sent without error means the file has ended
+std::size_t send_file_some(
+    int sock, int fd, std::uint64_t& offset, std::size_t len, boost::system::error_code& ec);
+
+/// A pipe used to move data between sockets in the kernel
+class kernel_pipe
+{
+public:
+    kernel_pipe();
+
+    ~kernel_pipe();
+
+    /// Moves up to `len` bytes from `in` into the pipe, returns 0 on end of stream
+    std::size_t fill(int in, std::size_t len, boost::system::error_code& ec);
+
+    /// Moves up to `len` bytes from the pipe to `out` until `out` is full, `ec` is set to
+    /// would_block if `out` is full
+    std::size_t drain(int out, std::size_t len, boost::system::error_code& ec);
+
+    /// Number of bytes in the pipe
+    std::size_t size() const { return size_; }
+
+    /// False if splice is not supported on the platform
+    bool valid() const { return fds_[0] >= 0; }
+
+private:
+    kernel_pipe(const kernel_pipe&) = delete;
+
+    void operator=(const kernel_pipe&) = delete;
+
+    int fds_[2];
+    std::size_t size_;
+};
+
+/// Switches a socket to non-blocking mode, and back to blocking mode when destroyed if it was
+template <typename Socket>
+class non_blocking_scope
+{
+public:
+    non_blocking_scope(Socket& s, boost::system::error_code& ec)
+    : s_(s), switched_(!s.native_non_blocking())
+    {
+        if (switched_) s_.native_non_blocking(true, ec);
+    }
+
+    ~non_blocking_scope()
+    {
+        boost::system::error_code ec;
+        if (switched_) s_.native_non_blocking(false, ec);
+    }
+
+private:
+    non_blocking_scope(const non_blocking_scope&) = delete;
+
+    void operator=(const non_blocking_scope&) = delete;
+
+    Socket& s_;
+    bool switched_;
+};
+
+/// Offers the session cached for `peer` before a client handshake, does nothing if the context
+/// has no `ssl::client_session_cache` attached
+void ssl_client_resume(::ssl_st* ssl, const std::string& peer);
+
+/// Counts the client handshake as a cache hit or miss
+void ssl_client_handshaked(::ssl_st* ssl, bool ok);
+
+/// OpenSSL discards the session of a connection freed without a TLS shutdown, marks an
+/// established connection as shut down so its session can still be resumed, only when the
+/// context has a session cache, ticket keys or a client session cache attached
+void ssl_keep_session(::ssl_st* ssl);
+
+/// Lets a stream wait for incoming data without holding a buffer, only sockets support it
+template <typename Stream>
+struct readiness
+{
+    /// Returns true if it is known that nothing can be read without blocking
+    static bool idle(Stream&) { return false; }
+
+    /// Returns true if it is known that a read will not block
+    static bool readable(Stream&) { return false; }
+
+    static void wait_readable(Stream&, boost::system::error_code&) {}
+};
+
+template <typename Protocol>
+struct readiness<boost::asio::basic_stream_socket<Protocol>>
+{
+    static bool idle(boost::asio::basic_stream_socket<Protocol>& s)
+    {
+        boost::system::error_code ec;
+        return s.available(ec) == 0 && !ec;
+    }
+
+    static bool readable(boost::asio::basic_stream_socket<Protocol>& s)
+    {
+        boost::system::error_code ec;
+        return s.available(ec) > 0 && !ec;
+    }
+
+    static void wait_readable(boost::asio::basic_stream_socket<Protocol>& s,
+                              boost::system::error_code& ec)
+    {
+        s.async_read_some(boost::asio::null_buffers(), fibers::asio::yield[ec]);
+    }
+};
+
+} // End of namespace detail
+
 template <typename Stream>
 class streambuf_base : public std::streambuf, public Stream
 {
@@ -80,7 +272,11 @@ public:
           //, put_buffer_(std::move(other.put_buffer_))
           ,
           unbuffered_(other.unbuffered_),
-          duplex_mode_(other.duplex_mode_)
+          duplex_mode_(other.duplex_mode_),
+          get_buffer_size_(other.get_buffer_size_),
+          put_buffer_size_(other.put_buffer_size_),
+          release_when_idle_(other.release_when_idle_),
+          coalesce_(other.coalesce_)
     {
         init_buffers();
     }
@@ -95,6 +291,138 @@ public:
 
     duplex_mode get_duplex_mode() const { return duplex_mode_; }
 
+    /**
+     * In half duplex mode, if true, pending output is kept in the put buffer when a read can be
+     * served without blocking, so replies to pipelined requests are coalesced into fewer writes.
+     * Output is still flushed when the buffer is full, on explicit flush, and before a read
+     * blocks. Only sockets can tell if a read blocks, other streams always flush.
+     */
+    void set_coalesce(bool c) { coalesce_ = c; }
+
+    bool get_coalesce() const { return coalesce_; }
+
+    /**
+     * Set sizes of get and put buffers, takes effect when the buffer is acquired next time
+     * Bigger buffers mean fewer syscalls for bulk transfer
+     */
+    void set_buffer_size(std::size_t get_size, std::size_t put_size)
+    {
+        get_buffer_size_ = get_size;
+        put_buffer_size_ = put_size;
+        release_buffers();
+    }
+
+    std::size_t get_buffer_size() const { return get_buffer_size_; }
+
+    std::size_t put_buffer_size() const { return put_buffer_size_; }
+
+    /**
+     * If true, a read waiting for data returns both buffers to the pool first, so an idle
+     * connection holds no buffer, only works with sockets
+     */
+    void set_release_when_idle(bool r) { release_when_idle_ = r; }
+
+    bool get_release_when_idle() const { return release_when_idle_; }
+
+    /**
+     * Writes buffered data followed by `buffers` with one gathered write, `buffers` are written
+     * directly from caller's memory without being copied into the put buffer
+     * @return number of bytes written from `buffers`
+     */
+    template <typename ConstBufferSequence>
+    std::size_t write_buffers(const ConstBufferSequence& buffers, boost::system::error_code& ec)
+    {
+        std::size_t pending = pptr() - pbase();
+        std::size_t ret = 0;
+        if (pending == 0) {
+            ret = boost::asio::async_write(
+                static_cast<base_type&>(*this), buffers, fibers::asio::yield[ec]);
+        } else {
+            // Keep the order, pending bytes go first in the same writev
+            std::vector<boost::asio::const_buffer> bufs;
+            bufs.push_back(boost::asio::const_buffer(pbase(), pending));
+            bufs.insert(bufs.end(), buffers.begin(), buffers.end());
+            std::size_t n = boost::asio::async_write(
+                static_cast<base_type&>(*this), bufs, fibers::asio::yield[ec]);
+            ret = n > pending ? n - pending : 0;
+            setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
+        }
+        return ret;
+    }
+
+    /**
+     * Fills `buffers`, buffered data is copied first, the rest is read directly into caller's
+     * memory with one scattered read
+     * @return number of bytes read, less than the size of `buffers` only on error
+     */
+    template <typename MutableBufferSequence>
+    std::size_t read_into(const MutableBufferSequence& buffers, boost::system::error_code& ec)
+    {
+        std::vector<boost::asio::mutable_buffer> rest;
+        std::size_t copied = 0;
+        for (auto i = buffers.begin(); i != buffers.end(); ++i) {
+            boost::asio::mutable_buffer b(*i);
+            std::size_t n = std::min(std::size_t(egptr() - gptr()), boost::asio::buffer_size(b));
+            if (n > 0) {
+                traits_type::copy(boost::asio::buffer_cast<char*>(b), gptr(), n);
+                gbump(int(n));
+                copied += n;
+                b = b + n;
+            }
+            if (boost::asio::buffer_size(b) > 0) rest.push_back(b);
+        }
+        if (rest.empty()) return copied;
+        flush_before_read();
+        return copied + boost::asio::async_read(
+                            static_cast<base_type&>(*this), rest, fibers::asio::yield[ec]);
+    }
+
+    /**
+     * Replaces `out` with data up to and including `delim`, the get buffer is scanned in place
+     * @return false if the stream ended before `delim`, `out` holds what was read
+     */
+    bool read_until(std::string& out, const std::string& delim)
+    {
+        out.clear();
+        if (delim.empty()) return true;
+        // A match may start in the last delim.size()-1 bytes already taken
+        const std::size_t carry = delim.size() - 1;
+        for (;;) {
+            if (gptr() == egptr() && traits_type::eq_int_type(underflow(), traits_type::eof()))
+                return false;
+            const char_type* g = gptr();
+            const char_type* e = egptr();
+            std::size_t n = std::size_t(e - g);
+            if (!out.empty() && carry > 0) {
+                // Partial match carried over, only check it against the head of the buffer
+                std::size_t t = std::min(out.size(), carry);
+                std::string edge(out, out.size() - t);
+                edge.append(g, std::min(n, carry));
+                std::size_t pos = edge.find(delim);
+                if (pos != std::string::npos) return take_until(out, pos + delim.size() - t);
+            }
+            const char_type* m = std::search(g, e, delim.begin(), delim.end());
+            if (m != e) return take_until(out, std::size_t(m - g) + delim.size());
+            out.append(g, n);
+            gbump(int(n));
+        }
+    }
+
+    /**
+     * Returns buffers holding no pending data to the pool, they are acquired again on demand
+     */
+    void release_buffers()
+    {
+        if (gptr() == egptr()) {
+            get_buffer_.release();
+            setg(0, 0, 0);
+        }
+        if (pptr() == pbase() && !unbuffered_) {
+            put_buffer_.release();
+            setp(0, 0);
+        }
+    }
+
 protected:
     pos_type
     seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
@@ -120,23 +448,53 @@ protected:
         return egptr() - gptr();
     }
 
+    std::streamsize xsgetn(char_type* s, std::streamsize n) override
+    {
+        std::streamsize avail = egptr() - gptr();
+        if (n - avail < std::streamsize(get_buffer_size_)) return std::streambuf::xsgetn(s, n);
+        // Large read, drain the buffer and read the rest directly into caller's memory
+        if (avail > 0) {
+            traits_type::copy(s, gptr(), avail);
+            gbump(int(avail));
+        }
+        flush_before_read();
+        boost::system::error_code ec;
+        std::size_t bytes_transferred
+            = boost::asio::async_read(static_cast<base_type&>(*this),
+                                      boost::asio::buffer(s + avail, n - avail),
+                                      fibers::asio::yield[ec]);
+        std::size_t total = avail + bytes_transferred;
+        if (char* buf = get_buffer_.data()) {
+            // The tail of what was read becomes the putback area, same as after underflow
+            std::size_t k = std::min(total, std::size_t(putback_max));
+            traits_type::copy(buf + putback_max - k, s + total - k, k);
+            setg(buf + putback_max - k, buf + putback_max, buf + putback_max);
+        } else {
+            setg(0, 0, 0);
+        }
+        return std::streamsize(total);
+    }
+
     int_type underflow() override
     {
-        if (duplex_mode_ == half_duplex) sync();
+        flush_before_read();
         if (gptr() == egptr()) {
             boost::system::error_code ec;
-            // size_t bytes_transferred=base_type::read_some(boost::asio::buffer(&get_buffer_[0]+
-            // putback_max, buffer_size-putback_max),
-            //                                              ec);
+            if (release_when_idle_ && detail::readiness<Stream>::idle(*this)) {
+                // Hold no buffer while waiting for the peer
+                release_buffers();
+                detail::readiness<Stream>::wait_readable(*this, ec);
+                if (ec) return traits_type::eof();
+            }
+            get_buffer_.acquire(get_buffer_size_ + putback_max);
+            char* buf = get_buffer_.data();
             size_t bytes_transferred = base_type::async_read_some(
-                boost::asio::buffer(&get_buffer_[0] + putback_max, buffer_size - putback_max),
+                boost::asio::buffer(buf + putback_max, get_buffer_.size() - putback_max),
                 fibers::asio::yield[ec]);
             if (ec || bytes_transferred == 0) {
                 return traits_type::eof();
             }
-            setg(&get_buffer_[0],
-                 &get_buffer_[0] + putback_max,
-                 &get_buffer_[0] + putback_max + bytes_transferred);
+            setg(buf, buf + putback_max, buf + putback_max + bytes_transferred);
             return traits_type::to_int_type(*gptr());
         } else {
             return traits_type::eof();
@@ -170,10 +528,14 @@ protected:
                 size -= bytes_transferred;
                 if (ec) return traits_type::eof();
             }
-            setp(&put_buffer_[0], &put_buffer_[0] + put_buffer_.size());
-
             // If the new character is eof then our work here is done.
-            if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+            if (traits_type::eq_int_type(c, traits_type::eof())) {
+                setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
+                return traits_type::not_eof(c);
+            }
+
+            put_buffer_.acquire(put_buffer_size_);
+            setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
 
             // Add the new character to the output buffer.
             *pptr() = traits_type::to_char_type(c);
@@ -198,29 +560,40 @@ protected:
 private:
     void init_buffers()
     {
-        get_buffer_.resize(buffer_size + putback_max);
-        put_buffer_.resize(buffer_size);
-        setg(&get_buffer_[0], &get_buffer_[0] + putback_max, &get_buffer_[0] + putback_max);
-        if (unbuffered_)
-            setp(0, 0);
-        else
-            setp(&put_buffer_[0], &put_buffer_[0] + put_buffer_.size());
+        // Buffers are acquired from the pool on first use
+        setg(0, 0, 0);
+        setp(0, 0);
     }
 
-    enum
+    /// Moves `n` bytes of the get buffer to `out`, always returns true
+    bool take_until(std::string& out, std::size_t n)
     {
-        putback_max = 8
-    };
-    // A practical MTU size
+        out.append(gptr(), n);
+        gbump(int(n));
+        return true;
+    }
+
+    // Half duplex peers wait for our output before sending more, flush before a read may block
+    void flush_before_read()
+    {
+        if (duplex_mode_ != half_duplex) return;
+        if (coalesce_ && detail::readiness<Stream>::readable(*this)) return;
+        sync();
+    }
+
     enum
     {
-        buffer_size = 1500
+        putback_max = 8
     };
 
-    std::vector<char> get_buffer_;
-    std::vector<char> put_buffer_;
+    detail::pooled_buffer get_buffer_;
+    detail::pooled_buffer put_buffer_;
     bool unbuffered_ = false;
     duplex_mode duplex_mode_ = half_duplex;
+    std::size_t get_buffer_size_ = default_buffer_size();
+    std::size_t put_buffer_size_ = default_buffer_size();
+    bool release_when_idle_ = false;
+    bool coalesce_ = false;
 };
 
 template <typename Stream>
@@ -248,6 +621,128 @@ public:
         base_type::async_connect(arg, fibers::asio::yield[ec]);
         return ec;
     }
+
+    /**
+     * Sends `len` bytes of file `fd` starting at `offset` with sendfile(2), the data never goes
+     * through user space, buffered output is flushed first. Parks the fiber when the socket
+     * buffer is full.
+     * @return number of bytes sent, less than `len` if the file ends or on error
+     */
+    std::size_t
+    send_file(int fd, std::uint64_t offset, std::size_t len, boost::system::error_code& ec)
+    {
+        typedef typename base_type::traits_type traits_type;
+        // Taken before the flush, which may switch the socket as well
+        detail::non_blocking_scope<base_type> nb(*this, ec);
+        if (ec) return 0;
+        if (traits_type::eq_int_type(base_type::sync(), traits_type::eof())) {
+            ec = boost::asio::error::broken_pipe;
+            return 0;
+        }
+        std::size_t ret = 0;
+        while (ret < len) {
+            std::size_t n = detail::send_file_some(
+                base_type::native_handle(), fd, offset, len - ret, ec);
+            ret += n;
+            if (ec == boost::asio::error::would_block) {
+                ec.clear();
+                base_type::async_write_some(boost::asio::null_buffers(), fibers::asio::yield[ec]);
+                if (ec) break;
+                continue;
+            }
+            // Error or end of file
+            break;
+        }
+        return ret;
+    }
+
+    /**
+     * Moves everything read from this socket to `to` until end of stream with splice(2) through
+     * a kernel pipe, or through a pooled buffer where splice is not supported. Data already in
+     * the get buffer goes first. Parks the fiber whenever either side is not ready.
+     * @return number of bytes moved
+     */
+    template <typename OtherProtocol>
+    std::size_t splice_to(streambuf<boost::asio::basic_stream_socket<OtherProtocol>>& to,
+                          boost::system::error_code& ec)
+    {
+        typedef typename base_type::traits_type traits_type;
+        // Taken before any I/O, which may switch the sockets as well
+        detail::non_blocking_scope<base_type> nb(*this, ec);
+        if (ec) return 0;
+        detail::non_blocking_scope<streambuf<boost::asio::basic_stream_socket<OtherProtocol>>>
+            to_nb(to, ec);
+        if (ec) return 0;
+        std::size_t ret = 0;
+        if (std::size_t avail = this->egptr() - this->gptr()) {
+            // Also flushes the put buffer of `to`
+            ret = to.write_buffers(boost::asio::buffer(this->gptr(), avail), ec);
+            this->gbump(int(ret));
+            if (ec) return ret;
+        } else if (traits_type::eq_int_type(to.pubsync(), traits_type::eof())) {
+            ec = boost::asio::error::broken_pipe;
+            return 0;
+        }
+        detail::kernel_pipe pipe;
+        if (!pipe.valid()) return ret + copy_to(to, ec);
+        while (!ec) {
+            std::size_t n = pipe.fill(base_type::native_handle(), 64 * 1024, ec);
+            if (ec == boost::asio::error::would_block) {
+                ec.clear();
+                base_type::async_read_some(boost::asio::null_buffers(), fibers::asio::yield[ec]);
+                continue;
+            }
+            if (ec || n == 0) break;
+            while (!ec && pipe.size() > 0) {
+                ret += pipe.drain(to.native_handle(), pipe.size(), ec);
+                if (ec == boost::asio::error::would_block) {
+                    ec.clear();
+                    to.async_write_some(boost::asio::null_buffers(), fibers::asio::yield[ec]);
+                }
+            }
+        }
+        return ret;
+    }
+
+    /// Set TCP_NODELAY, only works with TCP sockets
+    boost::system::error_code set_no_delay(bool nd)
+    {
+        boost::system::error_code ec;
+        base_type::set_option(boost::asio::ip::tcp::no_delay(nd), ec);
+        return ec;
+    }
+
+    /// Set TCP_CORK, partial segments are held back by the kernel until uncorked, Linux only
+    boost::system::error_code set_cork(bool c)
+    {
+        boost::system::error_code ec;
+#ifdef TCP_CORK
+        base_type::set_option(
+            boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK>(c), ec);
+#else
+        ec = boost::asio::error::operation_not_supported;
+#endif
+        return ec;
+    }
+
+private:
+    template <typename Other>
+    std::size_t copy_to(Other& to, boost::system::error_code& ec)
+    {
+        detail::pooled_buffer buf;
+        buf.acquire(64 * 1024);
+        std::size_t ret = 0;
+        for (;;) {
+            std::size_t n = base_type::async_read_some(
+                boost::asio::buffer(buf.data(), buf.size()), fibers::asio::yield[ec]);
+            if (ec) break;
+            ret += boost::asio::async_write(
+                to, boost::asio::buffer(buf.data(), n), fibers::asio::yield[ec]);
+            if (ec) break;
+        }
+        if (ec == boost::asio::error::eof) ec.clear();
+        return ret;
+    }
 };
 
 template <typename Stream>
@@ -263,6 +758,8 @@ public:
     {
     }
 
+    ~streambuf() { detail::ssl_keep_session(base_type::native_handle()); }
+
     void cancel() { base_type::next_layer().cancel(); }
 
     template <typename Arg>
@@ -271,7 +768,11 @@ public:
         boost::system::error_code ec;
         base_type::next_layer().async_connect(arg, fibers::asio::yield[ec]);
         if (ec) return ec;
+        std::ostringstream peer;
+        peer << arg;
+        detail::ssl_client_resume(base_type::native_handle(), peer.str());
         base_type::async_handshake(boost::asio::ssl::stream_base::client, fibers::asio::yield[ec]);
+        detail::ssl_client_handshaked(base_type::native_handle(), !ec);
         return ec;
     }
 };
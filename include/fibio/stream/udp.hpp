@@ -0,0 +1,363 @@
+//
+//  udp.hpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_stream_udp_hpp
+#define fibio_stream_udp_hpp
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/udp.hpp>
+#include <fibio/fiber.hpp>
+#include <fibio/future.hpp>
+#include <fibio/concurrent/concurrent_queue.hpp>
+#include <fibio/stream/iostream.hpp>
+
+namespace fibio {
+namespace stream {
+namespace detail {
+
+template <>
+inline boost::asio::ip::udp::endpoint
+make_endpoint<boost::asio::ip::udp::endpoint>(const std::string& access_point)
+{
+    // Same syntax as TCP, services are resolved as TCP ones
+    auto ep = make_endpoint<boost::asio::ip::tcp::endpoint>(access_point);
+    return boost::asio::ip::udp::endpoint(ep.address(), ep.port());
+}
+
+} // End of namespace detail
+
+/**
+ * Fixed number of datagram slots in one contiguous buffer
+ *
+ * A batch is filled by `udp_socket::receive_batch` or by `push`, and sent with
+ * `udp_socket::send_batch`, slots are reused after `clear` so a batch never allocates once built.
+ */
+class datagram_batch
+{
+public:
+    typedef boost::asio::ip::udp::endpoint endpoint_type;
+
+    explicit datagram_batch(std::size_t capacity = 64, std::size_t max_datagram_size = 2048)
+    : storage_(capacity * max_datagram_size), slots_(capacity), max_size_(max_datagram_size)
+    {
+    }
+
+    /// Number of slots
+    std::size_t capacity() const { return slots_.size(); }
+
+    /// Size of each slot, longer datagrams are truncated on receiving
+    std::size_t max_datagram_size() const { return max_size_; }
+
+    /// Number of datagrams in the batch
+    std::size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    bool full() const { return size_ == slots_.size(); }
+
+    void clear() { size_ = 0; }
+
+    /// Appends a datagram for a connected socket, returns false if it doesn't fit
+    bool push(const void* data, std::size_t n) { return push(data, n, endpoint_type(), false); }
+
+    /// Appends a datagram sent to `to`, returns false if the batch is full or `n` is too big
+    bool push(const void* data, std::size_t n, const endpoint_type& to)
+    {
+        return push(data, n, to, true);
+    }
+
+    char* data(std::size_t i) { return &storage_[i * max_size_]; }
+
+    const char* data(std::size_t i) const { return &storage_[i * max_size_]; }
+
+    std::size_t length(std::size_t i) const { return slots_[i].length_; }
+
+    /// Source of a received datagram, or destination of a datagram to send
+    const endpoint_type& endpoint(std::size_t i) const { return slots_[i].endpoint_; }
+
+    /// True if the received datagram was longer than `max_datagram_size`
+    bool truncated(std::size_t i) const { return slots_[i].truncated_; }
+
+private:
+    struct slot
+    {
+        std::size_t length_ = 0;
+        endpoint_type endpoint_;
+        bool has_endpoint_ = false;
+        bool truncated_ = false;
+    };
+
+    bool push(const void* data, std::size_t n, const endpoint_type& to, bool has_endpoint);
+
+    std::vector<char> storage_;
+    std::vector<slot> slots_;
+    std::size_t max_size_;
+    std::size_t size_ = 0;
+
+    friend class udp_socket;
+};
+
+/**
+ * UDP socket blocks the calling fiber instead of the thread
+ *
+ * The socket is non-blocking, every call tries the system call first and only waits for the
+ * socket to become ready when it would block, so a busy socket never goes through the reactor.
+ * Batches are received and sent with one `recvmmsg`/`sendmmsg` per up to 64 datagrams on Linux,
+ * other platforms fall back to one call per datagram.
+ */
+class udp_socket
+{
+public:
+    typedef boost::asio::ip::udp protocol_type;
+    typedef protocol_type::socket socket_type;
+    typedef protocol_type::endpoint endpoint_type;
+
+    udp_socket() : sock_(asio::get_io_service()) {}
+
+    /// Opens and binds the socket, throws `boost::system::system_error` on failure
+    explicit udp_socket(const endpoint_type& ep) : sock_(asio::get_io_service(), ep)
+    {
+        sock_.non_blocking(true);
+    }
+
+    explicit udp_socket(const char* access_point)
+    : udp_socket(detail::make_endpoint<endpoint_type>(access_point))
+    {
+    }
+
+    explicit udp_socket(const std::string& access_point)
+    : udp_socket(detail::make_endpoint<endpoint_type>(access_point))
+    {
+    }
+
+    udp_socket(udp_socket&& other) : sock_(std::move(other.sock_)) {}
+
+    udp_socket(const udp_socket&) = delete;
+
+    udp_socket& operator=(const udp_socket&) = delete;
+
+    boost::system::error_code open(const protocol_type& protocol = protocol_type::v6());
+
+    boost::system::error_code bind(const endpoint_type& ep);
+
+    /// Sets the default destination and filters out datagrams from other sources
+    boost::system::error_code connect(const endpoint_type& ep);
+
+    boost::system::error_code connect(const std::string& access_point)
+    {
+        return connect(detail::make_endpoint<endpoint_type>(access_point));
+    }
+
+    bool is_open() const { return sock_.is_open(); }
+
+    /// Wakes up all fibers blocked on the socket with `operation_aborted`
+    void close()
+    {
+        boost::system::error_code ec;
+        sock_.close(ec);
+    }
+
+    endpoint_type local_endpoint() const
+    {
+        boost::system::error_code ec;
+        return sock_.local_endpoint(ec);
+    }
+
+    socket_type& socket() { return sock_; }
+
+    socket_type::native_handle_type native_handle() { return sock_.native_handle(); }
+
+    /// Receives one datagram, returns its length, the rest of a longer datagram is discarded
+    std::size_t receive_from(void* data,
+                             std::size_t size,
+                             endpoint_type& from,
+                             boost::system::error_code& ec);
+
+    /// Receives one datagram on a connected socket
+    std::size_t receive(void* data, std::size_t size, boost::system::error_code& ec)
+    {
+        endpoint_type from;
+        return receive_from(data, size, from, ec);
+    }
+
+    std::size_t send_to(const void* data,
+                        std::size_t size,
+                        const endpoint_type& to,
+                        boost::system::error_code& ec);
+
+    /// Sends one datagram on a connected socket
+    std::size_t send(const void* data, std::size_t size, boost::system::error_code& ec);
+
+    /**
+     * Clears `b` and fills it with the datagrams already queued on the socket, waits only if
+     * there is none, returns the number of datagrams received
+     */
+    std::size_t receive_batch(datagram_batch& b, boost::system::error_code& ec);
+
+    /**
+     * Sends all datagrams in `b`, waits while the socket buffer is full, returns the number of
+     * datagrams sent, which is less than `b.size()` only on error
+     */
+    std::size_t send_batch(const datagram_batch& b, boost::system::error_code& ec);
+
+private:
+    void wait_read(boost::system::error_code& ec);
+
+    void wait_write(boost::system::error_code& ec);
+
+    socket_type sock_;
+};
+
+/**
+ * Receives datagrams on one socket and hands them to a pool of worker fibers
+ *
+ * A receiving fiber fills batches with `receive_batch` and queues whole batches, workers call the
+ * handler `f(const char* data, std::size_t size, const endpoint_type& from)` for each datagram in
+ * a batch, then return it to the receiver. When all batches are busy the receiver stops reading
+ * and the kernel drops the excess, instead of queueing without bound.
+ */
+class udp_listener
+{
+public:
+    typedef udp_socket::endpoint_type endpoint_type;
+
+    explicit udp_listener(const std::string& access_point,
+                          std::size_t workers = 4,
+                          std::size_t batch_size = 64,
+                          std::size_t max_datagram_size = 2048)
+    : ep_(detail::make_endpoint<endpoint_type>(access_point))
+    , workers_(workers ? workers : 1)
+    , batch_size_(batch_size ? batch_size : 1)
+    , max_datagram_size_(max_datagram_size)
+    {
+    }
+
+    endpoint_type endpoint() const { return ep_; }
+
+    // Start and join, other fiber may stop the listener
+    template <typename F>
+    boost::system::error_code operator()(F f)
+    {
+        try {
+            start(f);
+            join();
+        } catch (boost::system::system_error& e) {
+            return e.code();
+        }
+        return boost::system::error_code();
+    }
+
+    // Start listener, throws `boost::system::system_error` if the socket cannot be bound
+    template <typename F>
+    void start(F f)
+    {
+        if (!stop_signal_) {
+            // Datagrams sent once `start` returns are queued on the socket
+            sock_.reset(new udp_socket(ep_));
+            stop_signal_.reset(new promise<void>);
+            if (!receiver_fiber_) {
+                receiver_fiber_.reset(
+                    new fiber(&udp_listener::receiver_fiber<F>, this, stop_signal_.get(), f));
+            }
+        }
+    }
+
+    void stop()
+    {
+        if (stop_signal_) {
+            stop_signal_->set_value();
+        }
+    }
+
+    void join()
+    {
+        if (receiver_fiber_) {
+            receiver_fiber_->join();
+            receiver_fiber_.reset();
+            stop_signal_.reset();
+            sock_.reset();
+        }
+    }
+
+private:
+    typedef concurrent::concurrent_queue<datagram_batch*> batch_queue;
+
+    template <typename F>
+    void receiver_fiber(promise<void>* p, F f)
+    {
+        udp_socket& sock = *sock_;
+        fiber watchdog(fiber::attributes(fiber::attributes::stick_with_parent),
+                       &udp_listener::receiver_watchdog_fiber,
+                       this,
+                       p,
+                       std::ref(sock));
+        // Two batches per worker, one being handled and one ready
+        std::vector<std::unique_ptr<datagram_batch>> batches;
+        batch_queue free_batches;
+        batch_queue ready_batches;
+        for (std::size_t i = 0; i < workers_ * 2; i++) {
+            batches.emplace_back(new datagram_batch(batch_size_, max_datagram_size_));
+            free_batches.push(batches.back().get());
+        }
+        std::vector<fiber> workers;
+        for (std::size_t i = 0; i < workers_; i++) {
+            workers.emplace_back([f, &free_batches, &ready_batches]() {
+                datagram_batch* b = nullptr;
+                while (ready_batches.pop(b) == concurrent::queue_op_status::success) {
+                    for (std::size_t n = 0; n < b->size(); n++) {
+                        f(b->data(n), b->length(n), b->endpoint(n));
+                    }
+                    free_batches.push(b);
+                }
+            });
+        }
+        boost::system::error_code ec;
+        datagram_batch* b = nullptr;
+        while (free_batches.pop(b) == concurrent::queue_op_status::success) {
+            sock.receive_batch(*b, ec);
+            if (!ec) {
+                ready_batches.push(b);
+                continue;
+            }
+            free_batches.push(b);
+            // Only a stop ends the loop, errors like ENOBUFS or ECONNREFUSED from an ICMP message
+            // concern single datagrams
+            if (ec == boost::asio::error::operation_aborted || !sock.is_open()) break;
+        }
+        // Workers finish queued batches before exiting
+        ready_batches.close();
+        for (fiber& w : workers) w.join();
+        watchdog.join();
+    }
+
+    void receiver_watchdog_fiber(promise<void>* p, udp_socket& sock)
+    {
+        p->get_future().wait();
+        sock.close();
+    }
+
+    endpoint_type ep_;
+    std::size_t workers_;
+    std::size_t batch_size_;
+    std::size_t max_datagram_size_;
+    std::unique_ptr<udp_socket> sock_;
+    std::unique_ptr<fiber> receiver_fiber_;
+    std::unique_ptr<promise<void>> stop_signal_;
+};
+
+} // End of namespace stream
+
+using stream::datagram_batch;
+using stream::udp_socket;
+using stream::udp_listener;
+
+} // End of namespace fibio
+
+#endif
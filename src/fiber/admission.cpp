@@ -0,0 +1,319 @@
+//
+//  admission.cpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <boost/functional/hash.hpp>
+#include <fibio/fiber.hpp>
+#include <fibio/fibers/condition_variable.hpp>
+#include <fibio/fibers/mutex.hpp>
+#include <fibio/stream/admission.hpp>
+
+namespace fibio {
+namespace stream {
+
+namespace {
+
+constexpr std::size_t source_shards = 16;
+
+typedef admission_control::source_key source_key;
+
+struct source_key_hash
+{
+    std::size_t operator()(const source_key& k) const
+    {
+        return boost::hash_range(k.begin(), k.end());
+    }
+};
+
+// IPv4 addresses are stored as IPv4-mapped IPv6 ones
+source_key make_source_key(const boost::asio::ip::address& a)
+{
+    source_key k;
+    if (a.is_v4()) {
+        k.fill(0);
+        k[10] = k[11] = 0xff;
+        auto b = a.to_v4().to_bytes();
+        std::copy(b.begin(), b.end(), k.begin() + 12);
+    } else {
+        auto b = a.to_v6().to_bytes();
+        std::copy(b.begin(), b.end(), k.begin());
+    }
+    return k;
+}
+
+/**
+ * Connection counts per source address, a shard is locked only to update one counter and
+ * counters drop out when their last connection ends
+ */
+struct source_table
+{
+    struct shard
+    {
+        std::mutex m_;
+        std::unordered_map<source_key, std::uint32_t, source_key_hash> counts_;
+    };
+
+    shard& get_shard(const source_key& k)
+    {
+        return shards_[source_key_hash()(k) % source_shards];
+    }
+
+    bool acquire(const source_key& k, std::size_t limit)
+    {
+        shard& s = get_shard(k);
+        std::lock_guard<std::mutex> lock(s.m_);
+        std::uint32_t& n = s.counts_[k];
+        if (n >= limit) {
+            if (n == 0) s.counts_.erase(k);
+            return false;
+        }
+        n++;
+        return true;
+    }
+
+    void release(const source_key& k)
+    {
+        shard& s = get_shard(k);
+        std::lock_guard<std::mutex> lock(s.m_);
+        auto i = s.counts_.find(k);
+        if (i == s.counts_.end()) return;
+        if (--(i->second) == 0) s.counts_.erase(i);
+    }
+
+    shard shards_[source_shards];
+};
+
+} // End of anonymous namespace
+
+struct admission_control::state
+{
+    // Must be called with m_ held, true if the connection limit leaves no slot to reserve
+    bool limit_reached() const
+    {
+        std::size_t limit = max_connections_;
+        return limit && !reject_excess_ && active_ + reserved_ >= limit;
+    }
+
+    // Must be called with m_ held, charges the accept rate and returns the wait for the slot
+    std::chrono::steady_clock::duration charge_rate()
+    {
+        if (interval_.count() <= 0) return std::chrono::steady_clock::duration(0);
+        // Every accept moves the arrival time by one interval, it may lag behind `now` by the
+        // burst window at most
+        auto now = std::chrono::steady_clock::now();
+        auto t = std::max(next_accept_, now - burst_window_ + interval_);
+        next_accept_ = t + interval_;
+        return t > now ? t - now : std::chrono::steady_clock::duration(0);
+    }
+
+    // Neither a connection limit nor pacing, slots are taken without locking
+    bool unlimited() const { return !max_connections_ && !paced_; }
+
+    void release(const source_key* source)
+    {
+        if (source) sources_.release(*source);
+        active_.fetch_sub(1);
+        // An accepting fiber may be waiting, notify under the lock so the wakeup is not lost,
+        // slots reserved by other accepting fibers are only known under the lock
+        if (max_connections_ && !reject_excess_) {
+            std::lock_guard<fibers::mutex> lock(m_);
+            cv_.notify_all();
+        }
+    }
+
+    std::atomic<std::size_t> max_connections_{0};
+    std::atomic<bool> reject_excess_{false};
+    std::atomic<std::size_t> max_per_source_{0};
+    std::atomic<bool> paced_{false};
+    std::atomic<std::size_t> active_{0};
+    // Slots reserved by accepting fibers, counted against the connection limit like `active_`
+    std::atomic<std::size_t> reserved_{0};
+    std::atomic<std::uint64_t> admitted_{0};
+    std::atomic<std::uint64_t> rejected_{0};
+    std::atomic<std::uint64_t> rejected_per_source_{0};
+    std::atomic<std::uint64_t> paused_{0};
+    std::atomic<bool> closed_{false};
+    fibers::mutex m_;
+    fibers::condition_variable cv_;
+    // Accept pacing, the theoretical arrival time of the next accept
+    std::chrono::steady_clock::duration interval_{0};
+    std::chrono::steady_clock::duration burst_window_{0};
+    std::chrono::steady_clock::time_point next_accept_;
+    source_table sources_;
+};
+
+void admission_control::ticket::reset()
+{
+    if (owner_) owner_->release(has_source_ ? &source_ : nullptr);
+    owner_.reset();
+}
+
+admission_control::admission_control() : state_(std::make_shared<state>()) {}
+
+admission_control::~admission_control() {}
+
+void admission_control::set_max_connections(std::size_t n, bool reject_excess)
+{
+    state& s = *state_;
+    std::lock_guard<fibers::mutex> lock(s.m_);
+    s.max_connections_ = n;
+    s.reject_excess_ = reject_excess;
+    // A raised limit may let the accepting fiber go on
+    s.cv_.notify_all();
+}
+
+void admission_control::set_max_connections_per_source(std::size_t n)
+{
+    state_->max_per_source_ = n;
+}
+
+void admission_control::set_accept_rate(std::size_t per_second, std::size_t burst)
+{
+    state& s = *state_;
+    std::lock_guard<fibers::mutex> lock(s.m_);
+    s.paced_ = per_second != 0;
+    if (per_second == 0) {
+        s.interval_ = std::chrono::steady_clock::duration(0);
+        s.burst_window_ = s.interval_;
+        return;
+    }
+    s.interval_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::seconds(1))
+                  / per_second;
+    s.burst_window_ = s.interval_ * std::max<std::size_t>(burst, 1);
+    s.next_accept_ = std::chrono::steady_clock::now();
+}
+
+bool admission_control::wait_for_slot()
+{
+    state& s = *state_;
+    if (s.unlimited()) {
+        if (s.closed_) return false;
+        s.reserved_++;
+        return true;
+    }
+    std::chrono::steady_clock::duration delay(0);
+    {
+        std::unique_lock<fibers::mutex> lock(s.m_);
+        if (!s.closed_ && s.limit_reached()) {
+            s.paused_++;
+            while (!s.closed_ && s.limit_reached()) s.cv_.wait(lock);
+        }
+        if (s.closed_) return false;
+        // Reserved under the lock, so accepting fibers never take the same free slot
+        s.reserved_++;
+        delay = s.charge_rate();
+    }
+    if (delay.count() > 0) this_fiber::sleep_for(delay);
+    return true;
+}
+
+bool admission_control::try_slot()
+{
+    state& s = *state_;
+    if (s.unlimited()) {
+        if (s.closed_) return false;
+        s.reserved_++;
+        return true;
+    }
+    std::lock_guard<fibers::mutex> lock(s.m_);
+    if (s.closed_ || s.limit_reached()) return false;
+    if (s.charge_rate().count() > 0) {
+        // Not due yet, the paced wait is left to `wait_for_slot`
+        s.next_accept_ -= s.interval_;
+        return false;
+    }
+    s.reserved_++;
+    return true;
+}
+
+void admission_control::cancel_slot()
+{
+    state& s = *state_;
+    if (s.unlimited()) {
+        s.reserved_--;
+        return;
+    }
+    std::lock_guard<fibers::mutex> lock(s.m_);
+    s.reserved_--;
+    if (s.interval_.count() > 0) s.next_accept_ -= s.interval_;
+    s.cv_.notify_all();
+}
+
+admission_control::ticket admission_control::admit(const boost::asio::ip::address* source)
+{
+    state& s = *state_;
+    std::size_t n;
+    if (!s.max_connections_) {
+        s.reserved_--;
+        n = s.active_.fetch_add(1) + 1;
+    } else {
+        // Turns the reservation into a connection at once for fibers checking the limit
+        std::lock_guard<fibers::mutex> lock(s.m_);
+        s.reserved_--;
+        n = s.active_.fetch_add(1) + 1;
+    }
+    std::size_t limit = s.max_connections_;
+    if (limit && n > limit && s.reject_excess_) {
+        s.active_--;
+        s.rejected_++;
+        return ticket();
+    }
+    std::size_t per_source = s.max_per_source_;
+    if (per_source && source) {
+        source_key k = make_source_key(*source);
+        if (!s.sources_.acquire(k, per_source)) {
+            s.release(nullptr);
+            s.rejected_per_source_++;
+            return ticket();
+        }
+        s.admitted_++;
+        return ticket(state_, &k);
+    }
+    s.admitted_++;
+    return ticket(state_, nullptr);
+}
+
+void admission_control::close()
+{
+    state& s = *state_;
+    std::lock_guard<fibers::mutex> lock(s.m_);
+    s.closed_ = true;
+    s.cv_.notify_all();
+}
+
+void admission_control::open()
+{
+    state& s = *state_;
+    std::lock_guard<fibers::mutex> lock(s.m_);
+    s.closed_ = false;
+}
+
+std::size_t admission_control::active() const
+{
+    return state_->active_.load(std::memory_order_relaxed);
+}
+
+admission_control::statistics admission_control::stats() const
+{
+    const state& s = *state_;
+    statistics ret;
+    ret.admitted = s.admitted_;
+    ret.rejected = s.rejected_;
+    ret.rejected_per_source = s.rejected_per_source_;
+    ret.paused = s.paused_;
+    ret.active = s.active_;
+    return ret;
+}
+
+} // End of namespace stream
+} // End of namespace fibio
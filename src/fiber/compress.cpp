@@ -0,0 +1,456 @@
+//
+//  compress.cpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include <vector>
+#include <boost/system/system_error.hpp>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#include <fibio/stream/compressed.hpp>
+
+namespace fibio {
+namespace stream {
+namespace detail {
+
+namespace {
+
+#ifdef HAVE_ZLIB
+class zlib_compressor : public codec
+{
+public:
+    zlib_compressor(bool gzip, int level)
+    {
+        zs_.zalloc = Z_NULL;
+        zs_.zfree = Z_NULL;
+        zs_.opaque = Z_NULL;
+        // 16 more window bits asks for a gzip header and trailer
+        if (deflateInit2(&zs_, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY)
+            != Z_OK)
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(boost::system::errc::not_enough_memory)));
+    }
+
+    ~zlib_compressor() { deflateEnd(&zs_); }
+
+    result compress(
+        const char*& in, const char* in_end, char*& out, char* out_end, flush_type f) override
+    {
+        zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+        zs_.avail_in = uInt(in_end - in);
+        zs_.next_out = reinterpret_cast<Bytef*>(out);
+        zs_.avail_out = uInt(out_end - out);
+        int flush = f == finish ? Z_FINISH : f == sync_flush ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        int ret = deflate(&zs_, flush);
+        in = reinterpret_cast<const char*>(zs_.next_in);
+        out = reinterpret_cast<char*>(zs_.next_out);
+        if (ret == Z_STREAM_END) {
+            deflateReset(&zs_);
+            return done;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) return error;
+        if (f == finish) return more;
+        if (f == sync_flush) return zs_.avail_out == 0 ? more : done;
+        return in == in_end ? done : more;
+    }
+
+private:
+    z_stream zs_;
+};
+
+class zlib_decompressor : public codec
+{
+public:
+    zlib_decompressor(bool gzip)
+    {
+        zs_.zalloc = Z_NULL;
+        zs_.zfree = Z_NULL;
+        zs_.opaque = Z_NULL;
+        zs_.next_in = Z_NULL;
+        zs_.avail_in = 0;
+        if (inflateInit2(&zs_, gzip ? 15 + 16 : 15) != Z_OK)
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(boost::system::errc::not_enough_memory)));
+    }
+
+    ~zlib_decompressor() { inflateEnd(&zs_); }
+
+    result decompress(const char*& in, const char* in_end, char*& out, char* out_end) override
+    {
+        zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+        zs_.avail_in = uInt(in_end - in);
+        zs_.next_out = reinterpret_cast<Bytef*>(out);
+        zs_.avail_out = uInt(out_end - out);
+        int ret = inflate(&zs_, Z_NO_FLUSH);
+        in = reinterpret_cast<const char*>(zs_.next_in);
+        out = reinterpret_cast<char*>(zs_.next_out);
+        if (ret == Z_STREAM_END) {
+            inflateReset(&zs_);
+            return done;
+        }
+        return (ret == Z_OK || ret == Z_BUF_ERROR) ? more : error;
+    }
+
+private:
+    z_stream zs_;
+};
+#endif
+
+#ifdef HAVE_ZSTD
+class zstd_compressor : public codec
+{
+public:
+    zstd_compressor(int level) : ctx_(ZSTD_createCCtx())
+    {
+        if (!ctx_)
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(boost::system::errc::not_enough_memory)));
+        ZSTD_CCtx_setParameter(ctx_, ZSTD_c_compressionLevel, level < 0 ? 3 : level);
+    }
+
+    ~zstd_compressor() { ZSTD_freeCCtx(ctx_); }
+
+    result compress(
+        const char*& in, const char* in_end, char*& out, char* out_end, flush_type f) override
+    {
+        ZSTD_inBuffer ib = {in, std::size_t(in_end - in), 0};
+        ZSTD_outBuffer ob = {out, std::size_t(out_end - out), 0};
+        ZSTD_EndDirective op
+            = f == finish ? ZSTD_e_end : f == sync_flush ? ZSTD_e_flush : ZSTD_e_continue;
+        // Returns the amount of data still buffered in the context when flushing
+        std::size_t remaining = ZSTD_compressStream2(ctx_, &ob, &ib, op);
+        in += ib.pos;
+        out += ob.pos;
+        if (ZSTD_isError(remaining)) return error;
+        if (f == no_flush) return in == in_end ? done : more;
+        return (remaining == 0 && in == in_end) ? done : more;
+    }
+
+private:
+    ZSTD_CCtx* ctx_;
+};
+
+class zstd_decompressor : public codec
+{
+public:
+    zstd_decompressor() : ctx_(ZSTD_createDCtx())
+    {
+        if (!ctx_)
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(boost::system::errc::not_enough_memory)));
+    }
+
+    ~zstd_decompressor() { ZSTD_freeDCtx(ctx_); }
+
+    result decompress(const char*& in, const char* in_end, char*& out, char* out_end) override
+    {
+        ZSTD_inBuffer ib = {in, std::size_t(in_end - in), 0};
+        ZSTD_outBuffer ob = {out, std::size_t(out_end - out), 0};
+        // Stops at the end of a frame, the context then starts over with the next one
+        std::size_t ret = ZSTD_decompressStream(ctx_, &ob, &ib);
+        in += ib.pos;
+        out += ob.pos;
+        if (ZSTD_isError(ret)) return error;
+        return ret == 0 ? done : more;
+    }
+
+private:
+    ZSTD_DCtx* ctx_;
+};
+#endif
+
+#ifdef HAVE_LZ4
+// LZ4F_HEADER_SIZE_MAX, only public since lz4 1.9
+constexpr std::size_t lz4_header_size_max = 19;
+
+class lz4_compressor : public codec
+{
+public:
+    lz4_compressor(int level) : ctx_(0), started_(false), flushed_(false), staged_pos_(0)
+    {
+        if (LZ4F_isError(LZ4F_createCompressionContext(&ctx_, LZ4F_VERSION)))
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(boost::system::errc::not_enough_memory)));
+        prefs_ = LZ4F_preferences_t();
+        prefs_.frameInfo.blockSizeID = LZ4F_max64KB;
+        prefs_.compressionLevel = level < 0 ? 0 : level;
+    }
+
+    ~lz4_compressor() { LZ4F_freeCompressionContext(ctx_); }
+
+    // LZ4F wants room for the worst case of every call, output is staged and copied out
+    result compress(
+        const char*& in, const char* in_end, char*& out, char* out_end, flush_type f) override
+    {
+        for (;;) {
+            std::size_t n = std::min(staged_.size() - staged_pos_, std::size_t(out_end - out));
+            std::copy(staged_.data() + staged_pos_, staged_.data() + staged_pos_ + n, out);
+            out += n;
+            staged_pos_ += n;
+            if (staged_pos_ < staged_.size()) return more;
+            staged_.clear();
+            staged_pos_ = 0;
+            if (flushed_) {
+                // The flush or the end of frame staged before is out
+                flushed_ = false;
+                return done;
+            }
+            if (!started_) {
+                staged_.resize(lz4_header_size_max);
+                std::size_t r = LZ4F_compressBegin(ctx_, staged_.data(), staged_.size(), &prefs_);
+                if (LZ4F_isError(r)) return error;
+                staged_.resize(r);
+                started_ = true;
+                continue;
+            }
+            if (in != in_end) {
+                std::size_t chunk = std::min(std::size_t(in_end - in), std::size_t(64 * 1024));
+                staged_.resize(LZ4F_compressBound(chunk, &prefs_));
+                std::size_t r
+                    = LZ4F_compressUpdate(ctx_, staged_.data(), staged_.size(), in, chunk, 0);
+                if (LZ4F_isError(r)) return error;
+                staged_.resize(r);
+                in += chunk;
+                continue;
+            }
+            if (f == no_flush) return done;
+            staged_.resize(LZ4F_compressBound(0, &prefs_));
+            std::size_t r = f == finish
+                                ? LZ4F_compressEnd(ctx_, staged_.data(), staged_.size(), 0)
+                                : LZ4F_flush(ctx_, staged_.data(), staged_.size(), 0);
+            if (LZ4F_isError(r)) return error;
+            staged_.resize(r);
+            if (f == finish) started_ = false;
+            flushed_ = true;
+        }
+    }
+
+private:
+    LZ4F_cctx* ctx_;
+    LZ4F_preferences_t prefs_;
+    bool started_;
+    bool flushed_;
+    std::vector<char> staged_;
+    std::size_t staged_pos_;
+};
+
+class lz4_decompressor : public codec
+{
+public:
+    lz4_decompressor() : ctx_(0)
+    {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx_, LZ4F_VERSION)))
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(boost::system::errc::not_enough_memory)));
+    }
+
+    ~lz4_decompressor() { LZ4F_freeDecompressionContext(ctx_); }
+
+    result decompress(const char*& in, const char* in_end, char*& out, char* out_end) override
+    {
+        std::size_t in_size = in_end - in;
+        std::size_t out_size = out_end - out;
+        // Returns 0 once a frame is fully decoded, the context is then reset by LZ4F
+        std::size_t ret = LZ4F_decompress(ctx_, out, &out_size, in, &in_size, 0);
+        in += in_size;
+        out += out_size;
+        if (LZ4F_isError(ret)) return error;
+        return ret == 0 ? done : more;
+    }
+
+private:
+    LZ4F_dctx* ctx_;
+};
+#endif
+
+} // End of anonymous namespace
+
+bool compression_supported(compression c)
+{
+    switch (c) {
+#ifdef HAVE_ZLIB
+    case compression::deflate:
+    case compression::gzip:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case compression::zstd:
+        return true;
+#endif
+#ifdef HAVE_LZ4
+    case compression::lz4:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+std::unique_ptr<codec> make_compressor(compression c, int level)
+{
+    switch (c) {
+#ifdef HAVE_ZLIB
+    case compression::deflate:
+    case compression::gzip:
+        return std::unique_ptr<codec>(
+            new zlib_compressor(c == compression::gzip, level < 0 ? Z_DEFAULT_COMPRESSION : level));
+#endif
+#ifdef HAVE_ZSTD
+    case compression::zstd:
+        return std::unique_ptr<codec>(new zstd_compressor(level));
+#endif
+#ifdef HAVE_LZ4
+    case compression::lz4:
+        return std::unique_ptr<codec>(new lz4_compressor(level));
+#endif
+    default:
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(boost::system::errc::not_supported)));
+    }
+}
+
+std::unique_ptr<codec> make_decompressor(compression c)
+{
+    switch (c) {
+#ifdef HAVE_ZLIB
+    case compression::deflate:
+    case compression::gzip:
+        return std::unique_ptr<codec>(new zlib_decompressor(c == compression::gzip));
+#endif
+#ifdef HAVE_ZSTD
+    case compression::zstd:
+        return std::unique_ptr<codec>(new zstd_decompressor());
+#endif
+#ifdef HAVE_LZ4
+    case compression::lz4:
+        return std::unique_ptr<codec>(new lz4_decompressor());
+#endif
+    default:
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(boost::system::errc::not_supported)));
+    }
+}
+
+} // End of namespace detail
+
+compressed_streambuf::compressed_streambuf(std::streambuf* next,
+                                           compression c,
+                                           int level,
+                                           std::size_t buffer_size)
+: next_(next), compression_(c), level_(level), buffer_size_(buffer_size)
+{
+    if (!detail::compression_supported(c))
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(boost::system::errc::not_supported)));
+}
+
+compressed_streambuf::~compressed_streambuf()
+{
+    try {
+        if (in_message_ || pptr() != pbase()) finish();
+    } catch (...) {
+    }
+}
+
+bool compressed_streambuf::finish()
+{
+    if (!compressor_) return true;
+    if (!compress_out(detail::codec::finish)) return false;
+    in_message_ = false;
+    return next_->pubsync() == 0;
+}
+
+compressed_streambuf::int_type compressed_streambuf::overflow(int_type c)
+{
+    if (!compressor_) {
+        compressor_ = detail::make_compressor(compression_, level_);
+        put_buffer_.acquire(buffer_size_);
+        out_buffer_.acquire(buffer_size_);
+        setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
+    } else if (!compress_out(detail::codec::no_flush)) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int compressed_streambuf::sync()
+{
+    if (!compressor_ || (!in_message_ && pptr() == pbase())) return 0;
+    if (!compress_out(detail::codec::sync_flush)) return -1;
+    return next_->pubsync();
+}
+
+bool compressed_streambuf::compress_out(detail::codec::flush_type f)
+{
+    const char* in = pbase();
+    const char* in_end = pptr();
+    if (in != in_end) in_message_ = true;
+    // Nothing to end when no data went in since the last message
+    if (f != detail::codec::no_flush && !in_message_) return true;
+    for (;;) {
+        char* out = out_buffer_.data();
+        detail::codec::result r
+            = compressor_->compress(in, in_end, out, out_buffer_.data() + out_buffer_.size(), f);
+        if (r == detail::codec::error) return false;
+        std::streamsize n = out - out_buffer_.data();
+        if (n > 0 && next_->sputn(out_buffer_.data(), n) != n) return false;
+        if (r == detail::codec::done) break;
+    }
+    setp(pbase(), epptr());
+    return true;
+}
+
+compressed_streambuf::int_type compressed_streambuf::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (failed_) return traits_type::eof();
+    if (!decompressor_) {
+        decompressor_ = detail::make_decompressor(compression_);
+        get_buffer_.acquire(buffer_size_);
+        in_buffer_.acquire(buffer_size_);
+    }
+    for (;;) {
+        if (in_pos_ == in_end_) {
+            // Blocks only when nothing is buffered below, then takes whatever is there
+            if (traits_type::eq_int_type(next_->sgetc(), traits_type::eof())) {
+                // Ending in the middle of a message means the data is truncated
+                failed_ = reading_message_;
+                return traits_type::eof();
+            }
+            std::streamsize avail = std::max<std::streamsize>(next_->in_avail(), 1);
+            std::streamsize n = next_->sgetn(
+                in_buffer_.data(), std::min<std::streamsize>(avail, in_buffer_.size()));
+            in_pos_ = in_buffer_.data();
+            in_end_ = in_pos_ + n;
+        }
+        char* out = get_buffer_.data();
+        detail::codec::result r = decompressor_->decompress(
+            in_pos_, in_end_, out, get_buffer_.data() + get_buffer_.size());
+        if (r == detail::codec::error) {
+            failed_ = true;
+            return traits_type::eof();
+        }
+        reading_message_ = (r != detail::codec::done);
+        if (out != get_buffer_.data()) {
+            setg(get_buffer_.data(), get_buffer_.data(), out);
+            return traits_type::to_int_type(*gptr());
+        }
+    }
+}
+
+} // End of namespace stream
+} // End of namespace fibio
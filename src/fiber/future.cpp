@@ -6,7 +6,22 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+#include <fibio/fibers/detail/forward.hpp>
 #include <fibio/fibers/exceptions.hpp>
+#include <fibio/fibers/fiber.hpp>
+#include <fibio/fibers/future/oneshot.hpp>
+#include <fibio/fibers/future/pooled_allocator.hpp>
+#include "fiber_object.hpp"
 
 namespace fibio {
 namespace fibers {
@@ -41,5 +56,234 @@ boost::system::error_category const& future_category() noexcept
     return cat;
 }
 
+namespace detail {
+
+void oneshot_state_base::publish()
+{
+    switch (state_.exchange(READY, std::memory_order_acq_rel)) {
+    case WAITING: {
+        fiber_base::ptr_t w(std::move(waiter_));
+        w->resume();
+        break;
+    }
+    case THREAD_WAITING:
+        thread_notify();
+        break;
+    default:
+        break;
+    }
+}
+
+bool oneshot_state_base::cancel_wait()
+{
+    // Fails if the producer has already taken the waiter
+    int expected = WAITING;
+    return state_.compare_exchange_strong(expected, EMPTY, std::memory_order_acq_rel);
+}
+
+bool oneshot_state_base::begin_wait(int waiting_state)
+{
+    // A thread may have given up waiting with timeout, the state can still be THREAD_WAITING
+    int expected = state_.load(std::memory_order_acquire);
+    while (expected != READY) {
+        if (state_.compare_exchange_weak(expected, waiting_state, std::memory_order_acq_rel))
+            return true;
+    }
+    return false;
+}
+
+void oneshot_state_base::wait()
+{
+    if (ready()) return;
+    if (!this_fiber::is_a_fiber()) {
+        thread_wait();
+        return;
+    }
+    fiber_ptr_t tf = current_fiber_ptr();
+    waiter_ = tf;
+    if (begin_wait(WAITING)) {
+        // The producer resumes this fiber via strand post, which cannot run before pause()
+        tf->pause();
+    } else {
+        waiter_.reset();
+    }
+}
+
+future_status oneshot_state_base::wait_until(std::chrono::steady_clock::time_point timeout_time)
+{
+    if (ready()) return future_status::ready;
+    if (!this_fiber::is_a_fiber()) return thread_wait_until(timeout_time);
+    fiber_ptr_t tf = current_fiber_ptr();
+    waiter_ = tf;
+    if (!begin_wait(WAITING)) {
+        waiter_.reset();
+        return future_status::ready;
+    }
+    timer_t t(tf->get_io_service());
+    t.expires_at(timeout_time);
+    // Keep the state alive until the handler runs, the timer may fire after the value is set
+    boost::intrusive_ptr<oneshot_state_base> self(this);
+    t.async_wait([self](boost::system::error_code ec) {
+        if (!ec && self->cancel_wait()) {
+            fiber_base::ptr_t w(std::move(self->waiter_));
+            w->resume();
+        }
+    });
+    tf->pause();
+    return ready() ? future_status::ready : future_status::timeout;
+}
+
+#if defined(__linux__)
+namespace {
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int word");
+
+inline int* futex_word(std::atomic<int>& a) { return reinterpret_cast<int*>(&a); }
+
+} // End of anonymous namespace
+
+void oneshot_state_base::thread_wait()
+{
+    if (!begin_wait(THREAD_WAITING)) return;
+    while (!ready()) {
+        ::syscall(SYS_futex, futex_word(state_), FUTEX_WAIT_PRIVATE, THREAD_WAITING, 0, 0, 0);
+    }
+}
+
+future_status
+oneshot_state_base::thread_wait_until(std::chrono::steady_clock::time_point timeout_time)
+{
+    if (!begin_wait(THREAD_WAITING)) return future_status::ready;
+    while (!ready()) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= timeout_time) return future_status::timeout;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout_time - now).count();
+        struct timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        ::syscall(SYS_futex, futex_word(state_), FUTEX_WAIT_PRIVATE, THREAD_WAITING, &ts, 0, 0);
+    }
+    return future_status::ready;
+}
+
+void oneshot_state_base::thread_notify()
+{
+    ::syscall(SYS_futex, futex_word(state_), FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+}
+#else
+namespace {
+
+// Threads waiting on oneshot states park here, wake-ups are rare enough to share one
+std::mutex& parking_mutex()
+{
+    static std::mutex m;
+    return m;
+}
+
+std::condition_variable& parking_cv()
+{
+    static std::condition_variable cv;
+    return cv;
+}
+
+} // End of anonymous namespace
+
+void oneshot_state_base::thread_wait()
+{
+    if (!begin_wait(THREAD_WAITING)) return;
+    std::unique_lock<std::mutex> lk(parking_mutex());
+    parking_cv().wait(lk, [this]() { return ready(); });
+}
+
+future_status
+oneshot_state_base::thread_wait_until(std::chrono::steady_clock::time_point timeout_time)
+{
+    if (!begin_wait(THREAD_WAITING)) return future_status::ready;
+    std::unique_lock<std::mutex> lk(parking_mutex());
+    return parking_cv().wait_until(lk, timeout_time, [this]() { return ready(); })
+               ? future_status::ready
+               : future_status::timeout;
+}
+
+void oneshot_state_base::thread_notify()
+{
+    // Lock to make sure the waiter either sees READY or is already blocked
+    { std::lock_guard<std::mutex> lk(parking_mutex()); }
+    parking_cv().notify_all();
+}
+#endif
+
+namespace {
+
+// Size classes are multiples of 16 bytes up to 512 bytes
+constexpr std::size_t pool_granularity = 16;
+constexpr std::size_t pool_classes = 32;
+// Bound the memory parked in each free list
+constexpr std::size_t pool_max_cached = 1024;
+
+struct block_pool
+{
+    struct node
+    {
+        node* next;
+    };
+
+    node* heads_[pool_classes] = {};
+    std::size_t counts_[pool_classes] = {};
+
+    ~block_pool()
+    {
+        for (auto head : heads_) {
+            while (head) {
+                node* n = head;
+                head = head->next;
+                ::operator delete(n);
+            }
+        }
+    }
+
+    static block_pool& instance()
+    {
+        static thread_local block_pool pool;
+        return pool;
+    }
+};
+
+inline std::size_t size_class(std::size_t size)
+{
+    return (size + pool_granularity - 1) / pool_granularity - 1;
+}
+
+} // End of anonymous namespace
+
+void* pool_allocate(std::size_t size)
+{
+    std::size_t c = size_class(size);
+    if (c >= pool_classes) return ::operator new(size);
+    block_pool& pool = block_pool::instance();
+    if (block_pool::node* n = pool.heads_[c]) {
+        pool.heads_[c] = n->next;
+        --pool.counts_[c];
+        return n;
+    }
+    return ::operator new((c + 1) * pool_granularity);
+}
+
+void pool_deallocate(void* p, std::size_t size) noexcept
+{
+    std::size_t c = size_class(size);
+    block_pool& pool = block_pool::instance();
+    if (c >= pool_classes || pool.counts_[c] >= pool_max_cached) {
+        ::operator delete(p);
+        return;
+    }
+    block_pool::node* n = static_cast<block_pool::node*>(p);
+    n->next = pool.heads_[c];
+    pool.heads_[c] = n;
+    ++pool.counts_[c];
+}
+
+} // End of namespace detail
+
 } // End of namespace fibers
 } // End of namespace fibio
@@ -0,0 +1,507 @@
+//
+//  io_uring.cpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#include <cerrno>
+#if defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#endif
+#if defined(HAVE_IO_URING) && defined(IORING_FEAT_RW_CUR_POS)
+#define FIBIO_USE_IO_URING 1
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#include <fibio/fibers/fiber.hpp>
+#include <fibio/fibers/future/oneshot.hpp>
+#include <fibio/stream/fstream.hpp>
+
+namespace fibio {
+namespace stream {
+namespace detail {
+
+#if defined(FIBIO_USE_IO_URING)
+
+namespace {
+
+constexpr unsigned ring_entries = 256;
+constexpr unsigned fixed_buffer_slots = 64;
+// `len` of an SQE is 32 bits
+constexpr std::size_t max_request_size = std::size_t(1) << 30;
+
+struct request
+{
+    fibers::oneshot_promise<std::ptrdiff_t> promise_;
+    // Links in the list of outstanding requests, `linked_` is false once the result is set
+    request* prev_ = nullptr;
+    request* next_ = nullptr;
+    bool linked_ = false;
+    // Heap allocated and deleted with the result, otherwise it lives on the waiter's stack
+    bool detached_ = false;
+};
+
+// Backs off without holding any lock, a fiber sleeps so others on the same thread go on
+void park(unsigned attempt)
+{
+    std::chrono::microseconds d(1u << std::min(attempt, 10u));
+    if (this_fiber::is_a_fiber())
+        this_fiber::sleep_for(d);
+    else
+        std::this_thread::sleep_for(d);
+}
+
+/**
+ * One ring per process, requests are submitted by the calling fiber or thread and completions
+ * are reaped by a dedicated thread, which resumes the waiter with the result
+ *
+ * If the ring breaks, all outstanding requests fail with the error and the ring is no longer
+ * available, files opened afterwards and requests submitted afterwards go through the executor.
+ */
+class ring
+{
+public:
+    static ring* instance()
+    {
+        static ring r;
+        return (r.fd_ >= 0 && !r.failed_.load(std::memory_order_acquire)) ? &r : nullptr;
+    }
+
+    ~ring()
+    {
+        if (fd_ < 0) return;
+        if (reaper_.joinable()) {
+            // A NOP with no request attached tells the reaper to exit, a reaper that cannot be
+            // reached is left alone together with the ring it uses
+            if (push_sqe(IORING_OP_NOP, -1, 0, 0, 0, -1, 0)) {
+                reaper_.detach();
+                return;
+            }
+            reaper_.join();
+        }
+        ::munmap(sqes_, sqes_size_);
+        if (cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+        ::munmap(sq_ptr_, sq_size_);
+        ::close(fd_);
+    }
+
+    /// Returns the result of the operation, or -EBUSY if the ring is saturated
+    std::ptrdiff_t submit(unsigned char opcode,
+                          int fd,
+                          const void* buf,
+                          std::size_t len,
+                          std::int64_t offset,
+                          int buf_index)
+    {
+        request req;
+        fibers::oneshot_future<std::ptrdiff_t> f = req.promise_.get_future();
+        if (int err = start(&req, opcode, fd, buf, len, offset, buf_index)) return err;
+        return f.get();
+    }
+
+    /// Returns an empty future if the ring is saturated or broken
+    fibers::oneshot_future<std::ptrdiff_t> submit_async(unsigned char opcode,
+                                                        int fd,
+                                                        const void* buf,
+                                                        std::size_t len,
+                                                        std::int64_t offset,
+                                                        int buf_index)
+    {
+        std::unique_ptr<request> req(new request);
+        req->detached_ = true;
+        fibers::oneshot_future<std::ptrdiff_t> f = req->promise_.get_future();
+        if (start(req.get(), opcode, fd, buf, len, offset, buf_index))
+            return fibers::oneshot_future<std::ptrdiff_t>();
+        // Owned by the ring until it completes
+        req.release();
+        return f;
+    }
+
+    int register_buffer(void* p, std::size_t len)
+    {
+        std::lock_guard<std::mutex> lock(slots_mutex_);
+        if (free_slots_.empty()) return -1;
+        int index = free_slots_.back();
+        struct iovec iov = {p, len};
+        if (update_slot(index, &iov) < 0) return -1;
+        free_slots_.pop_back();
+        return index;
+    }
+
+    void unregister_buffer(int index)
+    {
+        std::lock_guard<std::mutex> lock(slots_mutex_);
+        struct iovec iov = {0, 0};
+        update_slot(index, &iov);
+        free_slots_.push_back(index);
+    }
+
+private:
+    ring()
+    {
+        struct io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd_ = int(::syscall(__NR_io_uring_setup, ring_entries, &p));
+        if (fd_ < 0) return;
+        // Reads and writes at the current file position need 5.6
+        if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+            ::close(fd_);
+            fd_ = -1;
+            return;
+        }
+        sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        sq_ptr_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single ? sq_ptr_ : map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+        if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            if (sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_size_);
+            if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+            if (sq_ptr_ != MAP_FAILED) ::munmap(sq_ptr_, sq_size_);
+            ::close(fd_);
+            fd_ = -1;
+            return;
+        }
+        char* sq = static_cast<char*>(sq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        char* cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_entries_ = p.sq_entries;
+        cq_entries_ = p.cq_entries;
+        register_slots();
+        reaper_ = std::thread([this]() { reap(); });
+    }
+
+    void* map(std::size_t size, off_t offset)
+    {
+        return ::mmap(
+            0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+    }
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return int(::syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags, 0, 0));
+    }
+
+    // Registered buffers skip page pinning on every request, slots are created empty and
+    // filled by `register_buffer`, files work without them on older kernels
+    void register_slots()
+    {
+#if defined(IORING_RSRC_REGISTER_SPARSE)
+        struct io_uring_rsrc_register r;
+        std::memset(&r, 0, sizeof(r));
+        r.nr = fixed_buffer_slots;
+        r.flags = IORING_RSRC_REGISTER_SPARSE;
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS2, &r, sizeof(r)) < 0)
+            return;
+        for (unsigned i = fixed_buffer_slots; i > 0; i--) free_slots_.push_back(int(i - 1));
+#endif
+    }
+
+    int update_slot(int index, struct iovec* iov)
+    {
+#if defined(IORING_RSRC_REGISTER_SPARSE)
+        struct io_uring_rsrc_update2 u;
+        std::memset(&u, 0, sizeof(u));
+        u.offset = unsigned(index);
+        u.data = reinterpret_cast<std::uint64_t>(iov);
+        u.nr = 1;
+        return int(
+            ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS_UPDATE, &u, sizeof(u)));
+#else
+        return -1;
+#endif
+    }
+
+    /**
+     * Returns -EBUSY or -ENOSYS if `req` is not taken, otherwise its result is set on completion,
+     * or when the ring breaks
+     */
+    int start(request* req,
+              unsigned char opcode,
+              int fd,
+              const void* buf,
+              std::size_t len,
+              std::int64_t offset,
+              int buf_index)
+    {
+        if (inflight_.fetch_add(1, std::memory_order_relaxed) >= cq_entries_) {
+            inflight_.fetch_sub(1, std::memory_order_relaxed);
+            return -EBUSY;
+        }
+        if (!link(req)) {
+            inflight_.fetch_sub(1, std::memory_order_relaxed);
+            return -ENOSYS;
+        }
+        if (int err = push_sqe(opcode, fd, buf, len, offset, buf_index, req)) fail(err);
+        return 0;
+    }
+
+    /**
+     * Fills an SQE under `sq_mutex_` and submits it without the lock, returns 0 or an errno value
+     *
+     * Every caller submits the SQE it filled, the kernel takes them in order so one `enter` may
+     * submit the SQE of another caller, which then submits the next one.
+     */
+    int push_sqe(unsigned char opcode,
+                 int fd,
+                 const void* buf,
+                 std::size_t len,
+                 std::int64_t offset,
+                 int buf_index,
+                 request* req)
+    {
+        for (unsigned attempt = 0;; attempt++) {
+            {
+                std::lock_guard<std::mutex> lock(sq_mutex_);
+                unsigned tail = *sq_tail_;
+                if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) < sq_entries_) {
+                    unsigned index = tail & sq_mask_;
+                    struct io_uring_sqe& sqe = sqes_[index];
+                    std::memset(&sqe, 0, sizeof(sqe));
+                    sqe.opcode = opcode;
+                    sqe.fd = fd;
+                    sqe.addr = reinterpret_cast<std::uint64_t>(buf);
+                    sqe.len = unsigned(std::min(len, max_request_size));
+                    sqe.off = std::uint64_t(offset);
+                    if (buf_index >= 0) sqe.buf_index = std::uint16_t(buf_index);
+                    sqe.user_data = reinterpret_cast<std::uint64_t>(req);
+                    sq_array_[index] = index;
+                    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+                    break;
+                }
+            }
+            // The SQ is full of entries other callers are about to submit
+            park(attempt);
+        }
+        for (unsigned attempt = 0;; attempt++) {
+            if (enter(1, 0, 0) >= 0) return 0;
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EBUSY) return errno;
+            // Out of kernel resources or the CQ is full, the reaper frees some meanwhile
+            park(attempt);
+        }
+    }
+
+    // Adds a request to the outstanding list, false if the ring is broken
+    bool link(request* req)
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex_);
+        if (failed_) return false;
+        req->prev_ = nullptr;
+        req->next_ = outstanding_;
+        if (outstanding_) outstanding_->prev_ = req;
+        outstanding_ = req;
+        req->linked_ = true;
+        return true;
+    }
+
+    // Must be called with requests_mutex_ held
+    void unlink(request* req)
+    {
+        if (req->prev_)
+            req->prev_->next_ = req->next_;
+        else
+            outstanding_ = req->next_;
+        if (req->next_) req->next_->prev_ = req->prev_;
+        req->linked_ = false;
+    }
+
+    void complete(request* req, int res)
+    {
+        std::unique_lock<std::mutex> lock(requests_mutex_);
+        // Already failed by `fail`
+        if (!req->linked_) return;
+        unlink(req);
+        // The request may live on the waiter's stack, take the promise before waking it up
+        fibers::oneshot_promise<std::ptrdiff_t> p(std::move(req->promise_));
+        std::unique_ptr<request> owned(req->detached_ ? req : nullptr);
+        lock.unlock();
+        inflight_.fetch_sub(1, std::memory_order_relaxed);
+        p.set_value(res);
+    }
+
+    // Marks the ring unavailable and fails all outstanding requests with `-err`
+    void fail(int err)
+    {
+        std::vector<fibers::oneshot_promise<std::ptrdiff_t>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(requests_mutex_);
+            failed_.store(true, std::memory_order_release);
+            while (request* req = outstanding_) {
+                unlink(req);
+                waiters.emplace_back(std::move(req->promise_));
+                if (req->detached_) delete req;
+            }
+        }
+        inflight_.fetch_sub(unsigned(waiters.size()), std::memory_order_relaxed);
+        for (auto& p : waiters) p.set_value(-err);
+    }
+
+    void reap()
+    {
+        for (;;) {
+            if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                fail(errno);
+                return;
+            }
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            bool stop = false;
+            for (; head != tail; head++) {
+                const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+                request* req = reinterpret_cast<request*>(cqe.user_data);
+                if (!req) {
+                    stop = true;
+                    continue;
+                }
+                complete(req, cqe.res);
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            if (stop) return;
+        }
+    }
+
+    int fd_ = -1;
+    void* sq_ptr_ = MAP_FAILED;
+    void* cq_ptr_ = MAP_FAILED;
+    struct io_uring_sqe* sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    std::size_t sq_size_ = 0;
+    std::size_t cq_size_ = 0;
+    std::size_t sqes_size_ = 0;
+    unsigned* sq_head_ = 0;
+    unsigned* sq_tail_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = 0;
+    unsigned* cq_head_ = 0;
+    unsigned* cq_tail_ = 0;
+    unsigned cq_mask_ = 0;
+    struct io_uring_cqe* cqes_ = 0;
+    unsigned cq_entries_ = 0;
+    std::atomic<unsigned> inflight_{0};
+    std::atomic<bool> failed_{false};
+    std::mutex sq_mutex_;
+    std::mutex requests_mutex_;
+    request* outstanding_ = nullptr;
+    std::mutex slots_mutex_;
+    std::vector<int> free_slots_;
+    std::thread reaper_;
+};
+
+} // End of anonymous namespace
+
+bool uring_available()
+{
+    return ring::instance() != nullptr;
+}
+
+std::ptrdiff_t
+uring_read(int fd, void* buf, std::size_t len, std::int64_t offset, int buf_index)
+{
+    ring* r = ring::instance();
+    if (!r) return -ENOSYS;
+    return r->submit(buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ,
+                     fd,
+                     buf,
+                     len,
+                     offset,
+                     buf_index);
+}
+
+fibers::oneshot_future<std::ptrdiff_t>
+uring_read_async(int fd, void* buf, std::size_t len, std::int64_t offset, int buf_index)
+{
+    ring* r = ring::instance();
+    if (!r) return fibers::oneshot_future<std::ptrdiff_t>();
+    return r->submit_async(buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ,
+                           fd,
+                           buf,
+                           len,
+                           offset,
+                           buf_index);
+}
+
+std::ptrdiff_t
+uring_write(int fd, const void* buf, std::size_t len, std::int64_t offset, int buf_index)
+{
+    ring* r = ring::instance();
+    if (!r) return -ENOSYS;
+    return r->submit(buf_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+                     fd,
+                     buf,
+                     len,
+                     offset,
+                     buf_index);
+}
+
+int uring_register_buffer(void* p, std::size_t len)
+{
+    ring* r = ring::instance();
+    return r ? r->register_buffer(p, len) : -1;
+}
+
+void uring_unregister_buffer(int index)
+{
+    if (index < 0) return;
+    if (ring* r = ring::instance()) r->unregister_buffer(index);
+}
+
+#else
+
+bool uring_available()
+{
+    return false;
+}
+
+std::ptrdiff_t uring_read(int, void*, std::size_t, std::int64_t, int)
+{
+    return -ENOSYS;
+}
+
+fibers::oneshot_future<std::ptrdiff_t>
+uring_read_async(int, void*, std::size_t, std::int64_t, int)
+{
+    return fibers::oneshot_future<std::ptrdiff_t>();
+}
+
+std::ptrdiff_t uring_write(int, const void*, std::size_t, std::int64_t, int)
+{
+    return -ENOSYS;
+}
+
+int uring_register_buffer(void*, std::size_t)
+{
+    return -1;
+}
+
+void uring_unregister_buffer(int)
+{
+}
+
+#endif
+
+} // End of namespace detail
+} // End of namespace stream
+} // End of namespace fibio
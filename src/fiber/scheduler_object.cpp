@@ -46,8 +46,13 @@ fiber_ptr_t scheduler_object::make_fiber(std::shared_ptr<boost::asio::strand> s,
     return ret;
 }
 
-static inline void run_in_this_thread(scheduler_ptr_t pthis)
+namespace {
+thread_local size_t current_worker_index_ = size_t(-1);
+} // End of anonymous namespace
+
+static inline void run_in_this_thread(scheduler_ptr_t pthis, size_t index)
 {
+    current_worker_index_ = index;
     pthis->io_service_.run();
 }
 
@@ -65,7 +70,7 @@ void scheduler_object::start(size_t nthr)
     check_timer->async_wait(
         std::bind(&scheduler_object::on_check_timer, pthis, std::placeholders::_1));
     for (size_t i = 0; i < nthr; i++) {
-        threads_.push_back(std::thread(run_in_this_thread, pthis));
+        threads_.push_back(std::thread(run_in_this_thread, pthis, threads_.size()));
     }
 }
 
@@ -93,7 +98,7 @@ void scheduler_object::add_thread(size_t nthr)
     std::lock_guard<std::mutex> guard(mtx_);
     scheduler_ptr_t pthis(shared_from_this());
     for (size_t i = 0; i < nthr; i++) {
-        threads_.push_back(std::thread(std::bind(run_in_this_thread, pthis)));
+        threads_.push_back(std::thread(std::bind(run_in_this_thread, pthis, threads_.size())));
     }
 }
 
@@ -169,6 +174,11 @@ size_t scheduler::worker_pool_size() const
     return impl_->worker_pool_size();
 }
 
+size_t scheduler::current_worker_index()
+{
+    return detail::current_worker_index_;
+}
+
 scheduler scheduler::get_instance()
 {
     return scheduler(detail::scheduler_object::get_instance());
@@ -0,0 +1,580 @@
+//
+//  ssl.cpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
+#include <boost/system/system_error.hpp>
+#include <fibio/stream/ssl.hpp>
+
+namespace fibio {
+namespace ssl {
+
+namespace {
+
+int session_cache_index()
+{
+    static int index = SSL_CTX_get_ex_new_index(0, 0, 0, 0, 0);
+    return index;
+}
+
+int ticket_keys_index()
+{
+    static int index = SSL_CTX_get_ex_new_index(0, 0, 0, 0, 0);
+    return index;
+}
+
+int client_session_cache_index()
+{
+    static int index = SSL_CTX_get_ex_new_index(0, 0, 0, 0, 0);
+    return index;
+}
+
+void free_peer(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+{
+    delete static_cast<std::string*>(ptr);
+}
+
+// Key of the client session cache, set on the connection by `ssl_client_resume`
+int peer_index()
+{
+    static int index = SSL_get_ex_new_index(0, 0, 0, 0, free_peer);
+    return index;
+}
+
+/**
+ * Sessions by key in LRU order, every entry holds a reference of the session
+ */
+class session_lru
+{
+public:
+    explicit session_lru(std::size_t capacity) : capacity_(std::max<std::size_t>(capacity, 1)) {}
+
+    ~session_lru() { clear(); }
+
+    /// Takes the reference of `s`
+    void put(const std::string& key, SSL_SESSION* s)
+    {
+        SSL_SESSION* evicted = 0;
+        SSL_SESSION* replaced = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            auto i = index_.find(key);
+            if (i != index_.end()) {
+                replaced = i->second->second;
+                i->second->second = s;
+                lru_.splice(lru_.begin(), lru_, i->second);
+            } else {
+                lru_.emplace_front(key, s);
+                index_.emplace(key, lru_.begin());
+                if (lru_.size() > capacity_) {
+                    evicted = lru_.back().second;
+                    index_.erase(lru_.back().first);
+                    lru_.pop_back();
+                }
+            }
+        }
+        // Freed out of the lock, the last reference may take a while
+        if (replaced) SSL_SESSION_free(replaced);
+        if (evicted) SSL_SESSION_free(evicted);
+    }
+
+    /// Returns a new reference of the session, or null
+    SSL_SESSION* get(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        auto i = index_.find(key);
+        if (i == index_.end()) return 0;
+        lru_.splice(lru_.begin(), lru_, i->second);
+        SSL_SESSION_up_ref(i->second->second);
+        return i->second->second;
+    }
+
+    /// Removes the entry of `key`, only if it is `s` when `s` is not null
+    void erase(const std::string& key, SSL_SESSION* s = 0)
+    {
+        SSL_SESSION* removed = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            auto i = index_.find(key);
+            if (i == index_.end() || (s && i->second->second != s)) return;
+            removed = i->second->second;
+            lru_.erase(i->second);
+            index_.erase(i);
+        }
+        SSL_SESSION_free(removed);
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return lru_.size();
+    }
+
+    void clear()
+    {
+        std::list<std::pair<std::string, SSL_SESSION*>> l;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            l.swap(lru_);
+            index_.clear();
+        }
+        for (auto& e : l) SSL_SESSION_free(e.second);
+    }
+
+private:
+    typedef std::list<std::pair<std::string, SSL_SESSION*>> list_type;
+
+    std::size_t capacity_;
+    mutable std::mutex m_;
+    list_type lru_;
+    std::unordered_map<std::string, list_type::iterator> index_;
+};
+
+std::string session_id(const SSL_SESSION* s)
+{
+    unsigned int len = 0;
+    const unsigned char* id = SSL_SESSION_get_id(s, &len);
+    return std::string(reinterpret_cast<const char*>(id), len);
+}
+
+} // End of anonymous namespace
+
+struct session_cache::impl
+{
+    impl(std::size_t capacity, std::size_t shards, std::chrono::seconds timeout)
+    : timeout_(timeout), hits_(0), misses_(0)
+    {
+        if (shards == 0) shards = 1;
+        for (std::size_t i = 0; i < shards; i++)
+            shards_.emplace_back(new session_lru((capacity + shards - 1) / shards));
+    }
+
+    session_lru& shard(const std::string& id)
+    {
+        return *shards_[std::hash<std::string>()(id) % shards_.size()];
+    }
+
+    static impl* get(SSL_CTX* ctx)
+    {
+        return static_cast<impl*>(SSL_CTX_get_ex_data(ctx, session_cache_index()));
+    }
+
+    static int new_session(SSL* ssl, SSL_SESSION* s)
+    {
+        impl* self = get(SSL_get_SSL_CTX(ssl));
+        if (!self) return 0;
+        self->shard(session_id(s)).put(session_id(s), s);
+        // The cache keeps the reference
+        return 1;
+    }
+
+    static SSL_SESSION* get_session(SSL* ssl, const unsigned char* id, int len, int* copy)
+    {
+        // The returned session holds a reference for OpenSSL already
+        *copy = 0;
+        impl* self = get(SSL_get_SSL_CTX(ssl));
+        if (!self) return 0;
+        std::string key(reinterpret_cast<const char*>(id), std::size_t(len));
+        SSL_SESSION* s = self->shard(key).get(key);
+        if (s)
+            self->hits_.fetch_add(1, std::memory_order_relaxed);
+        else
+            self->misses_.fetch_add(1, std::memory_order_relaxed);
+        return s;
+    }
+
+    static void remove_session(SSL_CTX* ctx, SSL_SESSION* s)
+    {
+        impl* self = get(ctx);
+        if (!self) return;
+        std::string key = session_id(s);
+        self->shard(key).erase(key, s);
+    }
+
+    std::chrono::seconds timeout_;
+    std::vector<std::unique_ptr<session_lru>> shards_;
+    std::atomic<std::size_t> hits_;
+    std::atomic<std::size_t> misses_;
+};
+
+session_cache::session_cache(std::size_t capacity,
+                             std::size_t shards,
+                             std::chrono::seconds timeout)
+: impl_(new impl(capacity, shards, timeout))
+{
+}
+
+session_cache::~session_cache()
+{
+}
+
+void session_cache::attach(context& ctx)
+{
+    SSL_CTX* c = ctx.native_handle();
+    SSL_CTX_set_ex_data(c, session_cache_index(), impl_.get());
+    SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_set_timeout(c, long(impl_->timeout_.count()));
+    // Resumption is refused without a session id context once client certificates are verified
+    static const unsigned char sid_ctx[] = "fibio";
+    SSL_CTX_set_session_id_context(c, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_sess_set_new_cb(c, &impl::new_session);
+    SSL_CTX_sess_set_get_cb(c, &impl::get_session);
+    SSL_CTX_sess_set_remove_cb(c, &impl::remove_session);
+}
+
+std::size_t session_cache::hits() const
+{
+    return impl_->hits_.load(std::memory_order_relaxed);
+}
+
+std::size_t session_cache::misses() const
+{
+    return impl_->misses_.load(std::memory_order_relaxed);
+}
+
+std::size_t session_cache::size() const
+{
+    std::size_t n = 0;
+    for (auto& s : impl_->shards_) n += s->size();
+    return n;
+}
+
+void session_cache::clear()
+{
+    for (auto& s : impl_->shards_) s->clear();
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX ticket_mac_ctx;
+#else
+typedef HMAC_CTX ticket_mac_ctx;
+#endif
+
+struct ticket_keys::impl
+{
+    struct key
+    {
+        unsigned char name_[16];
+        unsigned char hmac_[32];
+        unsigned char aes_[32];
+    };
+
+    impl(std::chrono::seconds rotation) : rotation_(rotation), hits_(0), misses_(0)
+    {
+        if (!generate(current_))
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(boost::system::errc::io_error)));
+        previous_ = current_;
+        created_ = std::chrono::steady_clock::now();
+    }
+
+    ~impl()
+    {
+        OPENSSL_cleanse(&current_, sizeof(current_));
+        OPENSSL_cleanse(&previous_, sizeof(previous_));
+    }
+
+    static bool generate(key& k)
+    {
+        return RAND_bytes(k.name_, sizeof(k.name_)) > 0 && RAND_bytes(k.hmac_, sizeof(k.hmac_)) > 0
+               && RAND_bytes(k.aes_, sizeof(k.aes_)) > 0;
+    }
+
+    bool due() const { return std::chrono::steady_clock::now() - created_ >= rotation_; }
+
+    /// Only rotates if the current key is expired when `if_due` is true, another thread may have
+    /// rotated it already
+    bool rotate(bool if_due)
+    {
+        key k;
+        if (!generate(k)) return false;
+        std::lock_guard<std::mutex> lock(m_);
+        if (!if_due || due()) {
+            previous_ = current_;
+            current_ = k;
+            created_ = std::chrono::steady_clock::now();
+        }
+        OPENSSL_cleanse(&k, sizeof(k));
+        return true;
+    }
+
+    static int init_mac(ticket_mac_ctx* mac, const key& k)
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        static char digest[] = "SHA256";
+        OSSL_PARAM params[]
+            = {OSSL_PARAM_construct_octet_string(
+                   OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(k.hmac_), sizeof(k.hmac_)),
+               OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+               OSSL_PARAM_construct_end()};
+        return EVP_MAC_CTX_set_params(mac, params);
+#else
+        return HMAC_Init_ex(mac, k.hmac_, sizeof(k.hmac_), EVP_sha256(), 0);
+#endif
+    }
+
+    static int callback(SSL* ssl,
+                        unsigned char* name,
+                        unsigned char* iv,
+                        EVP_CIPHER_CTX* cipher,
+                        ticket_mac_ctx* mac,
+                        int enc)
+    {
+        impl* self
+            = static_cast<impl*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ticket_keys_index()));
+        if (!self) return -1;
+        key k;
+        bool renew = false;
+        if (enc) {
+            // Rotation is checked when a ticket is issued, no timer is needed
+            bool expired;
+            {
+                std::lock_guard<std::mutex> lock(self->m_);
+                expired = self->due();
+            }
+            if (expired) self->rotate(true);
+            {
+                std::lock_guard<std::mutex> lock(self->m_);
+                k = self->current_;
+            }
+            if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0) return -1;
+            std::memcpy(name, k.name_, sizeof(k.name_));
+            int ok = EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), 0, k.aes_, iv)
+                     && init_mac(mac, k);
+            OPENSSL_cleanse(&k, sizeof(k));
+            return ok ? 1 : -1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(self->m_);
+            if (std::memcmp(name, self->current_.name_, sizeof(k.name_)) == 0) {
+                k = self->current_;
+            } else if (std::memcmp(name, self->previous_.name_, sizeof(k.name_)) == 0) {
+                k = self->previous_;
+                renew = true;
+            } else {
+                self->misses_.fetch_add(1, std::memory_order_relaxed);
+                // Unknown key, falls back to a full handshake
+                return 0;
+            }
+        }
+        int ok = EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), 0, k.aes_, iv) && init_mac(mac, k);
+        OPENSSL_cleanse(&k, sizeof(k));
+        if (!ok) return -1;
+        self->hits_.fetch_add(1, std::memory_order_relaxed);
+#if defined(TLS1_3_VERSION)
+        // A TLS 1.3 client uses a ticket only once, it needs a new one for the next resumption
+        if (SSL_version(ssl) >= TLS1_3_VERSION) renew = true;
+#endif
+        // 2 asks for a new ticket encrypted with the current key
+        return renew ? 2 : 1;
+    }
+
+    std::chrono::seconds rotation_;
+    std::mutex m_;
+    key current_;
+    key previous_;
+    std::chrono::steady_clock::time_point created_;
+    std::atomic<std::size_t> hits_;
+    std::atomic<std::size_t> misses_;
+};
+
+ticket_keys::ticket_keys(std::chrono::seconds rotation) : impl_(new impl(rotation))
+{
+}
+
+ticket_keys::~ticket_keys()
+{
+}
+
+void ticket_keys::attach(context& ctx)
+{
+    SSL_CTX* c = ctx.native_handle();
+    SSL_CTX_set_ex_data(c, ticket_keys_index(), impl_.get());
+    SSL_CTX_clear_options(c, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(c, &impl::callback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(c, &impl::callback);
+#endif
+}
+
+void ticket_keys::rotate()
+{
+    if (!impl_->rotate(false))
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(boost::system::errc::io_error)));
+}
+
+std::size_t ticket_keys::hits() const
+{
+    return impl_->hits_.load(std::memory_order_relaxed);
+}
+
+std::size_t ticket_keys::misses() const
+{
+    return impl_->misses_.load(std::memory_order_relaxed);
+}
+
+struct client_session_cache::impl
+{
+    impl(std::size_t capacity) : sessions_(capacity), hits_(0), misses_(0) {}
+
+    static impl* get(SSL_CTX* ctx)
+    {
+        return static_cast<impl*>(SSL_CTX_get_ex_data(ctx, client_session_cache_index()));
+    }
+
+    // Called at the end of a full handshake, or when a TLS 1.3 ticket arrives later
+    static int new_session(SSL* ssl, SSL_SESSION* s)
+    {
+        impl* self = get(SSL_get_SSL_CTX(ssl));
+        std::string* peer = static_cast<std::string*>(SSL_get_ex_data(ssl, peer_index()));
+        if (!self || !peer) return 0;
+        self->sessions_.put(*peer, s);
+        return 1;
+    }
+
+    session_lru sessions_;
+    std::atomic<std::size_t> hits_;
+    std::atomic<std::size_t> misses_;
+};
+
+client_session_cache::client_session_cache(std::size_t capacity) : impl_(new impl(capacity))
+{
+}
+
+client_session_cache::~client_session_cache()
+{
+}
+
+void client_session_cache::attach(context& ctx)
+{
+    SSL_CTX* c = ctx.native_handle();
+    SSL_CTX_set_ex_data(c, client_session_cache_index(), impl_.get());
+    SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(c, &impl::new_session);
+}
+
+std::size_t client_session_cache::hits() const
+{
+    return impl_->hits_.load(std::memory_order_relaxed);
+}
+
+std::size_t client_session_cache::misses() const
+{
+    return impl_->misses_.load(std::memory_order_relaxed);
+}
+
+std::size_t client_session_cache::size() const
+{
+    return impl_->sessions_.size();
+}
+
+void client_session_cache::clear()
+{
+    impl_->sessions_.clear();
+}
+
+handshake_offload::handshake_offload(std::size_t threads, std::size_t max_handshakes)
+: pool_(threads,
+        threads,
+        std::max(max_handshakes, std::size_t(fibers::foreign_thread_pool::default_queue_capacity)),
+        std::chrono::seconds(60))
+, max_handshakes_(std::max<std::size_t>(max_handshakes, 1))
+{
+}
+
+std::size_t handshake_offload::active() const
+{
+    std::lock_guard<fibers::mutex> lock(m_);
+    return active_;
+}
+
+std::size_t handshake_offload::waiting() const
+{
+    std::lock_guard<fibers::mutex> lock(m_);
+    return waiting_;
+}
+
+void handshake_offload::enter()
+{
+    std::unique_lock<fibers::mutex> lock(m_);
+    waiting_++;
+    cv_.wait(lock, [this]() { return active_ < max_handshakes_; });
+    waiting_--;
+    active_++;
+}
+
+void handshake_offload::leave()
+{
+    std::lock_guard<fibers::mutex> lock(m_);
+    active_--;
+    cv_.notify_one();
+}
+
+} // End of namespace ssl
+
+namespace stream {
+namespace detail {
+
+void ssl_client_resume(::ssl_st* ssl, const std::string& peer)
+{
+    ssl::client_session_cache::impl* cache
+        = ssl::client_session_cache::impl::get(SSL_get_SSL_CTX(ssl));
+    if (!cache) return;
+    delete static_cast<std::string*>(SSL_get_ex_data(ssl, ssl::peer_index()));
+    SSL_set_ex_data(ssl, ssl::peer_index(), new std::string(peer));
+    SSL_SESSION* s = cache->sessions_.get(peer);
+    if (!s) return;
+    // Stays in the cache until a newer session of the peer arrives
+    SSL_set_session(ssl, s);
+    SSL_SESSION_free(s);
+}
+
+void ssl_client_handshaked(::ssl_st* ssl, bool ok)
+{
+    ssl::client_session_cache::impl* cache
+        = ssl::client_session_cache::impl::get(SSL_get_SSL_CTX(ssl));
+    if (!cache || !ok) return;
+    if (SSL_session_reused(ssl))
+        cache->hits_.fetch_add(1, std::memory_order_relaxed);
+    else
+        cache->misses_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ssl_keep_session(::ssl_st* ssl)
+{
+    if (!ssl || !SSL_is_init_finished(ssl) || (SSL_get_shutdown(ssl) & SSL_SENT_SHUTDOWN)) return;
+    // Only contexts resuming through fibio keep the session of an unclean close
+    SSL_CTX* ctx = SSL_get_SSL_CTX(ssl);
+    if (!SSL_CTX_get_ex_data(ctx, ssl::session_cache_index())
+        && !SSL_CTX_get_ex_data(ctx, ssl::ticket_keys_index())
+        && !SSL_CTX_get_ex_data(ctx, ssl::client_session_cache_index()))
+        return;
+    // Quiet shutdown only sets the flags, nothing is sent
+    SSL_set_quiet_shutdown(ssl, 1);
+    SSL_shutdown(ssl);
+}
+
+} // End of namespace detail
+} // End of namespace stream
+} // End of namespace fibio
@@ -6,17 +6,408 @@
 //  Copyright (c) 2015 0d0a.com. All rights reserved.
 //
 
+#include <atomic>
+#include <cerrno>
+#include <new>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <signal.h>
+#include <sys/sendfile.h>
+#endif
+#include <fibio/stream/streambuf.hpp>
 #include <fibio/stream/fstream.hpp>
+#include <fibio/stream/mapped_fstream.hpp>
 
 namespace fibio {
 namespace stream {
+
+namespace {
+
+std::atomic<std::size_t> default_buffer_size_(1500);
+
+// Size classes are powers of 2 from 512 bytes to 64KB
+constexpr std::size_t slab_min_shift = 9;
+constexpr std::size_t slab_classes = 8;
+// Bound the memory parked in each free list, 1MB at most
+constexpr std::size_t slab_max_cached_bytes = 1024 * 1024;
+
+struct buffer_slab
+{
+    struct node
+    {
+        node* next;
+    };
+
+    node* heads_[slab_classes] = {};
+    std::size_t counts_[slab_classes] = {};
+
+    ~buffer_slab()
+    {
+        for (auto head : heads_) {
+            while (head) {
+                node* n = head;
+                head = head->next;
+                ::operator delete(n);
+            }
+        }
+    }
+
+    static buffer_slab& instance()
+    {
+        static thread_local buffer_slab slab;
+        return slab;
+    }
+};
+
+inline std::size_t slab_class(std::size_t size)
+{
+    std::size_t c = 0;
+    while (c < slab_classes && (std::size_t(1) << (c + slab_min_shift)) < size) c++;
+    return c;
+}
+
+#if defined(__linux__)
+// sendfile and splice have no MSG_NOSIGNAL, keep SIGPIPE pending on this thread and discard it
+// if a call raised one, so a peer closing the connection shows up as EPIPE instead. The mask is
+// per thread, a guard must not live across a fiber switch, callers take one per burst of
+// non-blocking calls
+struct sigpipe_guard
+{
+    sigpipe_guard()
+    {
+        sigset_t pending;
+        sigemptyset(&pending);
+        sigpending(&pending);
+        was_pending_ = sigismember(&pending, SIGPIPE);
+        if (!was_pending_) {
+            sigset_t s;
+            sigemptyset(&s);
+            sigaddset(&s, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &s, &old_);
+        }
+    }
+
+    ~sigpipe_guard()
+    {
+        if (was_pending_) return;
+        if (epipe_) {
+            sigset_t s;
+            sigemptyset(&s);
+            sigaddset(&s, SIGPIPE);
+            struct timespec zero = {0, 0};
+            while (sigtimedwait(&s, 0, &zero) < 0 && errno == EINTR) {
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old_, 0);
+    }
+
+    sigset_t old_;
+    bool was_pending_;
+    bool epipe_ = false;
+};
+#endif
+
+void set_errno_error(boost::system::error_code& ec)
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        ec = boost::asio::error::would_block;
+    else
+        ec.assign(errno, boost::system::system_category());
+}
+
+} // End of anonymous namespace
+
+void set_default_buffer_size(std::size_t size)
+{
+    default_buffer_size_.store(size, std::memory_order_relaxed);
+}
+
+std::size_t default_buffer_size()
+{
+    return default_buffer_size_.load(std::memory_order_relaxed);
+}
+
+mapped_filebuf::mapped_filebuf() : fd_(-1), data_(0), size_(0)
+{
+}
+
+mapped_filebuf::mapped_filebuf(mapped_filebuf&& other)
+: std::streambuf(other)
+, fd_(other.fd_)
+, data_(other.data_)
+, size_(other.size_)
+{
+    other.fd_ = -1;
+    other.data_ = 0;
+    other.size_ = 0;
+    other.setg(0, 0, 0);
+}
+
+mapped_filebuf::~mapped_filebuf()
+{
+    close();
+}
+
+mapped_filebuf* mapped_filebuf::open(const char* s, map_advice advice)
+{
+#if !defined(_WIN32)
+    if (is_open()) return 0;
+    // open and mmap may block on the disk
+    bool ok = (*detail::get_default_executor())([&]() {
+        int fd = ::open(s, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = 0;
+        if (st.st_size > 0) {
+            p = ::mmap(0, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                return false;
+            }
+            int adv = MADV_NORMAL;
+            switch (advice) {
+            case map_advice::normal:
+                break;
+            case map_advice::sequential:
+                adv = MADV_SEQUENTIAL;
+                break;
+            case map_advice::random:
+                adv = MADV_RANDOM;
+                break;
+            case map_advice::willneed:
+                adv = MADV_WILLNEED;
+                break;
+            }
+            // Only a hint, failure is harmless
+            ::madvise(p, std::size_t(st.st_size), adv);
+        }
+        fd_ = fd;
+        data_ = static_cast<char*>(p);
+        size_ = std::size_t(st.st_size);
+        return true;
+    });
+    if (!ok) return 0;
+    setg(data_, data_, data_ + size_);
+    return this;
+#else
+    return 0;
+#endif
+}
+
+mapped_filebuf* mapped_filebuf::close()
+{
+#if !defined(_WIN32)
+    if (!is_open()) return 0;
+    setg(0, 0, 0);
+    char* p = data_;
+    std::size_t size = size_;
+    int fd = fd_;
+    data_ = 0;
+    size_ = 0;
+    fd_ = -1;
+    // munmap may have to wait for dirty page table entries to be flushed
+    bool ok = (*detail::get_default_executor())([p, size, fd]() {
+        bool ret = true;
+        if (p && ::munmap(p, size) < 0) ret = false;
+        if (::close(fd) < 0) ret = false;
+        return ret;
+    });
+    return ok ? this : 0;
+#else
+    return 0;
+#endif
+}
+
+mapped_filebuf::pos_type
+mapped_filebuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+    if (!is_open() || !(which & std::ios_base::in)) return pos_type(off_type(-1));
+    off_type base;
+    switch (dir) {
+    case std::ios_base::beg:
+        base = 0;
+        break;
+    case std::ios_base::cur:
+        base = gptr() - eback();
+        break;
+    case std::ios_base::end:
+        base = off_type(size_);
+        break;
+    default:
+        return pos_type(off_type(-1));
+    }
+    return seekpos(pos_type(base + off), which);
+}
+
+mapped_filebuf::pos_type mapped_filebuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+    off_type off = pos;
+    if (!is_open() || !(which & std::ios_base::in) || off < 0 || off > off_type(size_))
+        return pos_type(off_type(-1));
+    setg(data_, data_ + off, data_ + size_);
+    return pos;
+}
+
 namespace detail {
 
+char* buffer_allocate(std::size_t& size)
+{
+    std::size_t c = slab_class(size);
+    if (c >= slab_classes) return static_cast<char*>(::operator new(size));
+    size = std::size_t(1) << (c + slab_min_shift);
+    buffer_slab& slab = buffer_slab::instance();
+    if (buffer_slab::node* n = slab.heads_[c]) {
+        slab.heads_[c] = n->next;
+        --slab.counts_[c];
+        return reinterpret_cast<char*>(n);
+    }
+    return static_cast<char*>(::operator new(size));
+}
+
+void buffer_deallocate(char* p, std::size_t size) noexcept
+{
+    std::size_t c = slab_class(size);
+    buffer_slab& slab = buffer_slab::instance();
+    if (c >= slab_classes || (slab.counts_[c] + 1) * size > slab_max_cached_bytes) {
+        ::operator delete(p);
+        return;
+    }
+    buffer_slab::node* n = reinterpret_cast<buffer_slab::node*>(p);
+    n->next = slab.heads_[c];
+    slab.heads_[c] = n;
+    ++slab.counts_[c];
+}
+
+std::size_t send_file_some(
+    int sock, int fd, std::uint64_t& offset, std::size_t len, boost::system::error_code& ec)
+{
+    ec.clear();
+#if defined(__linux__)
+    sigpipe_guard guard;
+    std::size_t ret = 0;
+    while (ret < len) {
+        off_t off = off_t(offset);
+        ssize_t n = ::sendfile(sock, fd, &off, len - ret);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            guard.epipe_ = (errno == EPIPE);
+            set_errno_error(ec);
+            break;
+        }
+        // End of file
+        if (n == 0) break;
+        offset = std::uint64_t(off);
+        ret += std::size_t(n);
+    }
+    return ret;
+#elif !defined(_WIN32)
+    // No zero-copy path, read a chunk and write it, the socket is non-blocking so a partial write
+    // only advances `offset` by what was sent
+#if defined(MSG_NOSIGNAL)
+    const int send_flags = MSG_NOSIGNAL;
+#else
+    const int send_flags = 0;
+#endif
+    std::size_t size = std::min<std::size_t>(len, 64 * 1024);
+    char* buf = buffer_allocate(size);
+    ssize_t n;
+    do {
+        n = ::pread(fd, buf, std::min(len, size), off_t(offset));
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        ssize_t sent;
+        do {
+            sent = ::send(sock, buf, std::size_t(n), send_flags);
+        } while (sent < 0 && errno == EINTR);
+        n = sent;
+        if (n > 0) offset += std::uint64_t(n);
+    }
+    if (n < 0) set_errno_error(ec);
+    buffer_deallocate(buf, size);
+    return n < 0 ? 0 : std::size_t(n);
+#else
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+#endif
+}
+
+kernel_pipe::kernel_pipe() : size_(0)
+{
+    fds_[0] = fds_[1] = -1;
+#if defined(__linux__)
+    if (::pipe2(fds_, O_NONBLOCK | O_CLOEXEC) < 0) fds_[0] = fds_[1] = -1;
+#endif
+}
+
+kernel_pipe::~kernel_pipe()
+{
+#if !defined(_WIN32)
+    if (fds_[0] >= 0) ::close(fds_[0]);
+    if (fds_[1] >= 0) ::close(fds_[1]);
+#endif
+}
+
+std::size_t kernel_pipe::fill(int in, std::size_t len, boost::system::error_code& ec)
+{
+    ec.clear();
+#if defined(__linux__)
+    ssize_t n;
+    do {
+        n = ::splice(in, 0, fds_[1], 0, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        set_errno_error(ec);
+        return 0;
+    }
+    size_ += std::size_t(n);
+    return std::size_t(n);
+#else
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+#endif
+}
+
+std::size_t kernel_pipe::drain(int out, std::size_t len, boost::system::error_code& ec)
+{
+    ec.clear();
+#if defined(__linux__)
+    sigpipe_guard guard;
+    std::size_t ret = 0;
+    while (ret < len) {
+        ssize_t n = ::splice(fds_[0], 0, out, 0, len - ret, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            guard.epipe_ = (errno == EPIPE);
+            set_errno_error(ec);
+            break;
+        }
+        size_ -= std::size_t(n);
+        ret += std::size_t(n);
+    }
+    return ret;
+#else
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+#endif
+}
+
 std::shared_ptr<fibers::foreign_thread_pool> get_default_executor() {
     static std::shared_ptr<fibers::foreign_thread_pool> default_executor;
     static std::once_flag executor_flag;
     std::call_once(executor_flag, [&](){
-        default_executor.reset(new fibers::foreign_thread_pool(2));
+        // Grows under a burst of blocking file operations, shrinks back to 2 threads when idle
+        default_executor.reset(
+            new fibers::foreign_thread_pool(2, 16, 1024, std::chrono::seconds(30)));
     });
     return default_executor;
 }
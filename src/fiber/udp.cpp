@@ -0,0 +1,238 @@
+//
+//  udp.cpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+#include <fibio/stream/udp.hpp>
+
+namespace fibio {
+namespace stream {
+
+namespace {
+
+// Messages per `recvmmsg`/`sendmmsg` call, the headers live on the fiber stack
+constexpr std::size_t mmsg_chunk = 64;
+
+bool would_block(const boost::system::error_code& ec)
+{
+    return ec == boost::asio::error::would_block || ec == boost::asio::error::try_again;
+}
+
+#if defined(__linux__)
+boost::system::error_code last_error()
+{
+    return boost::system::error_code(errno, boost::system::system_category());
+}
+#endif
+
+} // End of anonymous namespace
+
+bool datagram_batch::push(const void* data,
+                          std::size_t n,
+                          const endpoint_type& to,
+                          bool has_endpoint)
+{
+    if (full() || n > max_size_) return false;
+    slot& s = slots_[size_];
+    std::memcpy(this->data(size_), data, n);
+    s.length_ = n;
+    s.endpoint_ = to;
+    s.has_endpoint_ = has_endpoint;
+    s.truncated_ = false;
+    size_++;
+    return true;
+}
+
+boost::system::error_code udp_socket::open(const protocol_type& protocol)
+{
+    boost::system::error_code ec;
+    sock_.open(protocol, ec);
+    if (!ec) sock_.non_blocking(true, ec);
+    return ec;
+}
+
+boost::system::error_code udp_socket::bind(const endpoint_type& ep)
+{
+    boost::system::error_code ec;
+    if (!sock_.is_open()) {
+        ec = open(ep.protocol());
+        if (ec) return ec;
+    }
+    sock_.bind(ep, ec);
+    return ec;
+}
+
+boost::system::error_code udp_socket::connect(const endpoint_type& ep)
+{
+    boost::system::error_code ec;
+    if (!sock_.is_open()) {
+        ec = open(ep.protocol());
+        if (ec) return ec;
+    }
+    // Connecting a datagram socket never blocks
+    sock_.connect(ep, ec);
+    return ec;
+}
+
+void udp_socket::wait_read(boost::system::error_code& ec)
+{
+    sock_.async_receive(boost::asio::null_buffers(), asio::yield[ec]);
+}
+
+void udp_socket::wait_write(boost::system::error_code& ec)
+{
+    sock_.async_send(boost::asio::null_buffers(), asio::yield[ec]);
+}
+
+std::size_t udp_socket::receive_from(void* data,
+                                     std::size_t size,
+                                     endpoint_type& from,
+                                     boost::system::error_code& ec)
+{
+    for (;;) {
+        std::size_t n = sock_.receive_from(boost::asio::buffer(data, size), from, 0, ec);
+        if (!would_block(ec)) return n;
+        wait_read(ec);
+        if (ec) return 0;
+    }
+}
+
+std::size_t udp_socket::send_to(const void* data,
+                                std::size_t size,
+                                const endpoint_type& to,
+                                boost::system::error_code& ec)
+{
+    for (;;) {
+        std::size_t n = sock_.send_to(boost::asio::buffer(data, size), to, 0, ec);
+        if (!would_block(ec)) return n;
+        wait_write(ec);
+        if (ec) return 0;
+    }
+}
+
+std::size_t udp_socket::send(const void* data, std::size_t size, boost::system::error_code& ec)
+{
+    for (;;) {
+        std::size_t n = sock_.send(boost::asio::buffer(data, size), 0, ec);
+        if (!would_block(ec)) return n;
+        wait_write(ec);
+        if (ec) return 0;
+    }
+}
+
+std::size_t udp_socket::receive_batch(datagram_batch& b, boost::system::error_code& ec)
+{
+    b.clear();
+    for (;;) {
+        ec.clear();
+#if defined(__linux__)
+        struct mmsghdr msgs[mmsg_chunk];
+        struct iovec iovs[mmsg_chunk];
+        while (!b.full()) {
+            std::size_t n = std::min(b.capacity() - b.size_, mmsg_chunk);
+            for (std::size_t i = 0; i < n; i++) {
+                datagram_batch::slot& s = b.slots_[b.size_ + i];
+                iovs[i].iov_base = b.data(b.size_ + i);
+                iovs[i].iov_len = b.max_size_;
+                std::memset(&msgs[i], 0, sizeof(msgs[i]));
+                msgs[i].msg_hdr.msg_name = s.endpoint_.data();
+                msgs[i].msg_hdr.msg_namelen = socklen_t(s.endpoint_.capacity());
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int r = ::recvmmsg(sock_.native_handle(), msgs, unsigned(n), MSG_DONTWAIT, 0);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                ec = last_error();
+                break;
+            }
+            for (int i = 0; i < r; i++) {
+                datagram_batch::slot& s = b.slots_[b.size_ + i];
+                s.length_ = msgs[i].msg_len;
+                s.endpoint_.resize(msgs[i].msg_hdr.msg_namelen);
+                s.has_endpoint_ = true;
+                s.truncated_ = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+            }
+            b.size_ += std::size_t(r);
+            // The socket is drained
+            if (std::size_t(r) < n) break;
+        }
+#else
+        while (!b.full()) {
+            datagram_batch::slot& s = b.slots_[b.size_];
+            s.length_ = sock_.receive_from(
+                boost::asio::buffer(b.data(b.size_), b.max_size_), s.endpoint_, 0, ec);
+            if (ec) break;
+            s.has_endpoint_ = true;
+            s.truncated_ = false;
+            b.size_++;
+        }
+#endif
+        // Errors after some datagrams are reported again by the next call
+        if (!b.empty()) {
+            ec.clear();
+            return b.size();
+        }
+        if (!would_block(ec)) return 0;
+        wait_read(ec);
+        if (ec) return 0;
+    }
+}
+
+std::size_t udp_socket::send_batch(const datagram_batch& b, boost::system::error_code& ec)
+{
+    std::size_t sent = 0;
+    ec.clear();
+    while (sent < b.size()) {
+#if defined(__linux__)
+        struct mmsghdr msgs[mmsg_chunk];
+        struct iovec iovs[mmsg_chunk];
+        std::size_t n = std::min(b.size() - sent, mmsg_chunk);
+        for (std::size_t i = 0; i < n; i++) {
+            const datagram_batch::slot& s = b.slots_[sent + i];
+            iovs[i].iov_base = const_cast<char*>(b.data(sent + i));
+            iovs[i].iov_len = s.length_;
+            std::memset(&msgs[i], 0, sizeof(msgs[i]));
+            if (s.has_endpoint_) {
+                msgs[i].msg_hdr.msg_name = const_cast<void*>(
+                    static_cast<const void*>(s.endpoint_.data()));
+                msgs[i].msg_hdr.msg_namelen = socklen_t(s.endpoint_.size());
+            }
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int r = ::sendmmsg(sock_.native_handle(), msgs, unsigned(n), MSG_DONTWAIT);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            ec = last_error();
+        } else {
+            sent += std::size_t(r);
+        }
+#else
+        const datagram_batch::slot& s = b.slots_[sent];
+        boost::asio::const_buffers_1 buf(b.data(sent), s.length_);
+        if (s.has_endpoint_)
+            sock_.send_to(buf, s.endpoint_, 0, ec);
+        else
+            sock_.send(buf, 0, ec);
+        if (!ec) sent++;
+#endif
+        if (!ec) continue;
+        if (!would_block(ec)) return sent;
+        wait_write(ec);
+        if (ec) return sent;
+    }
+    return sent;
+}
+
+} // End of namespace stream
+} // End of namespace fibio
@@ -10,7 +10,7 @@
 #define fibio_http_common_chunked_stream_hpp
 
 #include <iostream>
-#include <vector>
+#include <fibio/stream/streambuf.hpp>
 
 namespace fibio {
 namespace http {
@@ -72,7 +72,7 @@ protected:
             if (current_chunk_ > 0) {
                 raw_stream_->peek();
                 size_t bytes_transferred = raw_stream_->readsome(
-                    &get_buffer_[0] + putback_max,
+                    get_buffer_.data() + putback_max,
                     std::min(current_chunk_, std::streamsize(buffer_size - putback_max)));
                 if (bytes_transferred == 0) {
                     return traits_type::eof();
@@ -84,9 +84,9 @@ protected:
                     if (getchar() != '\r') return traits_type::eof();
                     if (getchar() != '\n') return traits_type::eof();
                 }
-                setg(&get_buffer_[0],
-                     &get_buffer_[0] + putback_max,
-                     &get_buffer_[0] + putback_max + bytes_transferred);
+                setg(get_buffer_.data(),
+                     get_buffer_.data() + putback_max,
+                     get_buffer_.data() + putback_max + bytes_transferred);
                 return traits_type::to_int_type(*gptr());
             } else {
                 // Start a new chunk
@@ -106,8 +106,9 @@ protected:
 private:
     void init_buffers()
     {
-        get_buffer_.resize(buffer_size + putback_max);
-        setg(&get_buffer_[0], &get_buffer_[0] + putback_max, &get_buffer_[0] + putback_max);
+        get_buffer_.acquire(buffer_size);
+        char* buf = get_buffer_.data();
+        setg(buf, buf + putback_max, buf + putback_max);
     }
 
     int getchar()
@@ -158,7 +159,7 @@ private:
     {
         buffer_size = 4096
     };
-    std::vector<char> get_buffer_;
+    fibio::stream::detail::pooled_buffer get_buffer_;
     std::istream* raw_stream_ = nullptr;
     std::streamsize current_chunk_ = 0;
 
@@ -193,7 +194,7 @@ protected:
         // End of chunk
         raw_stream_->write("\r\n", 2);
         raw_stream_->flush();
-        setp(&put_buffer_[0], &put_buffer_[0] + put_buffer_.size());
+        setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
 
         // If the new character is eof then our work here is done.
         if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
@@ -213,8 +214,8 @@ protected:
 private:
     void init_buffers()
     {
-        put_buffer_.resize(buffer_size);
-        setp(&put_buffer_[0], &put_buffer_[0] + put_buffer_.size());
+        put_buffer_.acquire(buffer_size);
+        setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
     }
 
     void write_chunk_size(std::streamsize n)
@@ -229,7 +230,7 @@ private:
     {
         buffer_size = 4096
     };
-    std::vector<char> put_buffer_;
+    fibio::stream::detail::pooled_buffer put_buffer_;
     std::ostream* raw_stream_ = nullptr;
 
     friend class fibio::http::common::chunked_ostream;
@@ -279,15 +280,15 @@ protected:
             if (current_chunk_ > 0) {
                 raw_stream_->peek();
                 size_t bytes_transferred = raw_stream_->readsome(
-                    &get_buffer_[0] + putback_max,
+                    get_buffer_.data() + putback_max,
                     std::min(current_chunk_, std::streamsize(buffer_size - putback_max)));
                 if (bytes_transferred == 0) {
                     return traits_type::eof();
                 }
                 current_chunk_ -= bytes_transferred;
-                setg(&get_buffer_[0],
-                     &get_buffer_[0] + putback_max,
-                     &get_buffer_[0] + putback_max + bytes_transferred);
+                setg(get_buffer_.data(),
+                     get_buffer_.data() + putback_max,
+                     get_buffer_.data() + putback_max + bytes_transferred);
                 if (current_chunk_ == 0) {
                     // Current chunk data all consumed
                     // Consume following "\r\n"
@@ -324,7 +325,7 @@ protected:
         // End of chunk
         raw_stream_->write("\r\n", 2);
         raw_stream_->flush();
-        setp(&put_buffer_[0], &put_buffer_[0] + put_buffer_.size());
+        setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
 
         // If the new character is eof then our work here is done.
         if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
@@ -344,10 +345,11 @@ protected:
 private:
     void init_buffers()
     {
-        get_buffer_.resize(buffer_size + putback_max);
-        setg(&get_buffer_[0], &get_buffer_[0] + putback_max, &get_buffer_[0] + putback_max);
-        put_buffer_.resize(buffer_size);
-        setp(&put_buffer_[0], &put_buffer_[0] + put_buffer_.size());
+        get_buffer_.acquire(buffer_size);
+        char* buf = get_buffer_.data();
+        setg(buf, buf + putback_max, buf + putback_max);
+        put_buffer_.acquire(buffer_size);
+        setp(put_buffer_.data(), put_buffer_.data() + put_buffer_.size());
     }
 
     int getchar()
@@ -406,8 +408,8 @@ private:
     {
         buffer_size = 4096
     };
-    std::vector<char> get_buffer_;
-    std::vector<char> put_buffer_;
+    fibio::stream::detail::pooled_buffer get_buffer_;
+    fibio::stream::detail::pooled_buffer put_buffer_;
     std::iostream* raw_stream_ = nullptr;
     std::streamsize current_chunk_ = 0;
 
@@ -6,6 +6,7 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
+#include <limits>
 #include <boost/asio/basic_waitable_timer.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/iostreams/restrict.hpp>
@@ -42,6 +43,16 @@ struct stream_traits<tcp_stream>
     static constexpr uint16_t default_port = 80;
 
     static stream_type* construct(arg_type) { return new stream_type; }
+
+    static void accept(acceptor_type& acc, stream_type& s, boost::system::error_code& ec)
+    {
+        acc(s, ec);
+    }
+
+    static void handshake(acceptor_type&, stream_type&, boost::system::error_code& ec)
+    {
+        ec.clear();
+    }
 };
 
 template <>
@@ -54,6 +65,17 @@ struct stream_traits<ssl::tcp_stream>
     static constexpr uint16_t default_port = 443;
 
     static stream_type* construct(arg_type arg) { return new stream_type(*arg); }
+
+    // The handshake is done by the connection fiber, the accept loop is not held up by it
+    static void accept(acceptor_type& acc, stream_type& s, boost::system::error_code& ec)
+    {
+        acc.accept_connection(s, ec);
+    }
+
+    static void handshake(acceptor_type& acc, stream_type& s, boost::system::error_code& ec)
+    {
+        acc.handshake(s, ec);
+    }
 };
 
 template <typename Stream>
@@ -102,6 +124,18 @@ struct connection
         }
     }
 
+    void handshake(typename traits_type::acceptor_type& acc)
+    {
+        if (read_timeout_ > NO_TIMEOUT) {
+            // Handshake is bounded by the read timeout
+            watchdog_timer_->expires_from_now(read_timeout_);
+        }
+        boost::system::error_code ec;
+        traits_type::handshake(acc, stream(), ec);
+        // Following `recv` fails on a bad stream
+        if (ec) stream().setstate(std::ios_base::badbit);
+    }
+
     bool recv(request& req)
     {
         bool ret = false;
@@ -203,6 +237,8 @@ struct server_engine
         // Loop until accept closed
         while (true) {
             connection_type sc(host_, read_timeout_, write_timeout_, arg_);
+            sc.stream().set_buffer_size(get_buffer_size_, put_buffer_size_);
+            sc.stream().set_release_when_idle(release_buffers_when_idle_);
             ec = accept(sc);
             if (ec) break;
             sc.read_timeout_ = read_timeout_;
@@ -226,7 +262,7 @@ struct server_engine
     boost::system::error_code accept(connection_type& sc)
     {
         boost::system::error_code ec;
-        acceptor_(sc.stream(), ec);
+        traits_type::accept(acceptor_, sc.stream(), ec);
         if (!ec) {
             active_connection_++;
         }
@@ -244,6 +280,7 @@ struct server_engine
         if (read_timeout_ > NO_TIMEOUT || write_timeout_ > NO_TIMEOUT) {
             c.start_watchdog();
         }
+        c.handshake(acceptor_);
         request req;
         int count = 0;
         while (c.recv(req)) {
@@ -307,6 +344,9 @@ struct server_engine
     timeout_type read_timeout_ = DEFAULT_TIMEOUT;
     timeout_type write_timeout_ = DEFAULT_TIMEOUT;
     unsigned max_keep_alive_ = DEFAULT_MAX_KEEP_ALIVE;
+    std::size_t get_buffer_size_ = stream::default_buffer_size();
+    std::size_t put_buffer_size_ = stream::default_buffer_size();
+    bool release_buffers_when_idle_ = false;
     arg_type arg_;
 
     std::unique_ptr<fiber> watchdog_;
@@ -369,10 +409,8 @@ void server_request::drop_body()
 {
     // Discard body content iff body stream exists
     if (body_stream_) {
-        while (!body_stream().eof()) {
-            char buf[1024];
-            body_stream().read(buf, sizeof(buf));
-        }
+        // Skip in the stream buffer instead of copying out
+        body_stream().ignore(std::numeric_limits<std::streamsize>::max());
         body_stream_.reset();
         restriction_.reset();
     }
@@ -446,7 +484,13 @@ bool server_response::write()
     // Write headers
     if (!write_header(raw_stream())) return false;
     // Write body
-    raw_stream_->write(&(raw_body_stream_.vector()[0]), raw_body_stream_.vector().size());
+    const std::string& body = raw_body_stream_.vector();
+    if (stream::closable_stream* cs = dynamic_cast<stream::closable_stream*>(raw_stream_)) {
+        // Headers and body go out in one writev, the body is not copied
+        cs->write_direct(body.data(), body.size());
+    } else {
+        raw_stream_->write(body.data(), body.size());
+    }
     raw_stream_->flush();
     return !raw_stream_->eof() && !raw_stream_->fail() && !raw_stream_->bad();
 }
@@ -511,6 +555,10 @@ void server::init_engine()
         get_ssl_engine(engine_)->read_timeout_ = s_.read_timeout_;
         get_ssl_engine(engine_)->write_timeout_ = s_.write_timeout_;
         get_ssl_engine(engine_)->max_keep_alive_ = s_.max_keep_alive_;
+        get_ssl_engine(engine_)->get_buffer_size_ = s_.get_buffer_size_;
+        get_ssl_engine(engine_)->put_buffer_size_ = s_.put_buffer_size_;
+        get_ssl_engine(engine_)->release_buffers_when_idle_ = s_.release_buffers_when_idle_;
+        get_ssl_engine(engine_)->acceptor_.set_handshake_offload(s_.handshake_offload_);
     } else {
         engine_
             = reinterpret_cast<impl*>(new server_engine(0,
@@ -521,6 +569,9 @@ void server::init_engine()
         get_engine(engine_)->read_timeout_ = s_.read_timeout_;
         get_engine(engine_)->write_timeout_ = s_.write_timeout_;
         get_engine(engine_)->max_keep_alive_ = s_.max_keep_alive_;
+        get_engine(engine_)->get_buffer_size_ = s_.get_buffer_size_;
+        get_engine(engine_)->put_buffer_size_ = s_.put_buffer_size_;
+        get_engine(engine_)->release_buffers_when_idle_ = s_.release_buffers_when_idle_;
     }
 }
 
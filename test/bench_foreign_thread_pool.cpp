@@ -0,0 +1,104 @@
+//
+//  bench_foreign_thread_pool.cpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fibio/fiber.hpp>
+#include <fibio/future.hpp>
+#include <fibio/fiberize.hpp>
+
+using namespace fibio;
+
+/**
+ * The foreign thread pool before it was made elastic, tasks are packaged_tasks queued as
+ * std::function in a std::mutex protected queue
+ */
+struct legacy_thread_pool
+{
+    legacy_thread_pool(size_t pool_size = 1)
+    {
+        for (size_t i = 0; i < pool_size; i++) {
+            threads_.emplace_back([this]() {
+                for (auto& i : queue_) i();
+            });
+        }
+    }
+
+    ~legacy_thread_pool()
+    {
+        queue_.close();
+        for (auto& t : threads_) {
+            t.join();
+        }
+    }
+
+    template <typename Fn, typename... Args>
+    auto async_call(Fn&& fn, Args&&... args)
+        -> future<typename fibers::detail::task_data<Fn, Args...>::result_type>
+    {
+        typedef fibers::detail::task_data<Fn, Args...> task_data_type;
+        typedef typename task_data_type::result_type result_type;
+        std::shared_ptr<packaged_task<result_type()>> task(new packaged_task<result_type()>(
+            task_data_type(std::forward<Fn>(fn), std::forward<Args>(args)...)));
+        future<result_type> ret = task->get_future();
+        queue_.push([task]() { (*task)(); });
+        return ret;
+    }
+
+private:
+    typedef std::function<void()> task_type;
+    typedef concurrent::basic_concurrent_queue<task_type,
+                                               std::unique_lock<std::mutex>,
+                                               std::condition_variable> queue_type;
+
+    queue_type queue_;
+    std::vector<std::thread> threads_;
+};
+
+template <typename Fn>
+void measure(const char* name, int n, Fn fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        if (fn(i) != i * 10) {
+            std::cout << name << ": wrong result" << std::endl;
+            return;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << name << ": "
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / n
+              << "ns per round trip" << std::endl;
+}
+
+int fibio::main(int argc, char* argv[])
+{
+    const int n = argc > 1 ? std::atoi(argv[1]) : 100000;
+    auto thr_func = [](int x) { return x * 10; };
+    {
+        legacy_thread_pool pool;
+        measure("legacy packaged_task pool", n, [&](int i) {
+            return pool.async_call(thr_func, i).get();
+        });
+    }
+    {
+        foreign_thread_pool pool;
+        measure("async_call", n, [&](int i) { return pool.async_call(thr_func, i).get(); });
+        measure("async_call_oneshot", n, [&](int i) {
+            return pool.async_call_oneshot(thr_func, i).get();
+        });
+        measure("operator()", n, [&](int i) { return pool(thr_func, i); });
+    }
+    return 0;
+}
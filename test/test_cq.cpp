@@ -6,11 +6,19 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include <fibio/fiber.hpp>
 #include <fibio/fiberize.hpp>
 #include <fibio/concurrent/concurrent_queue.hpp>
+#include <fibio/concurrent/ring_queue.hpp>
+#include <fibio/concurrent/spsc_queue.hpp>
+#include <fibio/concurrent/select.hpp>
+#include <fibio/concurrent/bridge_queue.hpp>
+#include <fibio/concurrent/priority_queue.hpp>
 
 using namespace fibio;
 concurrent::concurrent_queue<int> cq;
@@ -42,6 +50,243 @@ void parent()
     assert(s == sum);
 }
 
+/// Not default constructible, counts live instances
+struct counted
+{
+    static int live;
+    explicit counted(int v) : v_(v) { live++; }
+    counted(const counted& other) : v_(other.v_) { live++; }
+    counted(counted&& other) noexcept : v_(other.v_) { live++; }
+    counted& operator=(counted&& other) noexcept
+    {
+        v_ = other.v_;
+        return *this;
+    }
+    ~counted() { live--; }
+    int v_;
+};
+int counted::live = 0;
+
+void test_ring_queue()
+{
+    concurrent::ring_queue<int> rq(5);
+    assert(rq.capacity() == 8);
+    for (int i = 0; i < 8; i++) assert(rq.try_push(i) == concurrent::queue_op_status::success);
+    assert(rq.full());
+    assert(rq.try_push(8) == concurrent::queue_op_status::full);
+    int v = -1;
+    assert(rq.try_pop(v) == concurrent::queue_op_status::success && v == 0);
+    for (int i = 1; i < 8; i++) assert(rq.pop(v) == concurrent::queue_op_status::success && v == i);
+    assert(rq.try_pop(v) == concurrent::queue_op_status::empty);
+    rq.close();
+    assert(rq.push(1) == concurrent::queue_op_status::closed);
+    assert(rq.pop(v) == concurrent::queue_op_status::closed);
+    {
+        // Elements left behind are destroyed with the queue
+        concurrent::ring_queue<counted> cr(4);
+        concurrent::spsc_queue<counted> cs(4);
+        counted c(1);
+        for (int i = 0; i < 3; i++) {
+            assert(cr.push(c) == concurrent::queue_op_status::success);
+            assert(cs.push(counted(i)) == concurrent::queue_op_status::success);
+        }
+        counted out(0);
+        assert(cr.pop(out) == concurrent::queue_op_status::success && out.v_ == 1);
+        assert(counted::live == 7);
+    }
+    assert(counted::live == 0);
+}
+
+void test_spsc_queue()
+{
+    concurrent::spsc_queue<int> q(16);
+    const int N = 10000;
+    fiber producer([&]() {
+        for (int i = 1; i <= N; i++) assert(q.push(i) == concurrent::queue_op_status::success);
+        q.close();
+    });
+    int expected = 1;
+    for (int v : q) assert(v == expected++);
+    assert(expected == N + 1);
+    producer.join();
+    assert(q.push(1) == concurrent::queue_op_status::closed);
+}
+
+void test_select()
+{
+    concurrent::concurrent_queue<int> q1, q2;
+    concurrent::concurrent_queue<int> q3(1);
+    int a = 0, b = 0;
+    // Nothing arrives
+    auto r = concurrent::select_for(
+        std::chrono::milliseconds(10), concurrent::on_pop(q1, a), concurrent::on_pop(q2, b));
+    assert(r.index == concurrent::select_timeout);
+    assert(r.status == concurrent::queue_op_status::timeout);
+    // Second queue becomes ready later
+    fiber f([&]() {
+        this_fiber::sleep_for(std::chrono::milliseconds(10));
+        q2.push(42);
+    });
+    r = concurrent::select(concurrent::on_pop(q1, a), concurrent::on_pop(q2, b));
+    assert(r.index == 1 && r.status == concurrent::queue_op_status::success && b == 42);
+    f.join();
+    // Push case waits for a free slot
+    q3.push(1);
+    fiber g([&]() {
+        this_fiber::sleep_for(std::chrono::milliseconds(10));
+        int v;
+        q3.pop(v);
+    });
+    r = concurrent::select(concurrent::on_pop(q1, a), concurrent::on_push(q3, 2));
+    assert(r.index == 1 && r.status == concurrent::queue_op_status::success);
+    g.join();
+    assert(q3.size() == 1);
+    // Closed queue completes the case with closed status
+    q1.close();
+    r = concurrent::select(concurrent::on_pop(q2, b), concurrent::on_pop(q1, a));
+    assert(r.index == 1 && r.status == concurrent::queue_op_status::closed);
+}
+
+void test_bridge_queue()
+{
+    const int N = 10000;
+    const long expected = long(N) * (N + 1) / 2;
+    // Threads push into a small queue, fibers pop
+    {
+        concurrent::bridge_queue<int> q(4);
+        std::atomic<int> producers(2);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 2; t++) {
+            threads.emplace_back([&]() {
+                for (int i = 1; i <= N; i++) q.push(i);
+                if (--producers == 0) q.close();
+            });
+        }
+        long s = 0;
+        for (int v : q) s += v;
+        assert(s == expected * 2);
+        for (auto& t : threads) t.join();
+    }
+    // Fiber pushes, thread pops
+    {
+        concurrent::bridge_queue<int> q(4);
+        long s = 0;
+        std::thread consumer([&]() {
+            for (int v : q) s += v;
+        });
+        for (int i = 1; i <= N; i++) q.push(i);
+        q.close();
+        consumer.join();
+        assert(s == expected);
+    }
+}
+
+struct job
+{
+    int id;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+struct deadline_of
+{
+    std::chrono::steady_clock::time_point operator()(const job& j) const { return j.deadline; }
+};
+
+void test_priority_queue()
+{
+    {
+        concurrent::concurrent_priority_queue<int> q;
+        for (int i : {5, 1, 9, 3, 7, 2, 8, 6, 4, 0}) q.push(i);
+        int v;
+        for (int i = 9; i >= 0; i--) {
+            assert(q.pop(v) == concurrent::queue_op_status::success && v == i);
+        }
+    }
+    {
+        typedef concurrent::earliest_deadline_first<deadline_of> edf;
+        typedef concurrent::expires_at_deadline<deadline_of> expired;
+        typedef concurrent::concurrent_priority_queue<job, edf, expired> job_queue;
+        job_queue q;
+        auto now = std::chrono::steady_clock::now();
+        q.push(job{1, now + std::chrono::seconds(20)});
+        q.push(job{2, now - std::chrono::seconds(1)});
+        q.push(job{3, now + std::chrono::seconds(10)});
+        q.push(job{4, now - std::chrono::seconds(2)});
+        job j;
+        // Expired jobs are dropped, the earliest live deadline comes first
+        assert(q.pop(j) == concurrent::queue_op_status::success && j.id == 3);
+        assert(q.pop(j) == concurrent::queue_op_status::success && j.id == 1);
+        assert(q.try_pop(j) == concurrent::queue_op_status::empty);
+        assert(q.evicted() == 2);
+    }
+    {
+        // Evicting expired jobs from a full queue wakes up the blocked pusher
+        typedef concurrent::earliest_deadline_first<deadline_of> edf;
+        typedef concurrent::expires_at_deadline<deadline_of> expired;
+        typedef concurrent::concurrent_priority_queue<job, edf, expired> job_queue;
+        const int N = 4;
+        job_queue q(N);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+        for (int i = 0; i < N; i++) q.push(job{i, deadline});
+        fiber pusher([&]() {
+            auto later = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            assert(q.push(job{N, later}) == concurrent::queue_op_status::success);
+        });
+        this_fiber::sleep_for(std::chrono::milliseconds(50));
+        job j;
+        assert(q.pop(j) == concurrent::queue_op_status::success && j.id == N);
+        assert(q.evicted() == N);
+        pusher.join();
+    }
+}
+
+// Producers and consumers run in separated fibers, returns elements per second
+template <typename Queue>
+double queue_throughput(Queue& q, int producers, int consumers, int per_producer)
+{
+    std::atomic<long> total(0);
+    barrier done(producers, [&]() { q.close(); });
+    auto start = std::chrono::steady_clock::now();
+    fiber_group fibers;
+    for (int i = 0; i < producers; i++) {
+        fibers.create_fiber([&]() {
+            for (int n = 1; n <= per_producer; n++) q.push(n);
+            done.wait();
+        });
+    }
+    for (int i = 0; i < consumers; i++) {
+        fibers.create_fiber([&]() {
+            long s = 0;
+            for (int n : q) s += n;
+            total += s;
+        });
+    }
+    fibers.join_all();
+    auto end = std::chrono::steady_clock::now();
+    assert(total == long(per_producer) * (per_producer + 1) / 2 * producers);
+    double secs = std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+    return double(producers) * per_producer / secs;
+}
+
+void bench_queues()
+{
+    const int total = 4000;
+    for (int pc : {1, 4}) {
+        concurrent::concurrent_queue<int> cq1(1024);
+        concurrent::ring_queue<int> rq(1024);
+        double a = queue_throughput(cq1, pc, pc, total / pc);
+        double b = queue_throughput(rq, pc, pc, total / pc);
+        std::cout << pc << " producers/" << pc << " consumers, concurrent_queue: " << long(a)
+                  << "/s, ring_queue: " << long(b) << "/s" << std::endl;
+    }
+    concurrent::concurrent_queue<int> cq1(1024);
+    concurrent::spsc_queue<int> sq(1024);
+    double a = queue_throughput(cq1, 1, 1, total);
+    double b = queue_throughput(sq, 1, 1, total);
+    std::cout << "1 producer/1 consumer, concurrent_queue: " << long(a)
+              << "/s, spsc_queue: " << long(b) << "/s" << std::endl;
+}
+
 int fibio::main(int argc, char* argv[])
 {
     this_fiber::get_scheduler().add_worker_thread(3);
@@ -49,6 +294,12 @@ int fibio::main(int argc, char* argv[])
     fiber_group fibers;
     fibers.create_fiber(parent);
     fibers.join_all();
+    test_ring_queue();
+    test_spsc_queue();
+    test_select();
+    test_bridge_queue();
+    test_priority_queue();
+    bench_queues();
     std::cout << "main_fiber exiting" << std::endl;
     return 0;
 }
@@ -6,6 +6,7 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <chrono>
@@ -47,6 +48,33 @@ void parent(mutex& m, condition_variable& cv)
     f.join();
 }
 
+void test_combining_barrier()
+{
+    const unsigned int N = 2000;
+    const int phases = 5;
+    std::atomic<int> arrived(0);
+    int completed = 0;
+    combining_barrier bar(N, [&]() {
+        // Every participant of this phase has arrived
+        assert(arrived == int(N) * (completed + 1));
+        completed++;
+    });
+    std::atomic<int> leaders(0);
+    fiber_group fibers;
+    for (unsigned int i = 0; i < N; i++) {
+        fibers.create_fiber([&]() {
+            for (int p = 0; p < phases; p++) {
+                arrived++;
+                if (bar.wait()) leaders++;
+                assert(completed > p);
+            }
+        });
+    }
+    fibers.join_all();
+    assert(completed == phases);
+    assert(leaders == phases);
+}
+
 int fibio::main(int argc, char* argv[])
 {
     this_fiber::get_scheduler().add_worker_thread(3);
@@ -57,6 +85,7 @@ int fibio::main(int argc, char* argv[])
     fiber_group fibers;
     fibers.create_fiber(parent, std::ref(m), std::ref(cv));
     fibers.join_all();
+    test_combining_barrier();
     std::cout << "main_fiber exiting" << std::endl;
     return 0;
 }
@@ -7,6 +7,7 @@
 //
 
 #include <iostream>
+#include <string>
 #include <fibio/iostream.hpp>
 #include <fibio/fiberize.hpp>
 
@@ -28,10 +29,144 @@ void test_fstream()
     }
 }
 
+void test_file_backends(bool uring)
+{
+    std::string expected;
+    {
+        ofstream f;
+        f.set_io_uring(uring);
+        f.open("/tmp/test_file_backends");
+        for (int i = 0; i < 20000; i++) {
+            f << i << '\n';
+            expected += std::to_string(i) + '\n';
+        }
+    }
+    {
+        ofstream f;
+        f.set_io_uring(uring);
+        f.open("/tmp/test_file_backends", std::ios_base::app);
+        f << "end\n";
+        expected += "end\n";
+    }
+    {
+        ifstream f;
+        f.set_io_uring(uring);
+        f.open("/tmp/test_file_backends");
+        std::string content((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        assert(content == expected);
+        // Seek relative to the end and to an absolute position
+        f.clear();
+        f.seekg(-4, std::ios_base::end);
+        std::string l;
+        std::getline(f, l);
+        assert(l == "end");
+        f.clear();
+        f.seekg(6);
+        std::getline(f, l);
+        assert(l == "3");
+        assert(f.tellg() == std::streampos(8));
+    }
+    {
+        fstream f;
+        f.set_io_uring(uring);
+        f.open("/tmp/test_file_backends", std::ios_base::in | std::ios_base::out);
+        f.seekp(0);
+        f << "X";
+        f.seekg(0);
+        char c;
+        f.get(c);
+        assert(c == 'X');
+        f.get(c);
+        assert(c == '\n');
+    }
+}
+
+void test_concurrent_readers()
+{
+    // Several fibers reading at once keep several requests in flight
+    fiber_group readers;
+    for (int n = 0; n < 8; n++) {
+        readers.create_fiber([]() {
+            ifstream f("/tmp/test_file_backends");
+            std::string l;
+            int lines = 0;
+            while (std::getline(f, l)) lines++;
+            assert(lines == 20001);
+        });
+    }
+    readers.join_all();
+}
+
+// The first line was overwritten with "X" by test_file_backends
+void test_readahead(bool uring)
+{
+    ifstream f;
+    f.set_io_uring(uring);
+    f.set_readahead(true);
+    f.open("/tmp/test_file_backends");
+    std::string l;
+    for (int i = 0; i < 10000; i++) {
+        std::getline(f, l);
+        assert(l == (i == 0 ? "X" : std::to_string(i)));
+    }
+    // Seeking discards prefetched blocks and restarts from the new position
+    std::streampos pos = f.tellg();
+    f.seekg(2);
+    std::getline(f, l);
+    assert(l == "1");
+    // A new buffer puts the file position back before the buffered and prefetched data
+    f.rdbuf()->pubsetbuf(0, 8192);
+    std::getline(f, l);
+    assert(l == "2");
+    f.seekg(pos);
+    int lines = 0;
+    std::string last;
+    while (std::getline(f, l)) {
+        lines++;
+        last = l;
+    }
+    assert(lines == 10001);
+    assert(last == "end");
+}
+
+void test_mapped_ifstream()
+{
+    mapped_ifstream f("/tmp/test_file_backends", stream::map_advice::sequential);
+    assert(f.is_open());
+    ifstream ref("/tmp/test_file_backends");
+    std::string expected((std::istreambuf_iterator<char>(ref)), std::istreambuf_iterator<char>());
+    // Direct access to the mapping
+    assert(std::string(f.data(), f.size()) == expected);
+    std::string l;
+    std::getline(f, l);
+    assert(l == "X");
+    f.seekg(-4, std::ios_base::end);
+    std::getline(f, l);
+    assert(l == "end");
+    assert(!std::getline(f, l));
+    f.clear();
+    f.seekg(2);
+    std::getline(f, l);
+    assert(l == "1");
+    f.close();
+    assert(!f.is_open());
+    mapped_ifstream missing("/tmp/no_such_file_for_fibio");
+    assert(!missing);
+}
+
 int fibio::main(int argc, char* argv[])
 {
     fiber_group fg;
     fg.create_fiber(test_fstream);
+    fg.create_fiber([]() {
+        // Both backends work on the same file, one after another
+        test_file_backends(true);
+        test_file_backends(false);
+        test_concurrent_readers();
+        test_readahead(true);
+        test_readahead(false);
+        test_mapped_ifstream();
+    });
     fg.join_all();
     std::cout << "main_fiber exiting" << std::endl;
     return 0;
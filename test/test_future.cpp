@@ -6,7 +6,11 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
+#include <atomic>
 #include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 #include <boost/lexical_cast.hpp>
 #include <fibio/fiber.hpp>
 #include <fibio/future.hpp>
@@ -78,6 +82,41 @@ void test_async_function()
     assert(af2(af1(42).get(), af1(24).get()).get() == f2(100)(f1(42), f1(24)));
 }
 
+void test_batched_async_function()
+{
+    std::atomic<int> batches(0);
+    std::atomic<std::size_t> largest(0);
+    auto bf = make_batched_async<int(int, int)>(
+        [&](std::vector<std::tuple<int, int>>& calls) {
+            batches++;
+            if (calls.size() > largest) largest = calls.size();
+            std::vector<int> ret;
+            for (auto& c : calls) ret.push_back(std::get<0>(c) * std::get<1>(c));
+            return ret;
+        },
+        16,
+        std::chrono::milliseconds(5));
+    std::vector<future<int>> fv;
+    for (int i = 0; i < 100; i++) fv.push_back(bf(i, 2));
+    for (int i = 0; i < 100; i++) assert(fv[i].get() == i * 2);
+    assert(largest > 1 && largest <= 16);
+    assert(batches < 100);
+
+    // Exception goes to every caller of the batch
+    auto bv = make_batched_async<void(std::string)>(
+        [](std::vector<std::tuple<std::string>>&) { throw std::runtime_error("failed"); },
+        8,
+        std::chrono::milliseconds(1));
+    future<void> f = bv("x");
+    bool caught = false;
+    try {
+        f.get();
+    } catch (std::runtime_error&) {
+        caught = true;
+    }
+    assert(caught);
+}
+
 void test_wait_for_any1()
 {
     future<void> f0 = async([]() { this_fiber::sleep_for(std::chrono::seconds(1)); });
@@ -269,6 +308,177 @@ void test_then4()
     assert(f.get() == 100);
 }
 
+void test_then_executor()
+{
+    async_executor<void> ex(2);
+    auto f = async([]() { return 100; })
+                 .then(ex, [](future<int>& f) { return boost::lexical_cast<std::string>(f.get()); })
+                 .then([](future<std::string>& f) { return boost::lexical_cast<int>(f.get()); });
+    assert(f.get() == 100);
+}
+
+void test_then_exception()
+{
+    promise<int> p;
+    auto f = p.get_future().then([](future<int>& f) -> int { throw std::runtime_error("then"); });
+    p.set_value(100);
+    bool thrown = false;
+    try {
+        f.get();
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_when_all1()
+{
+    future<int> f0 = async([]() {
+        this_fiber::sleep_for(std::chrono::milliseconds(100));
+        return 100;
+    });
+    shared_future<double> f1 = async([]() {
+                                   this_fiber::sleep_for(std::chrono::milliseconds(300));
+                                   return 100.5;
+                               }).share();
+    auto f = when_all(std::move(f0), f1, make_ready_future());
+    auto r = f.get();
+    assert(std::get<0>(r).get() == 100);
+    assert(std::get<1>(r).get() == 100.5);
+    std::get<2>(r).get();
+    // shared_future is copied into the result
+    assert(f1.valid());
+}
+
+void test_when_all2()
+{
+    std::vector<future<int>> fv;
+    for (int i = 0; i < 10; i++) {
+        fv.push_back(async([i]() {
+            this_fiber::sleep_for(std::chrono::milliseconds(10 * (10 - i)));
+            return i;
+        }));
+    }
+    auto r = when_all(fv.begin(), fv.end()).get();
+    assert(r.size() == 10);
+    for (int i = 0; i < 10; i++) assert(r[i].get() == i);
+    assert(when_all(fv.begin(), fv.begin()).get().empty());
+}
+
+void test_when_any1()
+{
+    future<void> f0 = async([]() { this_fiber::sleep_for(std::chrono::seconds(1)); });
+    future<int> f1 = async([]() {
+        this_fiber::sleep_for(std::chrono::milliseconds(100));
+        return 100;
+    });
+    future<double> f2 = async([]() {
+        this_fiber::sleep_for(std::chrono::milliseconds(300));
+        return 100.5;
+    });
+    auto r = when_any(std::move(f0), std::move(f1), std::move(f2)).get();
+    // 2nd future should be ready
+    assert(r.index == 1);
+    assert(std::get<1>(r.futures).get() == 100);
+    std::get<0>(r.futures).wait();
+}
+
+void test_when_any2()
+{
+    std::vector<future<int>> fv;
+    for (int i = 0; i < 10; i++) {
+        fv.push_back(async([i]() {
+            this_fiber::sleep_for(std::chrono::milliseconds(100 * (10 - i)));
+            return i;
+        }));
+    }
+    auto r = when_any(fv.begin(), fv.end()).get();
+    // Last future should be ready
+    assert(r.index == 9);
+    assert(r.futures[r.index].get() == 9);
+    assert(when_any(fv.begin(), fv.begin()).get().index == std::size_t(-1));
+}
+
+void test_pooled_allocator()
+{
+    for (int i = 0; i < 100; i++) {
+        promise<void> p(std::allocator_arg, pooled_allocator<void>());
+        future<void> f = p.get_future();
+        fiber([](promise<void> p) { p.set_value(); }, std::move(p)).detach();
+        f.get();
+    }
+    packaged_task<int(int)> pt(std::allocator_arg, pooled_allocator<int>(), [](int x) {
+        return x * 10;
+    });
+    auto f1 = pt.get_future();
+    pt(42);
+    assert(f1.get() == 420);
+    auto f2 = async(std::allocator_arg, pooled_allocator<int>(), [](int x) { return x + 1; }, 41);
+    assert(f2.get() == 42);
+}
+
+void test_oneshot()
+{
+    {
+        oneshot_promise<int> p;
+        oneshot_future<int> f = p.get_future();
+        fiber([](oneshot_promise<int> p) {
+            this_fiber::sleep_for(std::chrono::milliseconds(10));
+            p.set_value(42);
+        }, std::move(p)).detach();
+        assert(f.get() == 42);
+        assert(!f.valid());
+    }
+    {
+        oneshot_promise<void> p(std::allocator_arg, pooled_allocator<void>());
+        oneshot_future<void> f = p.get_future();
+        assert(f.wait_for(std::chrono::milliseconds(10)) == future_status::timeout);
+        fiber([](oneshot_promise<void> p) { p.set_value(); }, std::move(p)).detach();
+        assert(f.wait_for(std::chrono::seconds(10)) == future_status::ready);
+        assert(f.is_ready());
+        f.get();
+    }
+    {
+        oneshot_future<std::string> f;
+        {
+            oneshot_promise<std::string> p;
+            f = p.get_future();
+        }
+        bool thrown = false;
+        try {
+            f.get();
+        } catch (broken_promise&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    {
+        // Storing the value throws, both the setter and the waiter see the exception
+        struct bad_copy
+        {
+            bad_copy() = default;
+            bad_copy(const bad_copy&) { throw std::runtime_error("copy"); }
+        };
+        oneshot_promise<bad_copy> p;
+        oneshot_future<bad_copy> f = p.get_future();
+        bad_copy v;
+        bool thrown = false;
+        try {
+            p.set_value(v);
+        } catch (std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+        thrown = false;
+        try {
+            f.get();
+        } catch (std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
 void test_packaged_task()
 {
     {
@@ -298,6 +508,11 @@ void thr_func1()
     std::this_thread::sleep_for(std::chrono::seconds(1));
 }
 
+int thr_id(int x)
+{
+    return x;
+}
+
 void dot()
 {
     for (int i = 0; i < 30; i++) {
@@ -324,9 +539,61 @@ void test_foreign_thread_pool()
     std::cout << "check" << std::endl;
     pool(thr_func1);
     std::cout << "check" << std::endl;
+    // async_call returns a full featured future
+    future<int> r = pool.async_call(thr_func, 4).then([](future<int>& x) { return x.get() + 2; });
+    assert(r.get() == 42);
+    // A task of an unbounded pool can submit more than the ring holds to its own pool
+    std::vector<oneshot_future<int>> results;
+    pool([&]() {
+        for (int i = 0; i < 3000; i++) results.push_back(pool.async_call_oneshot(thr_id, i));
+    });
+    for (int i = 0; i < 3000; i++) assert(results[i].get() == i);
+    assert(pool.stats().queue_depth == 0);
     f.join();
 }
 
+void test_oneshot_thread()
+{
+    // Fiber completes, plain thread waits, then the other way around
+    oneshot_promise<int> p1;
+    oneshot_future<int> f1 = p1.get_future();
+    oneshot_promise<int> p2;
+    oneshot_future<int> f2 = p2.get_future();
+    std::thread t([&]() {
+        assert(f1.wait_for(std::chrono::milliseconds(10)) == future_status::timeout);
+        int v = f1.get();
+        p2.set_value(v * 10);
+    });
+    this_fiber::sleep_for(std::chrono::milliseconds(50));
+    p1.set_value(42);
+    assert(f2.get() == 420);
+    t.join();
+}
+
+void test_elastic_thread_pool()
+{
+    // 1 to 4 threads, room for 2 queued tasks, extra threads retire after 50ms idle
+    foreign_thread_pool pool(1, 4, 2, std::chrono::milliseconds(50));
+    assert(pool.stats().threads == 1);
+    auto slow = [](int x) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return x + 1;
+    };
+    std::vector<oneshot_future<int>> results;
+    // Submitting more than the queue holds parks this fiber instead of failing
+    for (int i = 0; i < 16; i++) results.push_back(pool.async_call_oneshot(slow, i));
+    foreign_thread_pool::stats_type st = pool.stats();
+    assert(st.threads > 1 && st.threads <= 4);
+    assert(st.queue_depth <= 2);
+    for (int i = 0; i < 16; i++) assert(results[i].get() == i + 1);
+    this_fiber::sleep_for(std::chrono::milliseconds(300));
+    st = pool.stats();
+    assert(st.threads == 1);
+    assert(st.completed == 16);
+    assert(st.run_time >= std::chrono::milliseconds(16 * 20));
+    assert(st.wait_time > std::chrono::nanoseconds(0));
+}
+
 int fibio::main(int argc, char* argv[])
 {
     fiber_group fg;
@@ -334,6 +601,7 @@ int fibio::main(int argc, char* argv[])
     fg.create_fiber(test_async);
     fg.create_fiber(test_async_executor);
     fg.create_fiber(test_async_function);
+    fg.create_fiber(test_batched_async_function);
     fg.create_fiber(test_wait_for_any1);
     fg.create_fiber(test_wait_for_any2);
     fg.create_fiber(test_wait_for_any3);
@@ -347,8 +615,18 @@ int fibio::main(int argc, char* argv[])
     fg.create_fiber(test_then2);
     fg.create_fiber(test_then3);
     fg.create_fiber(test_then4);
+    fg.create_fiber(test_then_executor);
+    fg.create_fiber(test_then_exception);
+    fg.create_fiber(test_when_all1);
+    fg.create_fiber(test_when_all2);
+    fg.create_fiber(test_when_any1);
+    fg.create_fiber(test_when_any2);
+    fg.create_fiber(test_pooled_allocator);
+    fg.create_fiber(test_oneshot);
     fg.create_fiber(test_packaged_task);
     fg.create_fiber(test_foreign_thread_pool);
+    fg.create_fiber(test_oneshot_thread);
+    fg.create_fiber(test_elastic_thread_pool);
     fg.join_all();
     std::cout << "main_fiber exiting" << std::endl;
     return 0;
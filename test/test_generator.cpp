@@ -0,0 +1,102 @@
+//
+//  test_generator.cpp
+//  fibio
+//
+//  Copyright (c) 2026 0d0a.com. All rights reserved.
+//
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fibio/fiber.hpp>
+#include <fibio/fiberize.hpp>
+
+using namespace fibio;
+
+void test_range()
+{
+    int produced = 0;
+    generator<int> g([&](generator<int>::yield_type& yield) {
+        for (int i = 0; i < 10; i++) {
+            produced++;
+            yield(i);
+        }
+    });
+    // Nothing runs before the first value is requested
+    this_fiber::sleep_for(std::chrono::milliseconds(10));
+    assert(produced == 0);
+    int expected = 0;
+    for (int i : g) {
+        // Values are produced one at a time
+        assert(produced == expected + 1);
+        assert(i == expected);
+        expected++;
+    }
+    assert(expected == 10);
+}
+
+void test_blocking_body()
+{
+    generator<std::string> g([](generator<std::string>::yield_type& yield) {
+        for (int i = 0; i < 3; i++) {
+            // Body can block in between
+            this_fiber::sleep_for(std::chrono::milliseconds(10));
+            yield(std::to_string(i));
+        }
+    });
+    std::vector<std::string> v;
+    for (auto& s : g) v.push_back(std::move(s));
+    assert((v == std::vector<std::string>{"0", "1", "2"}));
+}
+
+void test_exception()
+{
+    generator<int> g([](generator<int>::yield_type& yield) {
+        yield(1);
+        throw std::runtime_error("oops");
+    });
+    int n = 0;
+    bool caught = false;
+    try {
+        for (int i : g) n += i;
+    } catch (std::runtime_error&) {
+        caught = true;
+    }
+    assert(n == 1);
+    assert(caught);
+}
+
+void test_early_exit()
+{
+    bool unwound = false;
+    {
+        struct guard
+        {
+            ~guard() { flag = true; }
+            bool& flag;
+        };
+        generator<int> g([&](generator<int>::yield_type& yield) {
+            guard gd{unwound};
+            for (int i = 0;; i++) yield(i);
+        });
+        for (int i : g) {
+            if (i == 5) break;
+        }
+    }
+    // The endless body is unwound when the generator goes away
+    assert(unwound);
+}
+
+int fibio::main(int argc, char* argv[])
+{
+    fiber_group fg;
+    fg.create_fiber(test_range);
+    fg.create_fiber(test_blocking_body);
+    fg.create_fiber(test_exception);
+    fg.create_fiber(test_early_exit);
+    fg.join_all();
+    std::cout << "main_fiber exiting" << std::endl;
+    return 0;
+}
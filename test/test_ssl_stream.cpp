@@ -94,11 +94,144 @@ void ssl_parent()
     f.join();
 }
 
+void load_server_certificate(ssl::context& ctx)
+{
+    boost::system::error_code ec;
+    ctx.set_options(ssl::context::default_workarounds | ssl::context::no_sslv2
+                    | ssl::context::single_dh_use);
+    ctx.set_password_callback(
+        [](std::size_t, ssl::context::password_purpose) -> std::string { return "test"; });
+    ctx.use_certificate_chain_file("server.pem", ec);
+    assert(!ec);
+    ctx.use_private_key_file("server.pem", ssl::context::pem, ec);
+    assert(!ec);
+    ctx.use_tmp_dh_file("dh2048.pem", ec);
+    assert(!ec);
+}
+
+// Reconnects resume the session, from the server side cache or from a ticket
+void test_session_resumption(bool tickets)
+{
+    const int rounds = 4;
+    ssl::context server_ctx(ssl::context::sslv23_server);
+    load_server_certificate(server_ctx);
+    ssl::session_cache cache;
+    ssl::ticket_keys keys;
+    if (tickets) {
+        keys.attach(server_ctx);
+    } else {
+        server_ctx.set_options(SSL_OP_NO_TICKET);
+        cache.attach(server_ctx);
+    }
+    ssl::tcp_stream_acceptor acc("127.0.0.1:23458");
+    fiber server([&]() {
+        for (int i = 0; i < rounds; i++) {
+            ssl::tcp_stream str(server_ctx);
+            boost::system::error_code ec = acc(str);
+            assert(!ec);
+            std::string line;
+            std::getline(str, line);
+            assert(line == "hello");
+            str << "world" << std::endl;
+            // Waits for the client to close so all tickets are sent
+            std::getline(str, line);
+            str.close();
+        }
+    });
+
+    ssl::context client_ctx(ssl::context::sslv23_client);
+    boost::system::error_code ec;
+    client_ctx.load_verify_file("ca.pem", ec);
+    assert(!ec);
+    ssl::client_session_cache client_cache;
+    client_cache.attach(client_ctx);
+    for (int i = 0; i < rounds; i++) {
+        ssl::tcp_stream str(client_ctx);
+        ec = str.connect("127.0.0.1:23458");
+        assert(!ec);
+        str << "hello" << std::endl;
+        std::string line;
+        std::getline(str, line);
+        assert(line == "world");
+        str.close();
+    }
+    server.join();
+    acc.close();
+
+    // Only the first connection does a full handshake
+    assert(client_cache.misses() == 1);
+    assert(client_cache.hits() == rounds - 1);
+    if (tickets) {
+        assert(keys.hits() == rounds - 1);
+        assert(keys.misses() == 0);
+    } else {
+        assert(cache.hits() == rounds - 1);
+        assert(cache.size() >= 1);
+    }
+}
+
+// Handshakes run on the crypto pool, accepting goes on while earlier handshakes are in progress
+void test_handshake_offload()
+{
+    const int clients = 8;
+    ssl::context server_ctx(ssl::context::sslv23_server);
+    load_server_certificate(server_ctx);
+    ssl::handshake_offload offload(1, 2);
+    ssl::tcp_stream_acceptor acc("127.0.0.1:23459");
+    acc.set_handshake_offload(&offload);
+    fiber server([&]() {
+        fiber_group servants;
+        for (int i = 0; i < clients; i++) {
+            std::unique_ptr<ssl::tcp_stream> str(new ssl::tcp_stream(server_ctx));
+            boost::system::error_code ec;
+            acc.accept_connection(*str, ec);
+            assert(!ec);
+            servants.create_fiber([&acc](std::unique_ptr<ssl::tcp_stream> s) {
+                boost::system::error_code ec;
+                acc.handshake(*s, ec);
+                assert(!ec);
+                std::string line;
+                std::getline(*s, line);
+                *s << line << std::endl;
+                s->close();
+            }, std::move(str));
+        }
+        servants.join_all();
+    });
+
+    ssl::context client_ctx(ssl::context::sslv23_client);
+    boost::system::error_code ec;
+    client_ctx.load_verify_file("ca.pem", ec);
+    assert(!ec);
+    fiber_group fibers;
+    for (int i = 0; i < clients; i++) {
+        fibers.create_fiber([&client_ctx, i]() {
+            ssl::tcp_stream str(client_ctx);
+            boost::system::error_code ec = str.connect("127.0.0.1:23459");
+            assert(!ec);
+            str << i << std::endl;
+            std::string line;
+            std::getline(str, line);
+            assert(line == std::to_string(i));
+            str.close();
+        });
+    }
+    fibers.join_all();
+    server.join();
+    acc.close();
+    assert(offload.offloaded() > 0);
+    assert(offload.active() == 0);
+    assert(offload.waiting() == 0);
+}
+
 int fibio::main(int argc, char* argv[])
 {
     fiber_group fibers;
     fibers.create_fiber(ssl_parent);
     fibers.join_all();
+    test_session_resumption(false);
+    test_session_resumption(true);
+    test_handshake_offload();
     std::cout << "main_fiber exiting" << std::endl;
     return 0;
 }
@@ -6,9 +6,14 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
 #include <boost/random.hpp>
 #include <boost/lexical_cast.hpp>
 #include <fibio/fiber.hpp>
@@ -63,10 +68,583 @@ void parent()
     f.join();
 }
 
+void test_buffer_options()
+{
+    const std::size_t total = 1024 * 1024;
+    fiber f([total]() {
+        stream::tcp_stream str;
+        // Big buffers for bulk transfer
+        str.set_buffer_size(64 * 1024, 64 * 1024);
+        assert(str.rdbuf()->get_buffer_size() == 64 * 1024);
+        boost::system::error_code ec = str.connect("127.0.0.1:12346");
+        assert(!ec);
+        for (std::size_t i = 0; i < total; i++) str.put(char('a' + i % 26));
+        str.flush();
+        // Idle for a while, then send more
+        this_fiber::sleep_for(std::chrono::milliseconds(50));
+        str << "done" << std::endl;
+        str.close();
+    });
+    tcp_stream_acceptor acc("127.0.0.1:12346");
+    stream::tcp_stream str;
+    // Small buffers, and no buffer held while waiting for data
+    str.set_buffer_size(512, 512);
+    str.set_release_when_idle(true);
+    boost::system::error_code ec;
+    acc(str, ec);
+    assert(!ec);
+    for (std::size_t i = 0; i < total; i++) assert(str.get() == 'a' + i % 26);
+    std::string line;
+    std::getline(str, line);
+    assert(line == "done");
+    str.close();
+    acc.close();
+    f.join();
+}
+
+void test_write_buffers()
+{
+    std::string body(100000, 'x');
+    fiber f([&body]() {
+        stream::tcp_stream str;
+        boost::system::error_code ec = str.connect("127.0.0.1:12347");
+        assert(!ec);
+        // Buffered header and 2 user buffers go out in one gathered write
+        std::vector<boost::asio::const_buffer> bufs{boost::asio::buffer(body),
+                                                    boost::asio::buffer("\nend\n", 5)};
+        str << "header\n";
+        str.write_buffers(bufs);
+        assert(str.good());
+        str.write_direct("tail\n", 5);
+        str.flush();
+        str.close();
+    });
+    tcp_stream_acceptor acc("127.0.0.1:12347");
+    stream::tcp_stream str;
+    boost::system::error_code ec;
+    acc(str, ec);
+    assert(!ec);
+    std::string line;
+    std::getline(str, line);
+    assert(line == "header");
+    std::getline(str, line);
+    assert(line == body);
+    std::getline(str, line);
+    assert(line == "end");
+    std::getline(str, line);
+    assert(line == "tail");
+    str.close();
+    acc.close();
+    f.join();
+}
+
+void test_read_paths()
+{
+    std::string payload;
+    for (int i = 0; i < 200000; i++) payload.push_back(char('a' + i % 26));
+    fiber f([&payload]() {
+        stream::tcp_stream str;
+        boost::system::error_code ec = str.connect("127.0.0.1:12348");
+        assert(!ec);
+        str << "GET / HTTP/1.1\r\nHost: x\r\n\r\n" << payload << "tail\n";
+        str.flush();
+        str.close();
+    });
+    tcp_stream_acceptor acc("127.0.0.1:12348");
+    stream::tcp_stream str;
+    boost::system::error_code ec;
+    acc(str, ec);
+    assert(!ec);
+    std::string header;
+    str.read_until(header, "\r\n\r\n");
+    assert(header == "GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    // Larger than the stream buffer, goes directly into the caller's memory
+    std::vector<char> v(100000);
+    str.read(&v[0], v.size());
+    assert(str.gcount() == 100000);
+    assert(std::equal(v.begin(), v.end(), payload.begin()));
+    // The tail of the direct read can be put back
+    assert(str.unget() && str.get() == v.back());
+    // Scattered read
+    char a[30000], b[70000];
+    std::vector<boost::asio::mutable_buffer> bufs{boost::asio::buffer(a), boost::asio::buffer(b)};
+    assert(str.read_into(bufs) == 100000);
+    assert(std::equal(a, a + sizeof(a), payload.begin() + 100000));
+    assert(std::equal(b, b + sizeof(b), payload.begin() + 130000));
+    std::string line;
+    std::getline(str, line);
+    assert(line == "tail");
+    // Stream ends before the delimiter
+    str.read_until(line, "\n");
+    assert(line.empty() && str.eof());
+    str.close();
+    acc.close();
+    f.join();
+    // Delimiter split over several reads, after a partial match that fails
+    fiber g([]() {
+        stream::tcp_stream str;
+        boost::system::error_code ec = str.connect("127.0.0.1:12359");
+        assert(!ec);
+        for (const char* s : {"ab\r\n", "\r", "\r\n\r\nrest\n"}) {
+            str << s;
+            str.flush();
+            this_fiber::sleep_for(std::chrono::milliseconds(20));
+        }
+        str.close();
+    });
+    tcp_stream_acceptor acc2("127.0.0.1:12359");
+    stream::tcp_stream str2;
+    acc2(str2, ec);
+    assert(!ec);
+    str2.read_until(header, "\r\n\r\n");
+    assert(header == "ab\r\n\r\r\n\r\n");
+    std::getline(str2, line);
+    assert(line == "rest");
+    str2.close();
+    acc2.close();
+    g.join();
+}
+
+// TCP socket counts its writes, so the test can tell how many replies went out together
+struct counting_socket : boost::asio::ip::tcp::socket
+{
+    explicit counting_socket(boost::asio::io_service& iosvc) : boost::asio::ip::tcp::socket(iosvc)
+    {
+    }
+
+    template <typename ConstBufferSequence, typename WriteHandler>
+    auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+        -> decltype(std::declval<boost::asio::ip::tcp::socket&>().async_write_some(
+            buffers, std::forward<WriteHandler>(handler)))
+    {
+        writes++;
+        return boost::asio::ip::tcp::socket::async_write_some(
+            buffers, std::forward<WriteHandler>(handler));
+    }
+
+    std::size_t writes = 0;
+};
+
+namespace fibio {
+namespace stream {
+namespace detail {
+
+template <>
+struct readiness<counting_socket> : readiness<boost::asio::ip::tcp::socket>
+{
+};
+
+} // End of namespace detail
+} // End of namespace stream
+} // End of namespace fibio
+
+void test_coalesce()
+{
+    fiber f([]() {
+        stream::iostream<counting_socket> str;
+        boost::system::error_code ec;
+        str.rdbuf()->async_connect(
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"),
+                                           12349),
+            asio::yield[ec]);
+        assert(!ec);
+        str.rdbuf()->set_option(boost::asio::ip::tcp::no_delay(true));
+        str.set_coalesce(true);
+        // The pipelined requests take many reads to get in
+        str.rdbuf()->set_buffer_size(512, 64 * 1024);
+        // Replies to pipelined requests stay in the buffer until a read would block
+        std::string line;
+        while (std::getline(str, line)) {
+            if (line == "quit") break;
+            str << boost::lexical_cast<int>(line.substr(0, line.find(' '))) * 2 << '\n';
+        }
+        // One write per read of the requests without coalescing
+        assert(str.rdbuf()->writes < 5);
+        str.close();
+    });
+    tcp_stream_acceptor acc("127.0.0.1:12349");
+    stream::tcp_stream str;
+    boost::system::error_code ec;
+    acc(str, ec);
+    assert(!ec);
+    str.set_duplex_mode(stream::full_duplex);
+    // All requests go in one write
+    str.set_buffer_size(64 * 1024, 64 * 1024);
+    for (int i = 0; i < 100; i++) str << i << ' ' << std::string(100, 'x') << '\n';
+    str.flush();
+    std::string line;
+    for (int i = 0; i < 100; i++) {
+        std::getline(str, line);
+        assert(boost::lexical_cast<int>(line) == i * 2);
+    }
+    str << "quit" << std::endl;
+    str.close();
+    acc.close();
+    f.join();
+}
+
+void test_send_file_and_splice()
+{
+    // File -> sender -> proxy -> sink, the proxy moves data with splice
+    char path[] = "/tmp/fibio_send_file_XXXXXX";
+    int fd = ::mkstemp(path);
+    assert(fd >= 0);
+    ::unlink(path);
+    std::string content;
+    for (int i = 0; i < 200000; i++) content.push_back(char('a' + i % 26));
+    assert(::write(fd, content.data(), content.size()) == ssize_t(content.size()));
+    tcp_stream_acceptor proxy_acc("127.0.0.1:12350");
+    tcp_stream_acceptor sink_acc("127.0.0.1:12351");
+    fiber sender([&]() {
+        stream::tcp_stream str;
+        boost::system::error_code ec = str.connect("127.0.0.1:12350");
+        assert(!ec);
+        // Buffered output goes before the file
+        str << "head:";
+        str.rdbuf()->native_non_blocking(false);
+        assert(str.send_file(fd, 10, content.size() - 10) == content.size() - 10);
+        assert(str);
+        // The socket is switched back to blocking mode
+        assert(!str.rdbuf()->native_non_blocking());
+        str.close();
+    });
+    fiber proxy([&]() {
+        stream::tcp_stream in;
+        boost::system::error_code ec;
+        proxy_acc(in, ec);
+        assert(!ec);
+        // Takes some data into the get buffer before splicing
+        char c;
+        in.get(c);
+        assert(c == 'h');
+        stream::tcp_stream out;
+        ec = out.connect("127.0.0.1:12351");
+        assert(!ec);
+        in.rdbuf()->native_non_blocking(false);
+        out.rdbuf()->native_non_blocking(false);
+        std::size_t n = stream::splice(in, out, ec);
+        assert(!ec);
+        assert(n == 4 + content.size() - 10);
+        assert(!in.rdbuf()->native_non_blocking() && !out.rdbuf()->native_non_blocking());
+        out.close();
+        in.close();
+    });
+    stream::tcp_stream str;
+    boost::system::error_code ec;
+    sink_acc(str, ec);
+    assert(!ec);
+    std::string received((std::istreambuf_iterator<char>(str)), std::istreambuf_iterator<char>());
+    assert(received == "ead:" + content.substr(10));
+    sender.join();
+    proxy.join();
+    proxy_acc.close();
+    sink_acc.close();
+    ::close(fd);
+}
+
+void test_compressed_stream()
+{
+    stream::compression codecs[] = {stream::compression::deflate,
+                                    stream::compression::gzip,
+                                    stream::compression::zstd,
+                                    stream::compression::lz4};
+    for (stream::compression c : codecs) {
+        // Every codec found by the build must work, the others must be refused
+        bool built = true;
+#ifndef HAVE_ZLIB
+        if (c == stream::compression::deflate || c == stream::compression::gzip) built = false;
+#endif
+#ifndef HAVE_ZSTD
+        if (c == stream::compression::zstd) built = false;
+#endif
+#ifndef HAVE_LZ4
+        if (c == stream::compression::lz4) built = false;
+#endif
+        assert(stream::detail::compression_supported(c) == built);
+        if (!built) {
+            std::stringbuf sb;
+            bool refused = false;
+            try {
+                stream::compressed_streambuf z(&sb, c);
+            } catch (boost::system::system_error&) {
+                refused = true;
+            }
+            assert(refused);
+            continue;
+        }
+        tcp_stream_acceptor acc("127.0.0.1:12352");
+        fiber f([c]() {
+            stream::tcp_stream str;
+            boost::system::error_code ec = str.connect("127.0.0.1:12352");
+            assert(!ec);
+            stream::compressed_stream z(str, c);
+            // Two messages over the same codec contexts
+            for (int m = 0; m < 2; m++) {
+                for (int i = 0; i < 5000; i++) z << i << '\n';
+                z << "quit" << std::endl;
+                z.finish();
+                long sum = 0;
+                z >> sum;
+                assert(sum == 12497500);
+            }
+        });
+        stream::tcp_stream str;
+        boost::system::error_code ec;
+        acc(str, ec);
+        assert(!ec);
+        stream::compressed_stream z(str, c);
+        for (int m = 0; m < 2; m++) {
+            std::string line;
+            long sum = 0;
+            while (std::getline(z, line) && line != "quit") sum += boost::lexical_cast<long>(line);
+            z << sum << '\n';
+            z.finish();
+        }
+        f.join();
+        assert(!z.rdbuf()->failed());
+        acc.close();
+    }
+}
+
+void test_udp()
+{
+    udp_socket server("127.0.0.1:12353");
+    udp_socket client;
+    boost::system::error_code ec = client.connect("127.0.0.1:12353");
+    assert(!ec);
+    datagram_batch out(32, 64);
+    for (int i = 0; i < 32; i++) {
+        std::string s = boost::lexical_cast<std::string>(i);
+        assert(out.push(s.data(), s.size()));
+    }
+    assert(out.full());
+    assert(client.send_batch(out, ec) == 32);
+    assert(!ec);
+    datagram_batch in(16, 64);
+    int expected = 0;
+    while (expected < 32) {
+        std::size_t n = server.receive_batch(in, ec);
+        assert(!ec && n > 0 && n == in.size());
+        for (std::size_t i = 0; i < n; i++) {
+            std::string s(in.data(i), in.length(i));
+            assert(boost::lexical_cast<int>(s) == expected++);
+            assert(in.endpoint(i) == client.local_endpoint());
+            assert(!in.truncated(i));
+        }
+    }
+    // Reply to the sources of a received batch
+    datagram_batch reply(16, 64);
+    for (std::size_t i = 0; i < in.size(); i++) reply.push("ok", 2, in.endpoint(i));
+    assert(server.send_batch(reply, ec) == in.size());
+    char buf[16];
+    assert(client.receive(buf, sizeof(buf), ec) == 2);
+    assert(!ec && std::string(buf, 2) == "ok");
+    server.close();
+    client.close();
+
+    // Datagrams fan out to the worker fibers of a listener
+    std::atomic<int> received(0);
+    std::atomic<long> sum(0);
+    udp_listener l("127.0.0.1:12354", 2, 8);
+    l.start([&](const char* data, std::size_t size, const udp_listener::endpoint_type& from) {
+        sum += boost::lexical_cast<long>(std::string(data, size));
+        received++;
+    });
+    // The socket is bound by `start`, binding the same address again fails in the caller
+    udp_listener busy("127.0.0.1:12354");
+    ec = busy([](const char*, std::size_t, const udp_listener::endpoint_type&) {});
+    assert(ec == boost::asio::error::address_in_use);
+    udp_socket sender;
+    ec = sender.connect("127.0.0.1:12354");
+    assert(!ec);
+    for (int m = 0; m < 10; m++) {
+        datagram_batch b(20, 16);
+        for (int i = 0; i < 20; i++) {
+            std::string s = boost::lexical_cast<std::string>(m * 20 + i);
+            b.push(s.data(), s.size());
+        }
+        assert(sender.send_batch(b, ec) == 20);
+        this_fiber::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (int i = 0; i < 1000 && received < 200; i++) {
+        this_fiber::sleep_for(std::chrono::milliseconds(1));
+    }
+    l.stop();
+    l.join();
+    assert(received == 200);
+    assert(sum == 19900);
+}
+
+void test_reuse_port_listener()
+{
+    std::atomic<int> served(0);
+    tcp_listener l("127.0.0.1:12355");
+    // Several SO_REUSEPORT sockets, each with its own accepting fiber
+    l.set_acceptors(4);
+    l.set_accept_batch(8);
+    l.start([&](tcp_stream& s) {
+        std::string line;
+        while (std::getline(s, line)) s << line << std::endl;
+        served++;
+    });
+    // The sockets listen once `start` returns, blocking connects keep the only scheduler thread
+    // until all connections wait in the backlogs, so every acceptor has some to drain
+    std::vector<std::unique_ptr<stream::tcp_stream>> clients;
+    for (int i = 0; i < 20; i++) {
+        clients.emplace_back(new stream::tcp_stream);
+        boost::system::error_code ec;
+        clients.back()->stream_descriptor().connect(l.endpoint(), ec);
+        assert(!ec);
+    }
+    for (int i = 0; i < 20; i++) {
+        *clients[i] << i << std::endl;
+        std::string line;
+        std::getline(*clients[i], line);
+        assert(boost::lexical_cast<int>(line) == i);
+        clients[i]->close();
+    }
+    for (int i = 0; i < 1000 && served < 20; i++) {
+        this_fiber::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(served == 20);
+    l.stop();
+    l.join();
+    std::size_t busy = 0;
+    std::uint64_t accepted = 0;
+    std::uint64_t batched = 0;
+    for (auto& a : l.acceptor_stats()) {
+        if (a.accepted) busy++;
+        accepted += a.accepted;
+        batched += a.batched;
+    }
+    assert(l.acceptor_stats().size() == 4);
+    assert(accepted == 20);
+    assert(busy > 1);
+    assert(batched > 0);
+}
+
+// Polls `pred` until it holds or a few seconds have passed, returns the last result
+template <typename Pred>
+bool poll_until(Pred pred)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!pred() && std::chrono::steady_clock::now() < deadline) {
+        this_fiber::sleep_for(std::chrono::milliseconds(1));
+    }
+    return pred();
+}
+
+void test_admission_control()
+{
+    promise<void> gate;
+    shared_future<void> opened = gate.get_future().share();
+    std::atomic<int> served(0);
+    tcp_listener l("127.0.0.1:12356");
+    l.admission().set_max_connections(2);
+    l.start([&served, opened](tcp_stream& s) {
+        served++;
+        opened.wait();
+        s << "done" << std::endl;
+    });
+    std::vector<fiber> clients;
+    for (int i = 0; i < 4; i++) {
+        clients.emplace_back([]() {
+            stream::tcp_stream str;
+            boost::system::error_code ec = str.connect("127.0.0.1:12356");
+            assert(!ec);
+            std::string line;
+            std::getline(str, line);
+            assert(line == "done");
+        });
+    }
+    // The other connections wait in the backlog until a slot is free, once the accepting fiber
+    // is paused nothing else is taken
+    assert(poll_until([&]() { return l.admission().stats().paused == 1; }));
+    assert(served == 2);
+    assert(l.admission().active() == 2);
+    gate.set_value();
+    for (fiber& c : clients) c.join();
+    assert(poll_until([&]() { return l.admission().active() == 0; }));
+    assert(served == 4);
+    assert(l.admission().stats().admitted == 4);
+    l.stop();
+    l.join();
+
+    // A second connection from the same address is closed right away
+    tcp_listener l2("127.0.0.1:12357");
+    l2.admission().set_max_connections_per_source(1);
+    l2.start([](tcp_stream& s) {
+        std::string line;
+        while (std::getline(s, line)) s << line << std::endl;
+    });
+    stream::tcp_stream a;
+    boost::system::error_code ec = a.connect("127.0.0.1:12357");
+    assert(!ec);
+    std::string line;
+    a << "a" << std::endl;
+    std::getline(a, line);
+    assert(line == "a");
+    stream::tcp_stream b;
+    ec = b.connect("127.0.0.1:12357");
+    assert(!ec);
+    b << "b" << std::endl;
+    assert(!std::getline(b, line));
+    assert(l2.admission().stats().rejected_per_source == 1);
+    a.close();
+    b.close();
+    l2.stop();
+    l2.join();
+
+    // Acceptors reserve slots under the lock, several of them never go past the limit
+    promise<void> gate3;
+    shared_future<void> opened3 = gate3.get_future().share();
+    std::atomic<int> served3(0);
+    std::atomic<int> inside(0);
+    std::atomic<int> peak(0);
+    tcp_listener l3("127.0.0.1:12358");
+    l3.set_acceptors(4);
+    l3.admission().set_max_connections(2);
+    l3.start([&served3, &inside, &peak, opened3](tcp_stream& s) {
+        served3++;
+        int n = ++inside;
+        for (int p = peak; n > p && !peak.compare_exchange_weak(p, n);) {
+        }
+        opened3.wait();
+        s << "done" << std::endl;
+        inside--;
+    });
+    std::vector<std::unique_ptr<stream::tcp_stream>> waiting;
+    for (int i = 0; i < 8; i++) {
+        waiting.emplace_back(new stream::tcp_stream);
+        waiting.back()->stream_descriptor().connect(l3.endpoint(), ec);
+        assert(!ec);
+    }
+    assert(poll_until([&]() { return served3 == 2 && l3.admission().stats().paused > 0; }));
+    assert(l3.admission().active() == 2);
+    gate3.set_value();
+    for (auto& c : waiting) {
+        std::getline(*c, line);
+        assert(line == "done");
+    }
+    assert(served3 == 8);
+    assert(peak == 2);
+    l3.stop();
+    l3.join();
+}
+
 int fibio::main(int argc, char* argv[])
 {
     fiber_group fibers;
     fibers.create_fiber(parent);
+    fibers.create_fiber(test_buffer_options);
+    fibers.create_fiber(test_write_buffers);
+    fibers.create_fiber(test_read_paths);
+    fibers.create_fiber(test_coalesce);
+    fibers.create_fiber(test_send_file_and_splice);
+    fibers.create_fiber(test_compressed_stream);
+    fibers.create_fiber(test_udp);
+    fibers.create_fiber(test_reuse_port_listener);
+    fibers.create_fiber(test_admission_control);
     fibers.join_all();
     std::cout << "main_fiber exiting" << std::endl;
     return 0;